@@ -0,0 +1,27 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Boot-time microbenchmarks, built with BENCH=1 (CONFIG_BENCH). Each one
+// runs on the boot CPU once its subsystem is up and prints its results
+// over the UART. bench_virtio_blk(), bench_ipc() and bench_sync() need
+// blocking and wakeups, so they must be called from a task. kernel.c runs
+// them one after another in a single task before starting any other, so
+// none is measured against unrelated load.
+
+#ifdef CONFIG_BENCH
+void bench_kmalloc(void);
+void bench_tlb(void);
+void bench_string(void);
+void bench_virtio_blk(void);
+void bench_ipc(void);
+void bench_sync(void);
+#else
+static inline void bench_kmalloc(void) {}
+static inline void bench_tlb(void) {}
+static inline void bench_string(void) {}
+static inline void bench_virtio_blk(void) {}
+static inline void bench_ipc(void) {}
+static inline void bench_sync(void) {}
+#endif
+
+#endif  // BENCH_H
@@ -0,0 +1,21 @@
+#ifndef BOOTTIME_H
+#define BOOTTIME_H
+
+#include <stdint.h>
+
+// Boot-phase timing on CNTPCT_EL0. boot.s stamps _start; kernel_main()
+// marks the end of each init phase and prints one summary line before
+// handing the boot CPU to the scheduler.
+#define BOOT_MAX_PHASES 16
+
+extern uint64_t boot_start_ticks;  // CNTPCT_EL0 at _start (boot.s)
+
+// End the current phase, named 'name' (a string literal), now. Phases past
+// BOOT_MAX_PHASES are folded into the last one.
+void boot_phase(const char *name);
+
+// Print "Boot: <total> us to first task (<phase> <us>, ...)". Needs
+// timer_init_periodic() for the counter frequency.
+void boot_time_report(void);
+
+#endif  // BOOTTIME_H
@@ -0,0 +1,69 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdint.h>
+
+#include "spinlock.h"
+#include "wait.h"
+
+// Message channels between tasks.
+//
+// A channel is a ring of fixed-size message slots. channel_send() copies a
+// message into the next free slot and channel_recv() copies the oldest one
+// out; a sender finding the ring full, or a receiver finding it empty,
+// blocks (TASK_BLOCKED) until its peer makes room or delivers, and the
+// peer wakes it directly rather than leaving it for a timer tick. Any
+// number of tasks may send and receive on one channel; each message goes
+// to exactly one receiver, in order.
+//
+// Small payloads travel inline in the slot. Large ones move by ownership:
+// the sender puts a kmalloc() buffer in 'buf', loses it on a successful
+// send (msg->buf is cleared), and the receiver gets the same pointer and
+// must kfree() it. Nothing but the 64-byte slot is ever copied.
+
+#define CHANNEL_INLINE_SIZE 40  // Inline payload bytes per message
+
+typedef struct {
+    uint64_t tag;  // Caller-defined
+    void *buf;     // Optional kmalloc() buffer handed to the receiver
+    uint64_t len;  // Length of 'buf'
+    uint8_t data[CHANNEL_INLINE_SIZE];
+} channel_msg_t;
+
+_Static_assert(sizeof(channel_msg_t) == 64, "one cache line per slot");
+
+typedef struct {
+    spinlock_t lock;
+    channel_msg_t *slots;
+    uint32_t mask;  // Slots minus one
+    volatile uint32_t closed;
+    uint64_t head;  // Free-running: next slot to fill
+    uint64_t tail;  // Next slot to take
+    wait_queue_t not_full;   // Senders waiting for a free slot
+    wait_queue_t not_empty;  // Receivers waiting for a message
+} channel_t;
+
+// New channel with 'slots' message slots (rounded up to a power of two).
+// NULL when out of memory.
+channel_t *channel_create(uint32_t slots);
+
+// Free the channel and any buffers in undelivered messages. Nobody may be
+// using it or blocked on it.
+void channel_destroy(channel_t *ch);
+
+// Stop the channel: blocked and later senders fail, and receivers fail
+// once the messages already queued have been taken.
+void channel_close(channel_t *ch);
+
+// Send or receive one message, blocking while the ring is full or empty.
+// Task context only. Return 0, or -1 if the channel is closed (or when
+// called from outside a task).
+int channel_send(channel_t *ch, channel_msg_t *msg);
+int channel_recv(channel_t *ch, channel_msg_t *msg);
+
+// As above without blocking, also from IRQ context: -1 if the ring is
+// full or empty, or the channel closed.
+int channel_try_send(channel_t *ch, channel_msg_t *msg);
+int channel_try_recv(channel_t *ch, channel_msg_t *msg);
+
+#endif  // CHANNEL_H
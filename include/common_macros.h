@@ -20,9 +20,42 @@
 // We are using the EL1 Physical Timer, so ID 30.
 #define INTERRUPT_ID_CNTPNSIRQ 30  // EL1 Physical Timer IRQ ID
 
+// PL011 UART0 on QEMU 'virt': SPI 1.
+#define INTERRUPT_ID_UART0 33
+
+// virtio-mmio transport n on QEMU 'virt': SPI 16 + n (see virtio.h).
+#define INTERRUPT_ID_VIRTIO_MMIO 48
+
+// SGI used as the reschedule IPI between cores.
+#define INTERRUPT_ID_IPI_RESCHEDULE 0
+
+// SMP related macros
+#define MAX_CPUS 4                  // Cores brought up via PSCI CPU_ON
+#define CPU_BOOT_STACK_SIZE 16384   // Boot/IRQ stack for each secondary core
+#define CPU_FAULT_STACK_SIZE 8192   // Entry stack for growing task stacks
+
+// Memory layout (QEMU 'virt'). The RAM size normally comes from the device
+// tree; RAM_SIZE_DEFAULT matches -m 64M in the Makefile for when there is
+// none. QEMU gives an ELF kernel no DTB and no initrd, so 'make run' loads
+// them itself: the DTB at DTB_LOAD_ADDR (DTB_ADDR in the Makefile), in the
+// last MiB of that RAM, and any initrd at INITRD_LOAD_ADDR (INITRD_ADDR),
+// which leaves it 31 MiB.
+#define RAM_BASE 0x40000000UL
+#define RAM_SIZE_DEFAULT (64UL * 1024 * 1024)
+#define DTB_LOAD_ADDR 0x43f00000UL
+#define INITRD_LOAD_ADDR 0x42000000UL
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_MAX_ORDER 10  // Largest page_alloc() block: 2^10 pages (4 MiB)
+
 // Task related macros
-#define MAX_TASKS 16          // Maximum number of tasks in the system
-#define TASK_STACK_SIZE 4096  // Stack size for each task in bytes (e.g., 4KB)
+// Default stack reservation. Only the pages a task actually touches are
+// backed by memory (see kstack.c).
+#define TASK_STACK_SIZE (64 * 1024)
+#define NUM_PRIORITY_LEVELS 32  // Scheduler priority levels (0 = highest)
+
+// Initial per-CPU hrtimer heap capacity; the heap grows on demand.
+#define HRTIMER_HEAP_INITIAL 64
 
 // Other common macros can go here
 
@@ -46,6 +46,13 @@ typedef struct {
     uint64_t lr;  // x30 (Link Register)
 } context_state_t;
 
+// SVC immediates handled by c_sync_handler(). Each calls schedule() like
+// task_yield(), task_block() and task_exit() do from kernel context; the
+// caller must already have set its state for SVC_BLOCK and SVC_EXIT.
+#define SVC_YIELD 0  // Give up the CPU, stay runnable
+#define SVC_BLOCK 1  // Caller already marked itself TASK_BLOCKED
+#define SVC_EXIT 2   // Caller already marked itself TASK_ZOMBIE
+
 // Function declarations
 void exceptions_init(void);  // Initializes exception handling (e.g., VBAR_EL1)
 void enable_interrupts(void);  // Enables IRQs (e.g., msr daifclr, #2)
@@ -53,10 +60,8 @@ void disable_interrupts(
     void);  // Disables IRQs (e.g., msr daifset, #2) - if you have it
 
 // C handlers for exceptions (called from assembly)
-void c_sync_handler(uint64_t esr_el1,
-                    context_state_t *ctx);     // Pass ESR_EL1 explicitly
-uint64_t c_irq_handler(context_state_t *ctx);  // c_irq_handler now returns the
-                                               // SP of the next task to run
+void c_sync_handler(uint64_t esr_el1, context_state_t *ctx);
+void c_irq_handler(context_state_t *ctx);  // May switch tasks via schedule()
 void minimal_fiq_print(void);
 void minimal_serror_print(void);
 
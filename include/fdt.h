@@ -0,0 +1,26 @@
+#ifndef FDT_H
+#define FDT_H
+
+#include <stdint.h>
+
+// Minimal read-only flattened device tree (DTB) parser: just enough to
+// find the RAM QEMU gives us and the initrd it loaded.
+
+#define FDT_MAGIC 0xD00DFEED
+
+// Non-zero if 'fdt' points at a DTB header we understand.
+int fdt_valid(const void *fdt);
+
+// Size of the whole blob in bytes (header totalsize).
+uint32_t fdt_total_size(const void *fdt);
+
+// First (base, size) pair of the "reg" property of the first /memory node.
+// Returns 0, or -1 if there is none.
+int fdt_find_memory(const void *fdt, uint64_t *base, uint64_t *size);
+
+// Physical range [start, end) of the initrd, from /chosen's
+// linux,initrd-start and linux,initrd-end. Returns 0, or -1 if there is
+// none.
+int fdt_find_initrd(const void *fdt, uint64_t *start, uint64_t *end);
+
+#endif  // FDT_H
@@ -0,0 +1,10 @@
+#ifndef FP_TASKS_H
+#define FP_TASKS_H
+
+#include <stdint.h>
+
+// Demo task using FP/SIMD registers (src/fp_tasks.c). 'arg' is a small
+// task number.
+void fp_task(void *arg);
+
+#endif  // FP_TASKS_H
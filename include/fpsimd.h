@@ -0,0 +1,33 @@
+#ifndef FPSIMD_H
+#define FPSIMD_H
+
+#include <stdint.h>
+
+// Saved FP/SIMD register file of a task: v0-v31, FPSR and FPCR.
+// The layout must match fpsimd_save_state/fpsimd_load_state in fpsimd.s.
+typedef struct {
+    uint64_t vregs[64];  // v0-v31, 128 bits each
+    uint32_t fpsr;
+    uint32_t fpcr;
+} __attribute__((aligned(16))) fpsimd_state_t;
+
+struct tcb;
+struct cpu;
+
+// Lazy FP/SIMD switching. CPACR_EL1.FPEN traps every FP/SIMD instruction
+// unless the running task's registers are the ones live in this CPU's
+// register file; the first trapping instruction saves the previous owner's
+// registers and loads the new owner's. The kernel itself is built with
+// -mgeneral-regs-only and never touches these registers.
+void fpsimd_cpu_init(void);
+void fpsimd_task_init(struct tcb *task);
+void fpsimd_switch_to(struct cpu *cpu, struct tcb *next);
+void fpsimd_task_exit(struct cpu *cpu, struct tcb *task);
+int fpsimd_state_live_on(struct cpu *cpu, struct tcb *task);
+void fpsimd_trap(void);  // EC 0x07 handler, called from c_sync_handler()
+
+// In fpsimd.s. FP/SIMD access must be enabled in CPACR_EL1 when called.
+void fpsimd_save_state(fpsimd_state_t *state);
+void fpsimd_load_state(const fpsimd_state_t *state);
+
+#endif  // FPSIMD_H
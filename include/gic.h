@@ -39,6 +39,12 @@
 
 // Function prototypes
 void gic_init(void);
+void gic_cpu_init(void);
+void gic_send_sgi(uint32_t sgi_id, uint8_t cpu_target_mask);
+
+// GICD_ITARGETSR target bit of the calling CPU (from the banked
+// GICD_ITARGETSR0), for routing an SPI to it.
+uint8_t gic_cpu_mask(void);
 void gic_enable_interrupt(uint32_t int_id, uint8_t core_target_mask,
                           uint8_t priority);
 uint32_t gic_read_iar(void);
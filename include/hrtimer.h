@@ -0,0 +1,40 @@
+#ifndef HRTIMER_H
+#define HRTIMER_H
+
+#include <stdint.h>
+
+// High-resolution one-shot timers on the EL1 physical timer.
+//
+// Each CPU keeps its pending timers in a binary min-heap ordered by absolute
+// expiry (in CNTPCT_EL0 ticks), and CNTP_CVAL_EL0 is always programmed with
+// the earliest one. Start and cancel are O(log n); finding the next expiry
+// is O(1).
+typedef struct hrtimer {
+    uint64_t expires;  // Absolute CNTPCT_EL0 value
+    // Runs in IRQ context on the CPU the timer was started on, with no
+    // hrtimer lock held, so it may re-start its own timer.
+    void (*callback)(struct hrtimer *timer);
+    void *data;
+    int32_t heap_index;  // Position in the CPU's heap, -1 when not queued
+    uint32_t cpu;        // CPU whose heap holds the timer
+} hrtimer_t;
+
+void hrtimer_init(hrtimer_t *timer, void (*callback)(hrtimer_t *timer),
+                  void *data);
+
+// Queue 'timer' on the calling CPU to fire at absolute counter value
+// 'expires' (re-queues it if already pending). Returns 0, or -1 if the
+// CPU's heap could not grow.
+int hrtimer_start(hrtimer_t *timer, uint64_t expires);
+
+// As hrtimer_start(), relative to now.
+int hrtimer_start_ns(hrtimer_t *timer, uint64_t delay_ns);
+
+// Remove a pending timer. Returns 1 if it was pending, 0 otherwise.
+int hrtimer_cancel(hrtimer_t *timer);
+
+// Timer PPI handler: runs every expired timer on this CPU and re-arms
+// CNTP_CVAL_EL0 for the earliest remaining one.
+void hrtimer_interrupt(void);
+
+#endif  // HRTIMER_H
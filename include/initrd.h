@@ -0,0 +1,62 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <stdint.h>
+
+// Read-only files from the initrd, a cpio archive in the "newc" format
+// (cpio -o -H newc). A loader that boots us like Linux names it in the
+// DTB's /chosen; 'make run' puts it at INITRD_LOAD_ADDR instead.
+//
+// initrd_init() walks the archive once and builds a hash index of path to
+// file; nothing is copied. Lookups are an FNV-1a hash and, on average, one
+// probe of an open-addressed table. File data is handed out as pointers
+// straight into the archive, which stays where it was loaded (its pages are
+// never given to the page allocator). Data is only 4-byte aligned, as the
+// format lays it out.
+//
+// Paths are as stored in the archive with any leading "./" or "/" removed
+// ("bin/init", not "./bin/init"). Only regular files are indexed.
+
+typedef struct {
+    const char *path;  // Points into the archive, NUL-terminated
+    const uint8_t *data;
+    uint64_t size;
+    uint32_t mode;  // st_mode from the archive
+} initrd_file_t;
+
+// A file opened for sequential reads.
+typedef struct {
+    const initrd_file_t *file;
+    uint64_t pos;
+} initrd_fd_t;
+
+// Size of the archive at 'start', through its trailer, or 0 if there is no
+// complete archive before 'limit'. Reads a byte at a time, so it is safe
+// with the MMU off.
+uint64_t initrd_probe(uint64_t start, uint64_t limit);
+
+// Index the archive in [start, end) (identity mapped). Needs kmalloc().
+// Returns the number of files, or -1 if the archive is malformed (files
+// before the damage stay indexed).
+int64_t initrd_init(uint64_t start, uint64_t end);
+
+// File at 'path', or NULL.
+const initrd_file_t *initrd_lookup(const char *path);
+
+// Open 'path' for initrd_read(). Returns 0, or -1 if there is no such
+// file.
+int initrd_open(const char *path, initrd_fd_t *fd);
+
+// Point '*data' at up to 'len' bytes from the current position and move
+// past them. Returns the number of bytes, 0 at end of file.
+uint64_t initrd_read(initrd_fd_t *fd, const void **data, uint64_t len);
+
+// The whole of 'path': its data, with the length in '*size'. NULL if there
+// is no such file.
+const void *initrd_map(const char *path, uint64_t *size);
+
+// Call 'fn' for every file, in archive order.
+void initrd_for_each(void (*fn)(const initrd_file_t *file, void *arg),
+                     void *arg);
+
+#endif  // INITRD_H
@@ -0,0 +1,35 @@
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include <stdint.h>
+
+// General-purpose kernel heap.
+//
+// Requests up to KMALLOC_MAX_SIZE bytes are rounded up to a power-of-two
+// size class, each backed by a slab cache. Every CPU keeps a small magazine
+// of free objects per class, so the common alloc/free is an O(1) push or pop
+// with IRQs masked and no lock; the slab cache is only touched, in batches,
+// when a magazine runs empty or full. Larger requests get whole pages from
+// page_alloc(). Memory is 16-byte aligned (page aligned for large requests).
+#define KMALLOC_MIN_SHIFT 4   // 16 bytes
+#define KMALLOC_MAX_SHIFT 13  // 8 KiB
+#define KMALLOC_MAX_SIZE (1U << KMALLOC_MAX_SHIFT)
+#define KMALLOC_NR_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+// Objects cached per CPU and size class. Refills and drains move half.
+#define KMALLOC_MAG_SIZE 32
+
+// Needs page_alloc_init() to have run.
+void kmalloc_init(void);
+
+// Returns NULL for size 0 or when out of memory.
+void *kmalloc(uint64_t size);
+void *kzalloc(uint64_t size);
+
+// Accepts NULL.
+void kfree(void *ptr);
+
+// Print per-class slab usage over the UART.
+void kmalloc_dump_stats(void);
+
+#endif  // KMALLOC_H
@@ -0,0 +1,80 @@
+#ifndef KPRINTF_H
+#define KPRINTF_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+// Formatted kernel logging.
+//
+// kprintf() formats on the caller's stack and appends the text to the
+// calling CPU's log buffer with IRQs masked, at about the cost of a
+// memcpy. The buffers are drained to the UART only by a lowest-priority
+// flusher task, which sleeps while they are empty. The first message after
+// a quiet spell wakes it, and that wakeup takes the flusher's wait-queue
+// lock and a run-queue lock (wake_up_one()). So kprintf() must not be
+// called with a run-queue lock or a wait-queue lock held. The idle loop
+// also wakes the flusher (klog_kick()) if anything is left buffered.
+// Until klog_init(), and after klog_panic_begin(), text goes straight to
+// the UART instead. Output from different CPUs, or written with
+// uart_puts() directly, is not ordered against buffered text.
+//
+// Formats: %d %i %u %x %X %p %s %c %%, with an optional '0' or '-' flag, a
+// field width, and an 'l', 'll' or 'z' length modifier.
+
+// Log levels, most severe first. Messages above KLOG_LEVEL are compiled
+// out: the call stays type-checked but GCC drops it as dead code.
+#define KLOG_ERR 0
+#define KLOG_WARN 1
+#define KLOG_INFO 2
+#define KLOG_DEBUG 3
+
+#ifndef KLOG_LEVEL
+#ifdef CONFIG_DEBUG  // DEBUG=1
+#define KLOG_LEVEL KLOG_DEBUG
+#else
+#define KLOG_LEVEL KLOG_INFO
+#endif
+#endif
+
+#define klog_enabled(level) ((level) <= KLOG_LEVEL)
+
+#define KLOG_LINE_MAX 256  // Longer messages are truncated
+#define KLOG_BUF_SIZE 4096  // Per CPU, a power of two
+#define KLOG_FLUSH_DELAY_NS 20000000ULL  // Flusher batching delay, 20 ms
+
+#define klog(level, ...)              \
+    do {                              \
+        if (klog_enabled(level)) {    \
+            kprintf(__VA_ARGS__);     \
+        }                             \
+    } while (0)
+
+#define pr_err(...) klog(KLOG_ERR, __VA_ARGS__)
+#define pr_warn(...) klog(KLOG_WARN, __VA_ARGS__)
+#define pr_info(...) klog(KLOG_INFO, __VA_ARGS__)
+#define pr_debug(...) klog(KLOG_DEBUG, __VA_ARGS__)
+
+// Always printed; prefer the pr_*() wrappers.
+void kprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Format into 'buf' (always NUL-terminated if size > 0). Returns the
+// length written, excluding the NUL.
+uint32_t kvsnprintf(char *buf, uint32_t size, const char *fmt, va_list ap);
+uint32_t ksnprintf(char *buf, uint32_t size, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Start buffering: called once tasks can run, starts the flusher task.
+void klog_init(void);
+
+// Wake the flusher task if there is buffered text and it is asleep. For
+// the idle loop, which must not drain the buffers itself.
+void klog_kick(void);
+
+// Fatal-error path: flush the UART ring and every log buffer, then print
+// synchronously from here on (see uart_panic_begin()).
+void klog_panic_begin(void);
+
+// Print a message and halt this CPU with IRQs masked.
+void panic(const char *fmt, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+#endif  // KPRINTF_H
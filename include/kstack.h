@@ -0,0 +1,58 @@
+#ifndef KSTACK_H
+#define KSTACK_H
+
+#include <stdint.h>
+
+#include "common_macros.h"
+
+// Task stacks, grown on demand.
+//
+// Every stack gets a KSTACK_SLOT_SIZE slot of virtual address space in the
+// kernel's shared mappings, and reserves the top 'size' bytes of it; only
+// the top page is mapped up front. A translation fault in the reserved
+// range below the mapped pages maps fresh pages down to the faulting
+// address and the access is retried. Everything in the slot below the
+// reservation is never mapped, so a real overflow faults there and the
+// task is killed.
+#define KSTACK_VA_BASE (12UL << 30)  // RAM must end below this
+#define KSTACK_VA_SIZE (4UL << 30)
+#define KSTACK_SLOT_SHIFT 17  // 128 KiB per stack
+#define KSTACK_SLOT_SIZE (1UL << KSTACK_SLOT_SHIFT)
+#define KSTACK_MAX_SIZE (KSTACK_SLOT_SIZE - PAGE_SIZE)  // Keep a guard page
+#define KSTACK_NR_SLOTS (KSTACK_VA_SIZE >> KSTACK_SLOT_SHIFT)
+
+// Pages each CPU keeps aside for stack faults taken while that CPU holds
+// the page allocator's lock.
+#define KSTACK_RESERVE_PAGES 2
+
+typedef struct {
+    uint64_t base;    // Lowest address the stack may grow down to
+    uint64_t mapped;  // Lowest mapped address; [mapped, top) is backed
+    uint32_t size;    // Reserved bytes
+    uint32_t slot;
+} kstack_t;
+
+// Reserve a stack of at least 'size' bytes (at most KSTACK_MAX_SIZE) and
+// map its top page. Returns 0, or -1 when out of memory or address space.
+int kstack_alloc(kstack_t *stack, uint32_t size);
+void kstack_free(kstack_t *stack);
+
+static inline uint64_t kstack_top(const kstack_t *stack) {
+    return stack->base + stack->size;
+}
+
+// Top up the calling CPU's fault reserve. Called where taking the page
+// allocator's lock is safe (task switch, stack allocation).
+void kstack_refill_reserve(void);
+
+// Data abort at 'far' with a translation fault. Returns 1 if it was the
+// running task's stack and the page is now mapped, 0 if 'far' is not a
+// stack address. Does not return if the task overflowed its stack.
+int kstack_handle_fault(uint64_t far);
+
+// Called by the exception entry code, on this CPU's fault stack, when the
+// frame it is about to push below 'frame_low' would not fit in the mapped
+// part of the stack. Returns once it does.
+void kstack_entry_fault(uint64_t frame_low);
+
+#endif  // KSTACK_H
@@ -0,0 +1,108 @@
+#ifndef MMU_H
+#define MMU_H
+
+#include <stdint.h>
+
+// Stage 1 EL1 translation: 4K granule, 39-bit VA (three levels, starting at
+// level 1), TTBR0 only. The kernel is identity mapped (VA == PA) in
+// [0, MMU_KERNEL_VA_END) with global entries.
+//
+// Tasks may have their own address space: a level 1 table whose kernel
+// entries point at the kernel's own level 2 tables, so kernel mappings are
+// shared, plus private non-global mappings in [MMU_TASK_VA_BASE,
+// MMU_TASK_VA_END) tagged with the address space's ASID. Switching is a
+// TTBR0_EL1 write, with no TLB flush.
+
+// MAIR_EL1 attribute indices
+#define MT_DEVICE_nGnRnE 0
+#define MT_DEVICE_nGnRE 1
+#define MT_NORMAL 2     // Write-back, read/write-allocate
+#define MT_NORMAL_NC 3  // Non-cacheable
+
+// Level 3 (page) and level 1/2 (block/table) descriptor bits
+#define PTE_VALID (1UL << 0)
+#define PTE_TABLE (1UL << 1)  // Levels 1-2: next-level table
+#define PTE_PAGE (1UL << 1)   // Level 3: page (the only valid L3 type)
+#define PTE_TYPE_MASK 3UL     // Valid + table/page; bit 1 clear is a block
+#define PTE_ATTRINDX(idx) ((uint64_t)(idx) << 2)
+#define PTE_AP_RO (1UL << 7)        // AP[2]: read-only
+#define PTE_SH_INNER (3UL << 8)     // Inner shareable
+#define PTE_AF (1UL << 10)          // Access flag (no AF faults)
+#define PTE_NG (1UL << 11)          // Not global: tagged with the ASID
+#define PTE_PXN (1UL << 53)         // Not executable at EL1
+#define PTE_UXN (1UL << 54)         // Not executable at EL0
+#define PTE_ADDR_MASK 0x0000FFFFFFFFF000UL
+
+// Page protections for mmu_map_range() and friends
+#define MMU_PROT_KERNEL_RX \
+    (PTE_ATTRINDX(MT_NORMAL) | PTE_SH_INNER | PTE_AF | PTE_AP_RO | PTE_UXN)
+#define MMU_PROT_KERNEL_RO \
+    (PTE_ATTRINDX(MT_NORMAL) | PTE_SH_INNER | PTE_AF | PTE_AP_RO | PTE_PXN | \
+     PTE_UXN)
+#define MMU_PROT_KERNEL_RW \
+    (PTE_ATTRINDX(MT_NORMAL) | PTE_SH_INNER | PTE_AF | PTE_PXN | PTE_UXN)
+#define MMU_PROT_DEVICE \
+    (PTE_ATTRINDX(MT_DEVICE_nGnRE) | PTE_AF | PTE_PXN | PTE_UXN)
+
+#define MMU_VA_BITS 39
+#define MMU_BLOCK_SIZE (2UL << 20)  // Level 2 block
+#define MMU_KERNEL_VA_END (16UL << 30)  // RAM must end below this
+#define MMU_TASK_VA_BASE (256UL << 30)
+#define MMU_TASK_VA_END (1UL << MMU_VA_BITS)
+
+typedef struct addr_space {
+    uint64_t *root;          // Level 1 table
+    volatile uint64_t asid;  // Generation and ASID, 0 until first run
+    uint32_t users;          // References: tasks plus the creator's
+} addr_space_t;
+
+// Build the kernel's identity map for the kernel image, devices and
+// [ram_base, ram_end), and turn on the MMU and caches on the boot CPU.
+// Needs the page allocator first (tables come from page_alloc()).
+void mmu_init(uint64_t ram_base, uint64_t ram_end);
+
+// Turn on the MMU and caches on a secondary core with the boot CPU's tables.
+void mmu_enable_secondary(void);
+
+// Map or unmap [va, va + size) in the kernel's tables (all page aligned).
+// mmu_map_range() uses 2 MiB blocks where va, pa and size allow and 4K
+// pages elsewhere; mmu_map_range_pages() always uses pages. Both are safe
+// while the MMU is on: changed entries are invalidated from every core's
+// TLB. Return 0, or -1 when a table could not be allocated.
+int mmu_map_range(uint64_t va, uint64_t pa, uint64_t size, uint64_t prot);
+int mmu_map_range_pages(uint64_t va, uint64_t pa, uint64_t size,
+                        uint64_t prot);
+void mmu_unmap_range(uint64_t va, uint64_t size);
+
+// Physical address behind kernel VA 'va' ('pa' may be NULL). Returns 0, or
+// -1 if unmapped. Takes no lock: kernel tables are never freed.
+int mmu_lookup(uint64_t va, uint64_t *pa);
+
+// Map one page at a currently invalid 'va' whose level 3 table already
+// exists, without taking the page table lock or allocating. Only for
+// entries no other CPU updates (a task's own stack, see kstack.c). Returns
+// -1 if the table is missing.
+int mmu_map_page_prealloc(uint64_t va, uint64_t pa, uint64_t prot);
+
+// New address space holding one reference for the caller. NULL when out
+// of memory.
+addr_space_t *mmu_as_create(void);
+void mmu_as_get(addr_space_t *as);
+// Drop a reference; the last one frees the private page tables (not the
+// pages they map).
+void mmu_as_put(addr_space_t *as);
+
+// Map [va, va + size) of the task range in 4K pages. Returns 0, or -1 on
+// a bad range or when a table could not be allocated.
+int mmu_as_map(addr_space_t *as, uint64_t va, uint64_t pa, uint64_t size,
+               uint64_t prot);
+
+// Install 'as' (NULL: kernel mappings only) on the calling CPU. Called by
+// schedule() with IRQs masked.
+void mmu_switch_to(addr_space_t *as);
+
+// Write back [start, start + size) to memory, for data read by a core
+// whose caches are still off.
+void dcache_clean_range(const void *start, uint64_t size);
+
+#endif  // MMU_H
@@ -0,0 +1,71 @@
+#ifndef PAGE_ALLOC_H
+#define PAGE_ALLOC_H
+
+#include <stdint.h>
+
+#include "common_macros.h"
+
+// Buddy allocator for physical pages.
+//
+// Blocks are 2^order contiguous pages, naturally aligned to their size in
+// the physical address space. Each order has a free list; allocation splits
+// the smallest large-enough free block and freeing merges a block with its
+// buddy for as long as the buddy is free too, so both are O(log n) in the
+// number of orders. A page_t descriptor per page (kept at the start of the
+// managed memory) records which blocks are free.
+
+typedef struct page {
+    struct page *next;  // Free list links, valid while PAGE_FREE is set
+    struct page *prev;
+    void *slab_cache;   // Owning kmem_cache_t while PAGE_SLAB is set
+    uint8_t order;      // Order of the free or allocated block this heads
+    uint8_t flags;
+} page_t;
+
+#define PAGE_FREE (1U << 0)  // Heads a free block of 'order'
+#define PAGE_SLAB (1U << 1)  // Part of a slab (see slab.c)
+
+typedef struct {
+    uint64_t total_pages;                    // Pages managed
+    uint64_t free_pages;
+    uint32_t free_blocks[PAGE_MAX_ORDER + 1];  // Free blocks per order
+} page_stats_t;
+
+// Manage the pages in [start, end). They all start out allocated; hand
+// usable memory over with page_free_range().
+void page_alloc_init(uint64_t start, uint64_t end);
+
+// First address past the page_t map that page_alloc_init(start, end)
+// writes at 'start': nothing there may be kept.
+uint64_t page_alloc_map_end(uint64_t start, uint64_t end);
+
+// Give the pages in [start, end) to the allocator (skipping any part outside
+// the managed range).
+void page_free_range(uint64_t start, uint64_t end);
+
+// Returns a block of 2^order pages, or NULL when out of memory.
+void *page_alloc(uint32_t order);
+void page_free(void *addr, uint32_t order);
+
+// As page_alloc(), for fault handlers: returns NULL instead of deadlocking
+// when the fault hit while this CPU was inside the allocator. IRQs must be
+// masked.
+void *page_alloc_atomic(uint32_t order);
+
+// Descriptor of the page holding 'addr', or NULL if it is not managed.
+page_t *virt_to_page(const void *addr);
+
+// Smallest order whose block holds 'bytes'.
+uint32_t page_order_for(uint64_t bytes);
+
+uint64_t page_alloc_free_bytes(void);
+void page_alloc_get_stats(page_stats_t *stats);
+
+// Share of free memory (0-100) that sits in blocks smaller than 2^order
+// pages and so cannot serve an allocation of that order.
+uint32_t page_frag_index(const page_stats_t *stats, uint32_t order);
+
+// Print free blocks per order and the fragmentation index over the UART.
+void page_alloc_dump_stats(void);
+
+#endif  // PAGE_ALLOC_H
@@ -0,0 +1,30 @@
+#ifndef PID_H
+#define PID_H
+
+#include <stdint.h>
+
+struct tcb;
+
+// Task handle table. A PID is (generation << PID_INDEX_BITS) | slot; the
+// slot gives O(1) lookup and the generation, bumped every time a slot is
+// freed, makes a stale PID miss instead of finding the slot's next owner.
+#define PID_INDEX_BITS 16
+#define PID_GEN_BITS 15  // Keeps PIDs positive as an int
+#define PID_MAX_SLOTS (1U << PID_INDEX_BITS)
+#define PID_INDEX(pid) ((pid) & (PID_MAX_SLOTS - 1))
+#define PID_GEN(pid) (((pid) >> PID_INDEX_BITS) & ((1U << PID_GEN_BITS) - 1))
+
+void pid_init(void);
+
+// Bind a new PID to 'task'. Returns the PID, or -1 when the table is full.
+int32_t pid_alloc(struct tcb *task);
+
+// Release 'pid'; lookups of it fail from now on and its slot is reused
+// first (LIFO) by the next pid_alloc().
+void pid_free(uint32_t pid);
+
+// The task 'pid' refers to, or NULL if the PID is stale or invalid. The
+// TCB is only guaranteed to stay valid while the task cannot exit.
+struct tcb *task_lookup(uint32_t pid);
+
+#endif  // PID_H
@@ -0,0 +1,28 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include <stdint.h>
+
+// Minimal PMUv3 event counter access for benchmarks. Counters count at EL1
+// and EL0 on the calling CPU.
+
+// Common architectural event numbers
+#define PMU_EV_L1I_TLB_REFILL 0x02
+#define PMU_EV_L1D_TLB_REFILL 0x05
+#define PMU_EV_INST_RETIRED 0x08
+#define PMU_EV_CPU_CYCLES 0x11
+#define PMU_EV_L2D_TLB_REFILL 0x2D
+#define PMU_EV_DTLB_WALK 0x34
+
+// Event counters implemented (PMCR_EL0.N).
+uint32_t pmu_num_counters(void);
+
+// 1 if PMCEID0/1_EL0 say 'event' (0-63) can be counted.
+int pmu_event_supported(uint32_t event);
+
+// Program counter 'idx' for 'event', zero it and start it.
+void pmu_counter_start(uint32_t idx, uint32_t event);
+void pmu_counter_stop(uint32_t idx);
+uint64_t pmu_counter_read(uint32_t idx);
+
+#endif  // PMU_H
@@ -0,0 +1,52 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+
+#include "spinlock.h"
+
+// Object caches for fixed-size kernel objects (TCBs, kmalloc size classes).
+//
+// Each slab is a page_alloc() block whose first bytes hold a slab_t header,
+// followed by equally sized objects. Free objects are chained through their
+// first word, so alloc and free are O(1), and an object finds its slab by
+// masking its address with the (naturally aligned) slab size.
+struct kmem_cache;
+
+typedef struct slab {
+    struct slab *next;         // Next slab with free objects
+    struct kmem_cache *cache;  // Owning cache
+    void *free;                // First free object in this slab
+    uint32_t inuse;            // Objects handed out from this slab
+    uint32_t on_partial;       // Linked on cache->partial
+} slab_t;
+
+typedef struct kmem_cache {
+    const char *name;
+    spinlock_t lock;
+    uint32_t obj_size;       // Rounded up to 'align'
+    uint32_t obj_offset;     // First object's offset in a slab
+    uint32_t objs_per_slab;
+    uint32_t order;          // Slab size is 2^order pages
+    slab_t *partial;         // Slabs with at least one free object
+    uint32_t nr_slabs;
+    uint32_t nr_active;      // Objects currently allocated
+} kmem_cache_t;
+
+// Set up a cache of 'size'-byte objects aligned to 'align' (a power of
+// two, at least 8). The cache itself is caller-provided storage.
+void kmem_cache_init(kmem_cache_t *cache, const char *name, uint32_t size,
+                     uint32_t align);
+
+// Returns an uninitialised object, or NULL when out of memory.
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+// Move up to 'count' objects between 'objs' and the cache under a single
+// lock acquisition (used to refill and drain kmalloc's per-CPU magazines).
+// alloc_bulk returns how many objects it stored.
+uint32_t kmem_cache_alloc_bulk(kmem_cache_t *cache, void **objs,
+                               uint32_t count);
+void kmem_cache_free_bulk(kmem_cache_t *cache, void **objs, uint32_t count);
+
+#endif  // SLAB_H
@@ -0,0 +1,70 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+
+#include "common_macros.h"
+#include "hrtimer.h"
+#include "spinlock.h"
+#include "task.h"
+
+// Per-CPU state. TPIDR_EL1 of each core points at its own cpu_t, so
+// this_cpu() is a single system-register read.
+typedef struct cpu {
+    // Initial stack pointer for a secondary core. Must stay the first field:
+    // _secondary_entry in boot.s loads it from offset 0 of the cpu_t passed
+    // as the PSCI context ID.
+    uint64_t boot_stack_top;
+    // Exception-entry stack check, at fixed offsets for vectors.s:
+    // lowest mapped address of the running task's stack (0: no check), the
+    // stack to grow it from, and a spill slot for the entry code.
+    uint64_t stack_limit;
+    uint64_t fault_stack_top;
+    uint64_t entry_scratch;
+    uint32_t id;     // Logical CPU number (0 = boot CPU)
+    uint64_t mpidr;  // MPIDR_EL1 affinity value used with PSCI CPU_ON
+    volatile uint32_t online;
+    volatile uint32_t need_resched;  // Set by IRQ handlers, checked on exit
+    uint32_t tick_stopped;           // Periodic tick off while idle
+
+    // Pending hrtimers on this CPU (see hrtimer.c)
+    spinlock_t timer_lock;
+    uint32_t timer_count;
+    uint32_t timer_capacity;  // Slots in timer_heap, grown on demand
+    hrtimer_t **timer_heap;
+    hrtimer_t tick_timer;  // Periodic scheduler tick
+
+    tcb_t *curr_task;
+    tcb_t *idle_task;
+    tcb_t *prev_task;  // Task switched away from; see finish_task_switch()
+    tcb_t *fpsimd_owner;      // Task whose FP/SIMD registers are loaded
+    uint32_t fpsimd_enabled;  // CPACR_EL1.FPEN currently allows access
+    run_queue_t rq;
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+extern uint32_t smp_num_cpus;  // Number of CPUs brought online
+
+static inline cpu_t *this_cpu(void) {
+    cpu_t *cpu;
+    __asm__ __volatile__("mrs %0, tpidr_el1" : "=r"(cpu));
+    return cpu;
+}
+
+// Running and idle task of the executing CPU. Only stable while IRQs are
+// masked (a task may be migrated between CPUs when preempted); task code
+// should use task_current() instead.
+#define current_task (this_cpu()->curr_task)
+#define idle_task_tcb (this_cpu()->idle_task)
+
+void smp_init_boot_cpu(void);
+void smp_boot_secondaries(void (*idle_entry)(void *arg));
+void secondary_main(cpu_t *cpu);
+void smp_send_reschedule(uint32_t cpu_id);
+void smp_kick_idle_cpu(void);
+
+// PSCI firmware call through HVC (QEMU virt's PSCI conduit). In boot.s.
+int64_t psci_call(uint64_t function_id, uint64_t arg0, uint64_t arg1,
+                  uint64_t arg2);
+
+#endif  // SMP_H
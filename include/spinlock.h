@@ -0,0 +1,69 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+
+// Simple test-and-test-and-set spinlock built on the GCC __atomic builtins
+// (ldaxr/stxr on Cortex-A53). Locks taken from task context must use the
+// _irqsave variants so an interrupt on the same CPU cannot try to take a lock
+// its own CPU already holds.
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT {0}
+
+static inline void cpu_relax(void) { __asm__ __volatile__("yield" ::: "memory"); }
+
+static inline void spin_lock_init(spinlock_t *lock) { lock->locked = 0; }
+
+static inline void spin_lock(spinlock_t *lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) {
+            cpu_relax();
+        }
+    }
+}
+
+// Returns 1 if the lock was taken, 0 if it is held by someone else.
+static inline int spin_trylock(spinlock_t *lock) {
+    if (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+#define DAIF_IRQ_MASKED (1UL << 7)  // DAIF.I in a value from local_irq_save()
+
+// Save DAIF and mask IRQs on this CPU. Returns the previous DAIF value.
+static inline uint64_t local_irq_save(void) {
+    uint64_t flags;
+    __asm__ __volatile__(
+        "mrs %0, daif\n"
+        "msr daifset, #2"
+        : "=r"(flags)
+        :
+        : "memory");
+    return flags;
+}
+
+static inline void local_irq_restore(uint64_t flags) {
+    __asm__ __volatile__("msr daif, %0" ::"r"(flags) : "memory");
+}
+
+static inline uint64_t spin_lock_irqsave(spinlock_t *lock) {
+    uint64_t flags = local_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags) {
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
+
+#endif  // SPINLOCK_H
@@ -0,0 +1,22 @@
+#ifndef STRING_H
+#define STRING_H
+
+#include <stddef.h>
+
+// Freestanding string routines (string.s). These are also what GCC emits
+// calls to for struct copies and large initialisers, so they must exist
+// even under -ffreestanding.
+//
+// Large blocks go through 64-byte ldp/stp loops with aligned stores.
+// memset() to zero uses DC ZVA for whole cache blocks once string_init()
+// has run; it is safe with the MMU off before that.
+void *memset(void *dst, int c, size_t n);
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+
+// Read the DC ZVA block size from DCZID_EL0. Call once the MMU is on:
+// DC ZVA faults on Device memory.
+void string_init(void);
+
+#endif  // STRING_H
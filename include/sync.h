@@ -0,0 +1,58 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdint.h>
+
+#include "wait.h"
+
+// Sleeping synchronization for tasks, built on wait queues: mutexes,
+// counting semaphores and condition variables. All of them block the
+// caller, so none may be used from IRQ context or the idle task, except
+// sem_up() and the condvar signals, which only wake.
+
+// Mutex. 'state' is 0 when free, 1 when held, and 2 when held with
+// (possibly) waiters. An uncontended lock or unlock is one atomic on
+// 'state'; only contention reaches the wait queue. Not recursive, and not
+// FIFO: a running task may take the mutex ahead of one just woken.
+typedef struct {
+    volatile uint32_t state;
+    wait_queue_t waiters;
+} mutex_t;
+
+#define MUTEX_INIT {0, WAIT_QUEUE_INIT}
+
+void mutex_init(mutex_t *m);
+void mutex_lock(mutex_t *m);
+// Returns 1 if it took the mutex, 0 if it is held.
+int mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+// Counting semaphore.
+typedef struct {
+    volatile int64_t count;
+    wait_queue_t waiters;
+} semaphore_t;
+
+#define SEMAPHORE_INIT(n) {(n), WAIT_QUEUE_INIT}
+
+void sem_init(semaphore_t *sem, int64_t count);
+void sem_down(semaphore_t *sem);
+// Returns 1 if it took a unit, 0 if there was none.
+int sem_trydown(semaphore_t *sem);
+void sem_up(semaphore_t *sem);
+
+// Condition variable, used with a mutex that protects the condition.
+typedef struct {
+    wait_queue_t waiters;
+} condvar_t;
+
+#define CONDVAR_INIT {WAIT_QUEUE_INIT}
+
+void cond_init(condvar_t *cv);
+// Release 'm', sleep until signalled, and take 'm' again. Wakeups may be
+// spurious: re-check the condition in a loop.
+void cond_wait(condvar_t *cv, mutex_t *m);
+void cond_signal(condvar_t *cv);
+void cond_broadcast(condvar_t *cv);
+
+#endif  // SYNC_H
@@ -4,6 +4,11 @@
 #include <stdint.h>
 
 #include "common_macros.h"  // <<< ENSURE THIS IS HERE, AT THE TOP
+#include "fpsimd.h"
+#include "hrtimer.h"
+#include "kstack.h"
+#include "mmu.h"
+#include "spinlock.h"
 
 // Define task states
 typedef enum {
@@ -14,36 +19,102 @@ typedef enum {
     TASK_ZOMBIE
 } task_state_e;
 
+// Task priorities. Lower numbers are more urgent; the scheduler always runs
+// the highest-priority ready task and round-robins within a level.
+#define TASK_PRIO_HIGHEST 0
+#define TASK_PRIO_DEFAULT (NUM_PRIORITY_LEVELS / 2)
+#define TASK_PRIO_LOWEST (NUM_PRIORITY_LEVELS - 1)
+
+// Registers saved by cpu_switch_to() (switch.s): the AAPCS64 callee-saved
+// set, plus the stack and thread pointers. The layout must match switch.s.
+typedef struct {
+    uint64_t x19;
+    uint64_t x20;
+    uint64_t x21;
+    uint64_t x22;
+    uint64_t x23;
+    uint64_t x24;
+    uint64_t x25;
+    uint64_t x26;
+    uint64_t x27;
+    uint64_t x28;
+    uint64_t fp;  // x29
+    uint64_t lr;  // x30, where cpu_switch_to() returns to
+    uint64_t sp;
+    uint64_t tpidr_el0;
+} cpu_context_t;
+
 // Task Control Block (TCB) structure
 typedef struct tcb {
-    uint32_t pid;
-    task_state_e state;
-    uint64_t kernel_sp;
-    uint64_t *stack_base;
-    uint32_t stack_size;
-    uint8_t stack_idx;
+    // Must stay the first field: switch.s addresses it at TCB_CPU_CONTEXT.
+    // A preempted task's full exception frame lives on its stack, below
+    // the schedule() call that this context returns into.
+    cpu_context_t cpu_context;
+    uint32_t pid;  // Generation-tagged handle, see pid.h
+    volatile task_state_e state;
+    kstack_t stack;
+    uint8_t priority;  // 0 (highest) .. NUM_PRIORITY_LEVELS - 1 (lowest)
+    uint32_t cpu;      // CPU whose run queue the task was last placed on
+    // Set while a CPU is running on this task's stack. Cleared (with release
+    // semantics) by finish_task_switch() once that CPU has switched away, so
+    // no other CPU resumes the task while its stack is still in use.
+    volatile uint32_t on_cpu;
+    hrtimer_t sleep_timer;  // Wakes the task from task_sleep_until()
+    // Lazily switched FP/SIMD registers (see fpsimd.c). 'fpsimd' is only
+    // up to date while fpsimd_cpu is -1; otherwise the registers are still
+    // live in CPU fpsimd_cpu's register file.
+    fpsimd_state_t fpsimd;
+    volatile int32_t fpsimd_cpu;
     void (*entry_point)(void *);
     void *arg;
     struct tcb *next_in_queue;
-    void *page_table_base;
+    addr_space_t *addr_space;  // NULL: kernel mappings only
 } tcb_t;
 
+// One FIFO ready list per priority level, with head and tail pointers so
+// enqueue never walks the list.
+typedef struct {
+    tcb_t *head;
+    tcb_t *tail;
+} ready_list_t;
+
+// Per-CPU run queue. Level 'prio' is tracked by bit (31 - prio) of 'bitmap',
+// so __builtin_clz() of the bitmap is the most urgent non-empty level.
+typedef struct {
+    spinlock_t lock;
+    uint32_t bitmap;
+    uint32_t nr_ready;
+    ready_list_t lists[NUM_PRIORITY_LEVELS];
+} run_queue_t;
+
 // Global task management variables (declared as extern here)
-extern tcb_t
-    task_table[MAX_TASKS];  // MAX_TASKS needs to be defined before this line
-extern tcb_t *current_task;
-extern uint32_t next_pid;
-extern tcb_t *ready_queue_head;
-extern tcb_t *idle_task_tcb;
-extern uint8_t task_stacks_status[MAX_TASKS];  // MAX_TASKS needs to be defined
-                                               // before this line
+// The running task and idle task are per-CPU; see current_task and
+// idle_task_tcb in smp.h.
+// TCBs come from a slab cache and stacks from kstack_alloc(); PIDs are
+// handles into the table in pid.c (see task_lookup()).
 
 // Function declarations
 void task_init_system(void);
-int task_create(void (*entry_point)(void *arg), void *arg, const char *name);
-uint64_t schedule(uint64_t current_task_sp_val);
+int task_create(void (*entry_point)(void *arg), void *arg, const char *name,
+                uint8_t priority, uint32_t stack_size);
+// As task_create(), running in 'as' (the task takes its own reference).
+int task_create_in(addr_space_t *as, void (*entry_point)(void *arg), void *arg,
+                   const char *name, uint8_t priority, uint32_t stack_size);
+tcb_t *task_create_idle(void (*entry_point)(void *arg), uint32_t cpu_id);
+tcb_t *task_current(void);
+void schedule(void);
+void finish_task_switch(void);
+void cpu_switch_to(tcb_t *prev, tcb_t *next);  // In switch.s
 void add_to_ready_queue(tcb_t *task);
 tcb_t *get_next_ready_task(void);
 void task_exit(void);
+void task_yield(void);
+// Non-zero if the caller is a task that may block: not the idle task, and
+// not before scheduling has started.
+int task_can_block(void);
+void task_block(void);
+void task_wake(tcb_t *task);
+void task_sleep_until(uint64_t deadline_ticks);
+void task_sleep_ns(uint64_t ns);
 
 #endif  // TASK_H
\ No newline at end of file
@@ -12,14 +12,26 @@
 // Function to initialize the EL1 Physical Timer
 // void timer_init(void);  // Remove or comment out this conflicting declaration
 void timer_init_periodic(uint64_t interval_ticks);  // For periodic timer
+void timer_init_secondary(void);  // Per-core start of the same periodic tick
 
 // Function to handle the timer interrupt
 // This is the C part, called from the main IRQ handler
 void handle_timer_irq(void);
 
+// Counter access and conversions (CNTPCT_EL0 ticks at CNTFRQ_EL0 Hz).
+uint64_t timer_read_counter(void);
+uint64_t timer_ns_to_ticks(uint64_t ns);
+uint64_t timer_ticks_to_ns(uint64_t ticks);
+void timer_set_deadline(uint64_t cval);  // Program CNTP_CVAL_EL0 and enable
+
+// Dynamic tick control for the calling CPU (see schedule()).
+void timer_tick_stop(void);
+void timer_tick_restart(void);
+
 // Functions to access timer registers (if needed externally, otherwise keep
 // static in timer.c)
 uint64_t read_cntp_ctl_el0(void);
 void write_cntp_tval_el0(uint64_t val);
+void write_cntp_ctl_el0(uint64_t val);
 
 #endif  // TIMER_H
\ No newline at end of file
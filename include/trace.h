@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Binary event tracing into per-CPU ring buffers.
+//
+// Each record is timestamped with CNTPCT_EL0 and costs a handful of stores
+// into the calling CPU's ring; the oldest records are overwritten once a
+// ring wraps. trace_dump() streams the rings over the UART and
+// tools/trace2perfetto.py turns that into Chrome/Perfetto trace JSON.
+//
+// Tracepoints compile to nothing unless the kernel is built with
+// CONFIG_TRACE (make TRACE=1, the default).
+
+typedef enum {
+    TRACE_SWITCH = 1,      // arg0 = next pid, arg1 = prev pid (~0 if none)
+    TRACE_IRQ_ENTRY = 2,   // arg0 = GIC interrupt ID
+    TRACE_IRQ_EXIT = 3,    // arg0 = GIC interrupt ID
+    TRACE_TASK_STATE = 4,  // arg0 = pid, arg1 = new task_state_e
+    TRACE_TIMER_EXPIRE = 5 // arg0 = 0, arg1 = callback address
+} trace_type_e;
+
+// Layout shared with tools/trace2perfetto.py ("<QBBHIQ").
+typedef struct {
+    uint64_t ts;    // CNTPCT_EL0
+    uint8_t type;   // trace_type_e
+    uint8_t cpu;
+    uint16_t reserved;
+    uint32_t arg0;
+    uint64_t arg1;
+} trace_event_t;
+
+#define TRACE_RING_ENTRIES 4096  // Per CPU, power of two
+
+#ifdef CONFIG_TRACE
+void trace_init(void);
+void trace_record(uint32_t type, uint32_t arg0, uint64_t arg1);
+void trace_dump(void);
+#define TRACE_EVENT(type, arg0, arg1) \
+    trace_record((type), (uint32_t)(arg0), (uint64_t)(arg1))
+#else
+static inline void trace_init(void) {}
+static inline void trace_dump(void) {}
+#define TRACE_EVENT(type, arg0, arg1) \
+    do {                              \
+    } while (0)
+#endif
+
+#endif  // TRACE_H
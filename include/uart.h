@@ -4,22 +4,79 @@
 
 #include <stdint.h>
 
-// Initializes the UART.
+#define UART_BASE ((uintptr_t)0x09000000)  // PL011, must match uart.s
+
+// PL011 registers used from C (offsets from UART_BASE)
+#define UART_DR 0x00
+#define UART_FR 0x18
+#define UART_IFLS 0x34
+#define UART_IMSC 0x38
+#define UART_MIS 0x40
+#define UART_ICR 0x44
+
+#define UART_DR_ERROR 0xF00U    // OE, BE, PE, FE flags next to the data
+#define UART_DR_BAD 0x700U      // BE, PE, FE: the byte itself is garbage
+#define UART_FR_RXFE (1U << 4)  // Receive FIFO empty
+#define UART_FR_TXFF (1U << 5)  // Transmit FIFO full
+#define UART_INT_RX (1U << 4)   // RXIM/RXMIS/RXIC
+#define UART_INT_TX (1U << 5)   // TXIM/TXMIS/TXIC
+#define UART_INT_RT (1U << 6)   // Receive timeout: FIFO idle but not empty
+
+// Transmit and receive rings (uart.c). Must be powers of two.
+#define UART_TX_RING_SIZE 4096
+#define UART_RX_RING_SIZE 1024
+#define UART_RX_LINE_MAX 256  // Longest line being edited in line mode
+
+// Receive modes for uart_set_rx_mode()
+#define UART_RX_ECHO (1U << 0)   // Echo what is typed
+#define UART_RX_LINE (1U << 1)   // Line mode: edit a line, deliver on Enter
+
+// Initializes the UART. In uart.s.
 void uart_init(void);
 
-// Prints a null-terminated string to the UART.
+// Buffered output. Writers reserve space in a lock-free ring and return
+// without waiting for the UART; the PL011 TX interrupt drains it. When the
+// ring is full, a writer with IRQs enabled spins until there is room, and
+// one with IRQs masked (IRQ handlers, the scheduler) drops the rest of its
+// text, counted in uart_tx_dropped(). Until uart_irq_init() and after
+// uart_panic_begin() these write synchronously instead.
 void uart_puts(const char *s);
-
-// Prints a single character to the UART.
-// Note: The assembly implementation expects the char in w0 if called from C.
-// The current uart.s is optimized for calls from uart_puts (char in w2).
-// For direct C calls to uart_putc, uart.s would need adjustment or a wrapper.
-// For now, C code should primarily use uart_puts.
-// void uart_putc(char c); // Let's comment this out for C use for now to avoid
-// confusion
 void uart_putc(char c);
+void uart_write(const char *buf, uint64_t len);
+
+// Polled output straight to the TX FIFO, bypassing the ring. In uart.s.
+void uart_puts_sync(const char *s);
+void uart_putc_sync(char c);
+
+// Printed through uart_putc(). In uart.s.
+void print_hex(uint64_t val);
+void print_uint(uint64_t val);
+
+// Route the PL011 interrupt to this CPU and switch output over to the ring.
+// Needs gic_init().
+void uart_irq_init(void);
+
+// PL011 interrupt handler, called from c_irq_handler().
+void uart_irq_handler(void);
+
+// Block until input is available, then copy up to 'len' bytes of it into
+// 'buf'. In line mode only whole lines are available and a read stops
+// after the '\n'. Returns the number of bytes read, or -1 when not called
+// from a task that can sleep.
+int64_t uart_read(char *buf, uint64_t len);
+
+// UART_RX_* flags. Both are on by default. Pending input, including a
+// half-typed line, is discarded on a change.
+void uart_set_rx_mode(uint32_t mode);
+
+// For fatal errors: write out what is already in the ring and make all
+// further output synchronous, so the last words reach the console even if
+// the CPU halts with IRQs masked. Never undone.
+void uart_panic_begin(void);
 
-void print_hex(uint64_t val);   // <<< ADD DECLARATION HERE
-void print_uint(uint64_t val);  // <<< ADD THIS DECLARATION
+// Bytes dropped because the TX ring was full, and received bytes dropped
+// because nobody read them in time.
+uint64_t uart_tx_dropped(void);
+uint64_t uart_rx_dropped(void);
 
-#endif  // UART_H
\ No newline at end of file
+#endif  // UART_H
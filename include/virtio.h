@@ -0,0 +1,166 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+
+// virtio over MMIO: the transport registers, device setup, and split
+// virtqueues shared by the device drivers (see virtio_blk.c).
+//
+// QEMU virt has VIRTIO_MMIO_SLOTS transports of VIRTIO_MMIO_STRIDE bytes
+// from VIRTIO_MMIO_BASE, slot n raising SPI 16 + n. Unused slots read back
+// device ID 0. Both the legacy (version 1, QEMU's default) and the modern
+// (version 2, -global virtio-mmio.force-legacy=false) register layouts are
+// handled. RAM is identity mapped and QEMU's DMA is cache coherent, so
+// rings and buffers are handed over by physical address with barriers only.
+
+#define VIRTIO_MMIO_BASE ((uintptr_t)0x0a000000)
+#define VIRTIO_MMIO_STRIDE 0x200
+#define VIRTIO_MMIO_SLOTS 32
+
+// Register offsets from a transport's base
+#define VIRTIO_MMIO_MAGIC 0x000           // "virt"
+#define VIRTIO_MMIO_VERSION 0x004         // 1: legacy, 2: modern
+#define VIRTIO_MMIO_DEVICE_ID 0x008
+#define VIRTIO_MMIO_DEVICE_FEATURES 0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES 0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_GUEST_PAGE_SIZE 0x028  // Legacy only
+#define VIRTIO_MMIO_QUEUE_SEL 0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX 0x034
+#define VIRTIO_MMIO_QUEUE_NUM 0x038
+#define VIRTIO_MMIO_QUEUE_ALIGN 0x03c  // Legacy only
+#define VIRTIO_MMIO_QUEUE_PFN 0x040    // Legacy only
+#define VIRTIO_MMIO_QUEUE_READY 0x044  // Modern only
+#define VIRTIO_MMIO_QUEUE_NOTIFY 0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS 0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK 0x064
+#define VIRTIO_MMIO_STATUS 0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW 0x080  // Modern only, to 0x0a4
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH 0x084
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW 0x090
+#define VIRTIO_MMIO_QUEUE_DRIVER_HIGH 0x094
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW 0x0a0
+#define VIRTIO_MMIO_QUEUE_DEVICE_HIGH 0x0a4
+#define VIRTIO_MMIO_CONFIG 0x100  // Device-specific configuration
+
+#define VIRTIO_MMIO_MAGIC_VALUE 0x74726976
+
+#define VIRTIO_MMIO_INT_VRING (1U << 0)   // Used ring updated
+#define VIRTIO_MMIO_INT_CONFIG (1U << 1)  // Configuration changed
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FEATURES_OK 8
+#define VIRTIO_STATUS_FAILED 128
+
+#define VIRTIO_F_VERSION_1 32  // Feature bit, required by modern devices
+
+#define VIRTIO_ID_BLOCK 2
+
+// Split virtqueue layout (virtio 1.x, section 2.7)
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2  // Device writes the buffer
+#define VIRTQ_USED_F_NO_NOTIFY 1
+#define VIRTQ_MAX_SIZE 256  // Ring entries we use at most
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} virtq_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    volatile uint16_t idx;
+    uint16_t ring[];
+} virtq_avail_t;
+
+typedef struct {
+    uint32_t id;  // Head of the completed chain
+    uint32_t len;
+} virtq_used_elem_t;
+
+typedef struct {
+    volatile uint16_t flags;
+    volatile uint16_t idx;
+    virtq_used_elem_t ring[];
+} virtq_used_t;
+
+// One virtqueue and the driver's bookkeeping for it. Not locked here: the
+// owning driver serializes all calls for a queue.
+typedef struct {
+    uintptr_t base;  // Transport registers
+    uint32_t index;  // Queue number on the device
+    uint32_t size;   // Entries, a power of two
+    uint32_t order;  // page_alloc() order of the ring memory
+    virtq_desc_t *desc;
+    virtq_avail_t *avail;
+    virtq_used_t *used;
+    uint16_t free_head;  // Free descriptors, chained through 'next'
+    uint16_t num_free;
+    uint16_t avail_idx;  // Next avail slot; published by virtq_kick()
+    uint16_t avail_published;
+    uint16_t last_used;  // Next used entry to reap
+    uint64_t notifies;   // QueueNotify writes, for statistics
+} virtq_t;
+
+// A device found by virtio_probe().
+typedef struct {
+    uintptr_t base;
+    uint32_t slot;
+    uint32_t irq;  // GIC interrupt ID
+    uint32_t version;
+} virtio_dev_t;
+
+// Find the first transport holding a device of type 'device_id' and reset
+// it. Returns 0, or -1 if there is none.
+int virtio_probe(uint32_t device_id, virtio_dev_t *dev);
+
+// Feature negotiation: offer the device's features masked by 'wanted'
+// (VIRTIO_F_VERSION_1 is added for modern devices) and return the accepted
+// set, or -1 if the device refused it.
+int64_t virtio_negotiate(virtio_dev_t *dev, uint64_t wanted);
+
+// Set DRIVER_OK once the queues are ready.
+void virtio_driver_ok(virtio_dev_t *dev);
+
+// Mark the device FAILED, for a driver giving up on it.
+void virtio_fail(virtio_dev_t *dev);
+
+// Allocate queue 'index' with up to 'max_size' entries and hand it to the
+// device. Returns 0, or -1 if the device has no such queue or out of
+// memory.
+int virtq_init(virtq_t *vq, virtio_dev_t *dev, uint32_t index,
+               uint32_t max_size);
+
+// Take a free descriptor chain of 'count' entries, linked with
+// VIRTQ_DESC_F_NEXT; the caller fills in addr and len and ORs in
+// VIRTQ_DESC_F_WRITE for buffers the device writes. Returns the head, or -1
+// if fewer than 'count' are free.
+int32_t virtq_alloc_chain(virtq_t *vq, uint32_t count);
+
+// Queue the chain at 'head' in the avail ring. The device does not see it
+// until the next virtq_kick().
+void virtq_push(virtq_t *vq, uint16_t head);
+
+// Publish everything pushed since the last kick and ring the doorbell once,
+// unless the device asked not to be notified. Returns 1 if it notified.
+int virtq_kick(virtq_t *vq);
+
+// Next completed chain: its head, and the bytes the device wrote in '*len'
+// ('len' may be NULL). Frees the chain's descriptors. Returns -1 when the
+// used ring is empty.
+int32_t virtq_pop_used(virtq_t *vq, uint32_t *len);
+
+// Route the device's interrupt to the calling CPU and run 'handler' for it.
+void virtio_set_irq_handler(virtio_dev_t *dev, void (*handler)(void));
+
+// Called from c_irq_handler() for the GIC interrupts of all transports;
+// runs the handler registered for 'slot'.
+void virtio_irq_handler(uint32_t slot);
+
+#endif  // VIRTIO_H
@@ -0,0 +1,103 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+
+// virtio-blk driver on one split virtqueue.
+//
+// Requests are asynchronous: virtio_blk_submit() chains a header, the data
+// segments and a status byte into descriptors and queues them in the avail
+// ring, and virtio_blk_kick() publishes everything queued since the last
+// kick with a single QueueNotify write. Many requests can be in flight at
+// once; when the ring is full, further ones wait in a backlog that the
+// interrupt handler posts as descriptors come back. Completions arrive by
+// interrupt, which finishes each request and either runs its callback or
+// wakes the task waiting on it, so a task can queue I/O, compute, and
+// only then wait.
+//
+// Data buffers must be kernel RAM from page_alloc() or kmalloc() (identity
+// mapped and physically contiguous), not task stacks.
+
+#define VIRTIO_BLK_SECTOR_SIZE 512
+#define VIRTIO_BLK_MAX_SEGS 16   // Scatter/gather segments per request
+#define VIRTIO_BLK_QUEUE_SIZE 128  // Ring entries we ask for
+
+// Request types (the virtio-blk header values)
+#define VIRTIO_BLK_T_IN 0     // Read
+#define VIRTIO_BLK_T_OUT 1    // Write
+#define VIRTIO_BLK_T_FLUSH 4  // Write back the device's cache, no data
+
+// Feature bits we use
+#define VIRTIO_BLK_F_SEG_MAX 2
+#define VIRTIO_BLK_F_RO 5
+#define VIRTIO_BLK_F_FLUSH 9
+
+// virtio_blk_req_t.status until the request completes; then 0 or -1.
+#define VIRTIO_BLK_PENDING 1
+
+struct tcb;
+
+typedef struct {
+    void *buf;
+    uint32_t len;  // Multiple of VIRTIO_BLK_SECTOR_SIZE
+} virtio_blk_seg_t;
+
+typedef struct virtio_blk_req {
+    uint32_t type;
+    uint64_t sector;   // First sector
+    uint32_t nr_segs;  // 0 for a flush
+    virtio_blk_seg_t segs[VIRTIO_BLK_MAX_SEGS];
+    // Optional. Runs in IRQ context once 'status' is set, with no driver
+    // lock held, so it may submit more requests. A request with a callback
+    // is not waited for: the callback decides when it may be reused.
+    void (*done)(struct virtio_blk_req *req);
+    void *data;
+    volatile int32_t status;
+
+    // Driver-private
+    struct tcb *waiter;
+    struct virtio_blk_req *next;  // Backlog and completion lists
+} virtio_blk_req_t;
+
+typedef struct {
+    uint64_t requests;    // Submitted
+    uint64_t completed;
+    uint64_t notifies;    // QueueNotify writes
+    uint64_t interrupts;
+    uint64_t backlogged;  // Requests that found the ring full
+} virtio_blk_stats_t;
+
+// Find and set up the first virtio-blk device. Needs the GIC and the page
+// allocator. Returns 0, or -1 if there is no usable disk.
+int virtio_blk_init(void);
+
+// Non-zero once virtio_blk_init() found a disk.
+int virtio_blk_present(void);
+
+// Disk size in sectors, and whether it is read-only.
+uint64_t virtio_blk_capacity(void);
+int virtio_blk_read_only(void);
+
+// Queue 'req' (type, sector, segs, done and data filled in). Never blocks.
+// Returns 0, or -1 for a malformed request, one past the end of the disk,
+// or a write to a read-only disk.
+int virtio_blk_submit(virtio_blk_req_t *req);
+
+// Let the device see every request submitted since the last kick, with one
+// doorbell write.
+void virtio_blk_kick(void);
+
+// Kick, then block until 'req' completes. Task context only; returns the
+// request's status, or -1 when called from outside a task. In that case
+// 'req' is still in flight: the driver and the device keep using it, so it
+// must stay valid (and unreused) until it completes.
+int32_t virtio_blk_wait(virtio_blk_req_t *req);
+
+// Synchronous read or write of 'len' bytes at 'sector'. Task context only:
+// returns -1 without submitting anything when called from outside a task.
+int32_t virtio_blk_rw(uint32_t type, uint64_t sector, void *buf,
+                      uint32_t len);
+
+void virtio_blk_get_stats(virtio_blk_stats_t *stats);
+
+#endif  // VIRTIO_BLK_H
@@ -0,0 +1,73 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <stdint.h>
+
+#include "spinlock.h"
+#include "task.h"
+
+// Wait queues: a list of tasks blocked until some condition on a kernel
+// object holds.
+//
+// A waiter queues itself (an entry on its own stack) and marks itself
+// TASK_BLOCKED before it checks the condition, and a waker changes the
+// state behind the condition before it calls wake_up_one() or
+// wake_up_all(), so a wakeup can never fall between the check and the
+// block. A woken task is made ready straight away (task_wake()) and checks
+// the condition again when it runs. wait_event() wraps the whole protocol.
+//
+// Wakers may run in IRQ context; waiting needs a task. Lock order: the
+// queue's lock nests inside any lock a waker holds while waking.
+
+typedef struct wait_entry {
+    tcb_t *task;
+    struct wait_entry *next;
+    struct wait_entry *prev;
+    uint32_t queued;
+} wait_entry_t;
+
+typedef struct {
+    spinlock_t lock;
+    wait_entry_t *head;  // Oldest waiter first
+    wait_entry_t *tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT {SPINLOCK_INIT, NULL, NULL}
+
+void wait_queue_init(wait_queue_t *wq);
+
+// Queue the calling task on 'wq' (if it is not already) and mark it
+// TASK_BLOCKED. Call with IRQs masked, then check the condition and
+// task_block() if it is still false.
+void prepare_to_wait(wait_queue_t *wq, wait_entry_t *entry);
+
+// Leave 'wq' after waking up or finding the condition true, and mark the
+// task running again.
+void finish_wait(wait_queue_t *wq, wait_entry_t *entry);
+
+// Wake the oldest waiter, or every waiter. wake_up_one() returns 1 if
+// there was one to wake.
+int wake_up_one(wait_queue_t *wq);
+void wake_up_all(wait_queue_t *wq);
+
+// Sleep until 'cond' is true. Task context only. 'cond' is evaluated with
+// IRQs masked and may be evaluated several times.
+#define wait_event(wq, cond)                          \
+    do {                                              \
+        if (cond) {                                   \
+            break;                                    \
+        }                                             \
+        wait_entry_t __wait_entry = {0};              \
+        uint64_t __wait_flags = local_irq_save();     \
+        while (1) {                                   \
+            prepare_to_wait((wq), &__wait_entry);     \
+            if (cond) {                               \
+                break;                                \
+            }                                         \
+            task_block();                             \
+        }                                             \
+        finish_wait((wq), &__wait_entry);             \
+        local_irq_restore(__wait_flags);              \
+    } while (0)
+
+#endif  // WAIT_H
@@ -0,0 +1,159 @@
+#include "bench.h"
+
+#ifdef CONFIG_BENCH
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "channel.h"
+#include "kmalloc.h"
+#include "kprintf.h"
+#include "string.h"
+#include "task.h"
+#include "timer.h"
+
+// Ping-pong between two tasks over a pair of channels: round trips with
+// inline payloads and with a large buffer handed back and forth, then a
+// one-way stream. Latencies are in CNTPCT_EL0 ticks.
+#define BENCH_IPC_ROUNDS 10000
+#define BENCH_IPC_STREAM 100000
+#define BENCH_IPC_SLOTS 16
+#define BENCH_IPC_BUF_SIZE (1UL << 20)
+
+enum {
+    IPC_ECHO,  // Reply with the same message
+    IPC_SINK,  // No reply
+    IPC_QUIT,  // Reply, then exit
+};
+
+typedef struct {
+    channel_t *to_pong;
+    channel_t *to_ping;
+} ipc_pair_t;
+
+static ipc_pair_t ipc_pair;
+
+static void pong_task(void *arg) {
+    ipc_pair_t *pair = arg;
+    channel_msg_t msg;
+    while (channel_recv(pair->to_pong, &msg) == 0) {
+        if (msg.tag == IPC_SINK) {
+            continue;
+        }
+        // Any buffer goes back with the reply.
+        if (channel_send(pair->to_ping, &msg) < 0 || msg.tag == IPC_QUIT) {
+            break;
+        }
+    }
+    task_exit();
+}
+
+typedef struct {
+    uint64_t total;  // Ticks for all rounds
+    uint64_t min;
+    uint64_t max;
+} rtt_t;
+
+// 'rounds' round trips of 'msg'. Returns -1 if a channel failed.
+static int ping_rounds(ipc_pair_t *pair, channel_msg_t *msg, uint32_t rounds,
+                       rtt_t *rtt) {
+    rtt->min = UINT64_MAX;
+    rtt->max = 0;
+    uint64_t start = timer_read_counter();
+    for (uint32_t i = 0; i < rounds; ++i) {
+        uint64_t t0 = timer_read_counter();
+        msg->tag = IPC_ECHO;
+        if (channel_send(pair->to_pong, msg) < 0 ||
+            channel_recv(pair->to_ping, msg) < 0) {
+            return -1;
+        }
+        uint64_t t = timer_read_counter() - t0;
+        rtt->min = t < rtt->min ? t : rtt->min;
+        rtt->max = t > rtt->max ? t : rtt->max;
+    }
+    rtt->total = timer_read_counter() - start;
+    return 0;
+}
+
+static void print_rtt(const char *what, uint32_t rounds, const rtt_t *rtt) {
+    uint64_t ns = timer_ticks_to_ns(rtt->total);
+    kprintf("  %s: %lu msgs/s, round trip %lu ticks avg, %lu min, %lu max\n",
+            what, ns ? 2UL * rounds * 1000000000UL / ns : 0,
+            rtt->total / rounds, rtt->min, rtt->max);
+}
+
+// Returns 0 once pong has acknowledged IPC_QUIT, -1 if a channel failed.
+static int run_all(ipc_pair_t *pair) {
+    channel_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    rtt_t rtt;
+
+    kprintf("IPC benchmark (%u slots, 64-byte messages):\n",
+            BENCH_IPC_SLOTS);
+    if (ping_rounds(pair, &msg, BENCH_IPC_ROUNDS, &rtt) < 0) {
+        return -1;
+    }
+    print_rtt("inline ping-pong", BENCH_IPC_ROUNDS, &rtt);
+
+    // The buffer changes hands twice per round and is never copied, so
+    // this should cost what the inline case does whatever its size.
+    msg.buf = kmalloc(BENCH_IPC_BUF_SIZE);
+    msg.len = BENCH_IPC_BUF_SIZE;
+    if (msg.buf) {
+        void *buf = msg.buf;
+        if (ping_rounds(pair, &msg, BENCH_IPC_ROUNDS, &rtt) < 0) {
+            return -1;
+        }
+        print_rtt("1 MiB handoff   ", BENCH_IPC_ROUNDS, &rtt);
+        if (msg.buf != buf) {
+            kprintf("  handoff returned a different buffer\n");
+        }
+        kfree(msg.buf);
+        msg.buf = NULL;
+        msg.len = 0;
+    }
+
+    // One way: the ring lets the sender run ahead of the receiver.
+    uint64_t start = timer_read_counter();
+    msg.tag = IPC_SINK;
+    for (uint32_t i = 0; i < BENCH_IPC_STREAM; ++i) {
+        if (channel_send(pair->to_pong, &msg) < 0) {
+            return -1;
+        }
+    }
+    msg.tag = IPC_QUIT;  // Its reply also means the stream was drained
+    if (channel_send(pair->to_pong, &msg) < 0 ||
+        channel_recv(pair->to_ping, &msg) < 0) {
+        return -1;
+    }
+    uint64_t ns = timer_ticks_to_ns(timer_read_counter() - start);
+    kprintf("  one-way stream: %lu msgs/s\n",
+            ns ? (uint64_t)BENCH_IPC_STREAM * 1000000000UL / ns : 0);
+    return 0;
+}
+
+// The caller is the ping side.
+void bench_ipc(void) {
+    ipc_pair_t *pair = &ipc_pair;
+    pair->to_pong = channel_create(BENCH_IPC_SLOTS);
+    pair->to_ping = channel_create(BENCH_IPC_SLOTS);
+    if (!pair->to_pong || !pair->to_ping ||
+        task_create(pong_task, pair, "IPCPong", TASK_PRIO_DEFAULT, 0) < 0) {
+        kprintf("IPC benchmark: cannot set up\n");
+        if (pair->to_pong) {
+            channel_destroy(pair->to_pong);
+        }
+        if (pair->to_ping) {
+            channel_destroy(pair->to_ping);
+        }
+        return;
+    }
+    // Pong's reply to IPC_QUIT is the last time it touches either channel,
+    // so only then can they go. On failure they are left behind.
+    if (run_all(pair) == 0) {
+        channel_destroy(pair->to_pong);
+        channel_destroy(pair->to_ping);
+    }
+}
+
+#endif  // CONFIG_BENCH
@@ -0,0 +1,121 @@
+#include "bench.h"
+
+#ifdef CONFIG_BENCH
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "page_alloc.h"
+#include "string.h"
+#include "timer.h"
+#include "uart.h"
+
+// memset/memcpy/memmove against plain byte loops, 8 B to 1 MiB. Each size
+// moves about BENCH_STRING_BYTES in total so the small ones are not lost in
+// timer resolution.
+#define BENCH_STRING_ORDER 9  // 2 MiB: 1 MiB source, 1 MiB destination
+#define BENCH_STRING_MAX (1UL << 20)
+#define BENCH_STRING_BYTES (8UL << 20)
+#define BENCH_STRING_MIN_ITERS 8
+
+// What the kernel did before string.s. Volatile, so GCC cannot turn the
+// loops back into calls to the routines they are compared with.
+static void byte_set(void *dst, int c, size_t n) {
+    volatile uint8_t *d = dst;
+    while (n--) {
+        *d++ = (uint8_t)c;
+    }
+}
+
+static void byte_copy(void *dst, const void *src, size_t n) {
+    volatile uint8_t *d = dst;
+    const volatile uint8_t *s = src;
+    while (n--) {
+        *d++ = *s++;
+    }
+}
+
+static void print_mb_per_s(uint64_t bytes, uint64_t ticks) {
+    uint64_t ns = timer_ticks_to_ns(ticks);
+    print_uint(ns ? bytes * 1000 / ns : 0);
+}
+
+enum { OP_SET_ZERO, OP_SET, OP_COPY, OP_MOVE, OP_NR };
+
+static const char *const op_names[OP_NR] = {
+    "memset(0)", "memset(x)", "memcpy   ", "memmove  ",
+};
+
+static const uint64_t sizes[] = {
+    8, 64, 512, 4096, 32768, 262144, BENCH_STRING_MAX,
+};
+
+// Run one operation 'iters' times on 'size' bytes; returns the ticks taken.
+static uint64_t run_op(int op, int fast, uint8_t *buf, uint64_t size,
+                       uint32_t iters) {
+    uint8_t *src = buf;
+    uint8_t *dst = buf + BENCH_STRING_MAX;
+    uint64_t start = timer_read_counter();
+    for (uint32_t i = 0; i < iters; ++i) {
+        switch (op) {
+        case OP_SET_ZERO:
+            fast ? (void)memset(dst, 0, size) : byte_set(dst, 0, size);
+            break;
+        case OP_SET:
+            fast ? (void)memset(dst, 0x5a, size) : byte_set(dst, 0x5a, size);
+            break;
+        case OP_COPY:
+            fast ? (void)memcpy(dst, src, size) : byte_copy(dst, src, size);
+            break;
+        case OP_MOVE:
+            // Overlapping, destination above the source: the backward path.
+            if (fast) {
+                memmove(src + 8, src, size);
+            } else {
+                volatile uint8_t *p = src;
+                for (uint64_t j = size; j-- > 0;) {
+                    p[j + 8] = p[j];
+                }
+            }
+            break;
+        }
+    }
+    return timer_read_counter() - start;
+}
+
+void bench_string(void) {
+    uint8_t *buf = page_alloc(BENCH_STRING_ORDER);
+    if (!buf) {
+        uart_puts("string benchmark: no memory\n");
+        return;
+    }
+    byte_set(buf, 0xa5, 2 * BENCH_STRING_MAX);
+
+    uart_puts("string benchmark (MB/s, string.s vs byte loop):\n");
+    for (int op = 0; op < OP_NR; ++op) {
+        for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            uint64_t size = sizes[s];
+            uint32_t iters = BENCH_STRING_BYTES / size;
+            if (iters < BENCH_STRING_MIN_ITERS) {
+                iters = BENCH_STRING_MIN_ITERS;
+            }
+            uint64_t fast = run_op(op, 1, buf, size, iters);
+            // The byte loops are slow; a quarter of the work is plenty.
+            uint32_t slow_iters = iters / 4 ? iters / 4 : 1;
+            uint64_t slow = run_op(op, 0, buf, size, slow_iters);
+
+            uart_puts("  ");
+            uart_puts(op_names[op]);
+            uart_puts(" ");
+            print_uint(size);
+            uart_puts(" B: ");
+            print_mb_per_s(size * iters, fast);
+            uart_puts(" vs ");
+            print_mb_per_s(size * slow_iters, slow);
+            uart_puts("\n");
+        }
+    }
+    page_free(buf, BENCH_STRING_ORDER);
+}
+
+#endif  // CONFIG_BENCH
@@ -0,0 +1,123 @@
+#include "bench.h"
+
+#ifdef CONFIG_BENCH
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kprintf.h"
+#include "sync.h"
+#include "task.h"
+#include "timer.h"
+
+// Mutex cost uncontended, then N tasks hammering one mutex for
+// BENCH_SYNC_RUN_NS each: total throughput and how evenly the
+// acquisitions were shared (min/max per task and Jain's fairness index,
+// 100 = perfectly even).
+#define BENCH_SYNC_UNCONTENDED 100000
+#define BENCH_SYNC_MAX_TASKS 8
+#define BENCH_SYNC_RUN_NS 200000000UL  // 200 ms per run
+#define BENCH_SYNC_HOLD 64  // Busy-loop iterations inside the lock
+
+typedef struct {
+    uint64_t count;  // Acquisitions by this worker
+} worker_t;
+
+static mutex_t bench_lock = MUTEX_INIT;
+static uint64_t bench_shared;  // Only touched with bench_lock held
+
+// Start line: workers wait on 'start_cv' until 'start_go' is set.
+static mutex_t start_lock = MUTEX_INIT;
+static condvar_t start_cv = CONDVAR_INIT;
+static uint32_t start_go;
+static uint64_t run_deadline;
+
+static semaphore_t workers_done = SEMAPHORE_INIT(0);
+static worker_t workers[BENCH_SYNC_MAX_TASKS];
+
+static void worker_task(void *arg) {
+    worker_t *self = arg;
+
+    mutex_lock(&start_lock);
+    while (!start_go) {
+        cond_wait(&start_cv, &start_lock);
+    }
+    mutex_unlock(&start_lock);
+
+    while (timer_read_counter() < run_deadline) {
+        mutex_lock(&bench_lock);
+        bench_shared++;
+        for (volatile uint32_t i = 0; i < BENCH_SYNC_HOLD; ++i) {
+        }
+        mutex_unlock(&bench_lock);
+        self->count++;
+    }
+    sem_up(&workers_done);
+    task_exit();
+}
+
+static void run_contended(uint32_t nr) {
+    start_go = 0;
+    bench_shared = 0;
+    for (uint32_t i = 0; i < nr; ++i) {
+        workers[i].count = 0;
+        if (task_create(worker_task, &workers[i], "SyncBench",
+                        TASK_PRIO_DEFAULT, 0) < 0) {
+            kprintf("  cannot create worker %u\n", i);
+            nr = i;
+            break;
+        }
+    }
+    task_sleep_ns(10000000ULL);  // Let them all reach the start line
+
+    mutex_lock(&start_lock);
+    run_deadline = timer_read_counter() + timer_ns_to_ticks(BENCH_SYNC_RUN_NS);
+    start_go = 1;
+    cond_broadcast(&start_cv);
+    mutex_unlock(&start_lock);
+
+    for (uint32_t i = 0; i < nr; ++i) {
+        sem_down(&workers_done);
+    }
+    if (nr == 0) {
+        return;
+    }
+
+    uint64_t total = 0;
+    uint64_t sum_sq = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    for (uint32_t i = 0; i < nr; ++i) {
+        uint64_t c = workers[i].count;
+        total += c;
+        sum_sq += c * c;
+        min = c < min ? c : min;
+        max = c > max ? c : max;
+    }
+    // Jain's index: total^2 / (n * sum of squares), scaled to 0-100.
+    uint64_t fairness = sum_sq ? total * total * 100 / (nr * sum_sq) : 0;
+    kprintf("  %u tasks: %lu locks/s, per task min %lu max %lu, "
+            "fairness %lu%s\n",
+            nr, total * 1000000000UL / BENCH_SYNC_RUN_NS, min, max, fairness,
+            bench_shared == total ? "" : " (COUNT MISMATCH)");
+}
+
+void bench_sync(void) {
+    mutex_t m = MUTEX_INIT;
+    uint64_t start = timer_read_counter();
+    for (uint32_t i = 0; i < BENCH_SYNC_UNCONTENDED; ++i) {
+        mutex_lock(&m);
+        mutex_unlock(&m);
+    }
+    uint64_t ticks = timer_read_counter() - start;
+    kprintf("mutex benchmark:\n  uncontended lock+unlock: %lu ns\n",
+            timer_ticks_to_ns(ticks) / BENCH_SYNC_UNCONTENDED);
+
+    static const uint32_t task_counts[] = {2, 4, BENCH_SYNC_MAX_TASKS};
+    for (uint32_t i = 0; i < sizeof(task_counts) / sizeof(task_counts[0]);
+         ++i) {
+        run_contended(task_counts[i]);
+    }
+}
+
+#endif  // CONFIG_BENCH
@@ -0,0 +1,106 @@
+#include "bench.h"
+
+#ifdef CONFIG_BENCH
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common_macros.h"
+#include "kstack.h"
+#include "mmu.h"
+#include "page_alloc.h"
+#include "pmu.h"
+#include "timer.h"
+#include "uart.h"
+
+// A 4 MiB buffer is reached through the linear map (2 MiB blocks) and
+// through an alias of it mapped with 4K pages, just below the stack window.
+#define BENCH_TLB_ORDER PAGE_MAX_ORDER
+#define BENCH_TLB_BYTES (PAGE_SIZE << BENCH_TLB_ORDER)
+#define BENCH_TLB_PAGES (1UL << BENCH_TLB_ORDER)
+#define BENCH_TLB_ALIAS_VA (KSTACK_VA_BASE - 64 * 1024 * 1024)
+#define BENCH_TLB_PASSES 16
+// Odd, so (i * STRIDE) % PAGES visits every page, in an order the
+// prefetchers and a small TLB cannot follow.
+#define BENCH_TLB_STRIDE 613
+
+static const uint32_t bench_tlb_events[] = {
+    PMU_EV_L1D_TLB_REFILL,
+    PMU_EV_L2D_TLB_REFILL,
+    PMU_EV_DTLB_WALK,
+};
+static const char *const bench_tlb_event_names[] = {
+    "L1D_TLB_REFILL",
+    "L2D_TLB_REFILL",
+    "DTLB_WALK",
+};
+#define BENCH_TLB_NR_EVENTS \
+    (sizeof(bench_tlb_events) / sizeof(bench_tlb_events[0]))
+
+// One word per page, every page once per pass.
+static uint64_t touch_pages(uint64_t base) {
+    uint64_t sum = 0;
+    for (uint32_t pass = 0; pass < BENCH_TLB_PASSES; ++pass) {
+        for (uint64_t i = 0; i < BENCH_TLB_PAGES; ++i) {
+            uint64_t page = (i * BENCH_TLB_STRIDE) % BENCH_TLB_PAGES;
+            sum += *(volatile uint64_t *)(base + page * PAGE_SIZE);
+        }
+    }
+    return sum;
+}
+
+static void bench_tlb_run(const char *label, uint64_t base) {
+    uint32_t counters = pmu_num_counters();
+    touch_pages(base);  // Warm the caches; the TLB cannot hold it all anyway
+
+    for (uint32_t i = 0; i < BENCH_TLB_NR_EVENTS && i < counters; ++i) {
+        pmu_counter_start(i, bench_tlb_events[i]);
+    }
+    uint64_t start = timer_read_counter();
+    touch_pages(base);
+    uint64_t ticks = timer_read_counter() - start;
+
+    uint64_t accesses = BENCH_TLB_PASSES * BENCH_TLB_PAGES;
+    uart_puts(label);
+    print_uint(timer_ticks_to_ns(ticks) / accesses);
+    uart_puts(" ns/access\n");
+    for (uint32_t i = 0; i < BENCH_TLB_NR_EVENTS && i < counters; ++i) {
+        pmu_counter_stop(i);
+        uart_puts("    ");
+        uart_puts(bench_tlb_event_names[i]);
+        uart_puts(": ");
+        if (pmu_event_supported(bench_tlb_events[i])) {
+            print_uint(pmu_counter_read(i));
+        } else {
+            uart_puts("not implemented by this PMU");
+        }
+        uart_puts("\n");
+    }
+}
+
+void bench_tlb(void) {
+    uart_puts("TLB reach benchmark (");
+    print_uint(BENCH_TLB_BYTES >> 20);
+    uart_puts(" MiB, one access per page):\n");
+
+    void *buf = page_alloc(BENCH_TLB_ORDER);
+    if (!buf) {
+        uart_puts("  skipped: out of memory\n");
+        return;
+    }
+    if (mmu_lookup(BENCH_TLB_ALIAS_VA, NULL) == 0 ||
+        mmu_map_range_pages(BENCH_TLB_ALIAS_VA, (uint64_t)buf,
+                            BENCH_TLB_BYTES, MMU_PROT_KERNEL_RW) < 0) {
+        uart_puts("  skipped: no room for the 4K alias\n");
+        page_free(buf, BENCH_TLB_ORDER);
+        return;
+    }
+
+    bench_tlb_run("  2 MiB blocks (linear map): ", (uint64_t)buf);
+    bench_tlb_run("  4 KiB pages (alias):       ", BENCH_TLB_ALIAS_VA);
+
+    mmu_unmap_range(BENCH_TLB_ALIAS_VA, BENCH_TLB_BYTES);
+    page_free(buf, BENCH_TLB_ORDER);
+}
+
+#endif  // CONFIG_BENCH
@@ -0,0 +1,174 @@
+#include "bench.h"
+
+#ifdef CONFIG_BENCH
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kprintf.h"
+#include "page_alloc.h"
+#include "string.h"
+#include "task.h"
+#include "timer.h"
+#include "virtio_blk.h"
+
+// Sequential and random reads and writes of BENCH_BLK_REQ_SIZE requests,
+// one at a time and BENCH_BLK_DEPTH in flight. Moves BENCH_BLK_BYTES per
+// run within the first BENCH_BLK_SPAN bytes of the disk, which it
+// overwrites.
+#define BENCH_BLK_REQ_SIZE 4096
+#define BENCH_BLK_DEPTH 32
+#define BENCH_BLK_BYTES (4UL << 20)
+#define BENCH_BLK_SPAN (16UL << 20)
+
+#define BENCH_BLK_REQ_SECTORS (BENCH_BLK_REQ_SIZE / VIRTIO_BLK_SECTOR_SIZE)
+#define BENCH_BLK_BUF_ORDER 5  // BENCH_BLK_DEPTH pages
+
+_Static_assert((PAGE_SIZE << BENCH_BLK_BUF_ORDER) >=
+                   BENCH_BLK_DEPTH * BENCH_BLK_REQ_SIZE,
+               "one buffer per request in flight");
+
+static virtio_blk_req_t bench_reqs[BENCH_BLK_DEPTH];
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t xorshift64(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// 'nr' requests with up to 'depth' in flight. Free slots are refilled in
+// one go and kicked with a single doorbell, then we sleep until the oldest
+// completes and collect every finished request behind it. On an error the
+// requests still in flight are waited for before returning, so neither
+// their buffers nor bench_reqs[] are reused under the device.
+static int run(uint32_t type, int random, uint32_t depth, uint8_t *bufs,
+               uint64_t span_reqs, uint32_t nr) {
+    uint32_t submitted = 0;
+    uint32_t completed = 0;
+    int err = 0;
+    while (!err && completed < nr) {
+        while (submitted < nr && submitted - completed < depth) {
+            uint32_t slot = submitted % depth;
+            virtio_blk_req_t *req = &bench_reqs[slot];
+            uint64_t n = random ? xorshift64() % span_reqs
+                                : submitted % span_reqs;
+            req->type = type;
+            req->sector = n * BENCH_BLK_REQ_SECTORS;
+            req->nr_segs = 1;
+            req->segs[0].buf = bufs + slot * BENCH_BLK_REQ_SIZE;
+            req->segs[0].len = BENCH_BLK_REQ_SIZE;
+            req->done = NULL;
+            if (virtio_blk_submit(req) < 0) {
+                err = -1;
+                break;
+            }
+            submitted++;
+        }
+        if (err) {
+            break;
+        }
+        virtio_blk_kick();
+
+        if (virtio_blk_wait(&bench_reqs[completed % depth]) < 0) {
+            err = -1;
+        }
+        completed++;
+        while (completed < submitted &&
+               bench_reqs[completed % depth].status != VIRTIO_BLK_PENDING) {
+            if (bench_reqs[completed % depth].status < 0) {
+                err = -1;
+            }
+            completed++;
+        }
+    }
+    // We run as a task, so each wait blocks until its request is done
+    // (and kicks anything not yet published).
+    for (; completed < submitted; ++completed) {
+        virtio_blk_wait(&bench_reqs[completed % depth]);
+    }
+    return err;
+}
+
+// Write a pattern to the first request's sectors and read it back.
+static int check_pattern(uint8_t *bufs) {
+    uint8_t *out = bufs;
+    uint8_t *in = bufs + BENCH_BLK_REQ_SIZE;
+    for (uint32_t i = 0; i < BENCH_BLK_REQ_SIZE; ++i) {
+        out[i] = (uint8_t)(i * 7 + 3);
+    }
+    if (virtio_blk_rw(VIRTIO_BLK_T_OUT, 0, out, BENCH_BLK_REQ_SIZE) < 0 ||
+        virtio_blk_rw(VIRTIO_BLK_T_IN, 0, in, BENCH_BLK_REQ_SIZE) < 0) {
+        return -1;
+    }
+    return memcmp(out, in, BENCH_BLK_REQ_SIZE) == 0 ? 0 : -1;
+}
+
+static void run_all(uint8_t *bufs) {
+    if (check_pattern(bufs) < 0) {
+        kprintf("virtio-blk benchmark: write/read-back check failed\n");
+        return;
+    }
+
+    uint64_t span = BENCH_BLK_SPAN / VIRTIO_BLK_SECTOR_SIZE;
+    if (span > virtio_blk_capacity()) {
+        span = virtio_blk_capacity();
+    }
+    uint64_t span_reqs = span / BENCH_BLK_REQ_SECTORS;
+    uint32_t nr = BENCH_BLK_BYTES / BENCH_BLK_REQ_SIZE;
+
+    static const uint32_t depths[] = {1, BENCH_BLK_DEPTH};
+    kprintf("virtio-blk benchmark (%u B requests, %lu KiB span):\n",
+            BENCH_BLK_REQ_SIZE, span_reqs * BENCH_BLK_REQ_SIZE / 1024);
+    for (int random = 0; random <= 1; ++random) {
+        for (uint32_t type = VIRTIO_BLK_T_IN; type <= VIRTIO_BLK_T_OUT;
+             ++type) {
+            for (uint32_t d = 0; d < 2; ++d) {
+                virtio_blk_stats_t before, after;
+                virtio_blk_get_stats(&before);
+                uint64_t start = timer_read_counter();
+                int err = run(type, random, depths[d], bufs, span_reqs, nr);
+                uint64_t ns = timer_ticks_to_ns(timer_read_counter() - start);
+                virtio_blk_get_stats(&after);
+                if (err) {
+                    kprintf("  I/O error\n");
+                    return;
+                }
+
+                uint64_t bytes = (uint64_t)nr * BENCH_BLK_REQ_SIZE;
+                uint64_t notifies = after.notifies - before.notifies;
+                uint64_t irqs = after.interrupts - before.interrupts;
+                kprintf("  %s %-5s depth %2u: %5lu MB/s, %7lu IOPS, "
+                        "%lu req/notify, %lu req/IRQ\n",
+                        random ? "random" : "seq   ",
+                        type == VIRTIO_BLK_T_IN ? "read" : "write",
+                        depths[d], ns ? bytes * 1000 / ns : 0,
+                        ns ? (uint64_t)nr * 1000000000UL / ns : 0,
+                        notifies ? nr / notifies : nr,
+                        irqs ? nr / irqs : nr);
+            }
+        }
+    }
+}
+
+void bench_virtio_blk(void) {
+    if (!virtio_blk_present()) {
+        return;
+    }
+    if (virtio_blk_read_only() ||
+        virtio_blk_capacity() < 2 * BENCH_BLK_REQ_SECTORS) {
+        kprintf("virtio-blk benchmark: needs a writable disk\n");
+        return;
+    }
+    uint8_t *bufs = page_alloc(BENCH_BLK_BUF_ORDER);
+    if (!bufs) {
+        kprintf("virtio-blk benchmark: no memory\n");
+        return;
+    }
+    run_all(bufs);
+    page_free(bufs, BENCH_BLK_BUF_ORDER);
+}
+
+#endif  // CONFIG_BENCH
@@ -10,14 +10,45 @@
 
 .text
 _start:
+    // 0. Keep the device tree address QEMU passes in x0 (if any) before
+    // anything clobbers it. kernel_main() validates it. Also note when we
+    // got here, for the boot-time summary (see boottime.c). Both live in
+    // .data so the BSS clear below leaves them alone.
+    ldr x1, =boot_dtb_addr
+    str x0, [x1]
+    mrs x1, cntpct_el0
+    ldr x2, =boot_start_ticks
+    str x1, [x2]
+
+    // Zero .bss, including the boot stack, rather than trusting the loader
+    // to. The MMU is off, so all memory is Device and the stores must be
+    // aligned: the linker script aligns both ends to 16 bytes.
+    ldr x1, =__bss_start
+    ldr x2, =__bss_end
+1:  sub x3, x2, x1
+    cmp x3, #64
+    b.lo 2f
+    stp xzr, xzr, [x1]
+    stp xzr, xzr, [x1, #16]
+    stp xzr, xzr, [x1, #32]
+    stp xzr, xzr, [x1, #48]
+    add x1, x1, #64
+    b 1b
+2:  cmp x1, x2
+    b.hs 3f
+    stp xzr, xzr, [x1], #16
+    b 2b
+3:
+
     // 1. Set up stack pointer
     // Ensure this stack address is valid and won't collide with kernel/BSS/heap
     // For QEMU virt machine, RAM starts at 0x40000000.
-    // Let's put the initial stack for boot.s at the end of the first 1MB of RAM, growing downwards.
-    // 0x40000000 (RAM start) + 0x100000 (1MB) = 0x40100000
+    // The boot CPU's stack lives in .bss (boot_stack below) so it can never
+    // collide with the kernel image as it grows. Secondary cores get their
+    // own stacks from smp.c and enter at _secondary_entry instead.
     // This is just an initial stack for boot.s and early kernel_main.
     // The kernel might set up its own stack later, or per-task stacks.
-    ldr x30, =0x40100000 // Example stack top for bootloader
+    ldr x30, =boot_stack_top
     mov sp, x30
 
     // 2. Initialize UART (VBAR_EL1 setup is now done in C by exceptions_init)
@@ -27,16 +58,6 @@ _start:
     adr x0, boot_msg
     bl uart_puts
 
-    // Optional: Clear BSS (if your linker script defines _bss_start and _bss_end)
-    // ldr x1, =_bss_start
-    // ldr x2, =_bss_end
-    // clear_bss_loop:
-    //     cmp x1, x2
-    //     b.ge bss_cleared
-    //     str xzr, [x1], #8 // Zero out 8 bytes and increment pointer
-    //     b clear_bss_loop
-    // bss_cleared:
-
     // 4. Jump to kernel_main in C
     bl kernel_main
 
@@ -44,6 +65,25 @@ _start:
 end_loop:
     b end_loop
 
+// Entry point for secondary cores started with PSCI CPU_ON.
+// x0 = context ID = this core's cpu_t (see smp.c). The first field of cpu_t
+// is the top of the core's boot stack.
+.global _secondary_entry
+_secondary_entry:
+    ldr x1, [x0]            // cpu_t.boot_stack_top
+    mov sp, x1
+    msr tpidr_el1, x0       // this_cpu() reads TPIDR_EL1
+    bl secondary_main       // secondary_main(cpu_t *cpu), does not return
+secondary_end_loop:
+    b secondary_end_loop
+
+// PSCI call through the HVC conduit used by QEMU virt.
+// x0 = function ID, x1-x3 = arguments. Returns the PSCI status in x0.
+.global psci_call
+psci_call:
+    hvc #0
+    ret
+
 .global enable_interrupts
 enable_interrupts:
     msr daifclr, #2 // Clear IRQ mask bit (I bit in PSTATE/DAIF)
@@ -53,3 +93,18 @@ enable_interrupts:
 disable_interrupts:
     msr daifset, #2 // Set IRQ mask bit (I bit in PSTATE/DAIF)
     ret
+
+.section .data
+.balign 8
+.global boot_dtb_addr
+boot_dtb_addr:
+    .quad 0                 // x0 at entry: DTB physical address, or 0
+.global boot_start_ticks
+boot_start_ticks:
+    .quad 0                 // CNTPCT_EL0 at _start
+
+.section .bss
+.balign 16
+boot_stack:
+    .space 0x4000           // 16KB boot stack for the boot CPU
+boot_stack_top:
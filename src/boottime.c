@@ -0,0 +1,48 @@
+#include "boottime.h"
+
+#include "timer.h"
+#include "uart.h"
+
+typedef struct {
+    const char *name;
+    uint64_t end;  // CNTPCT_EL0 when the phase finished
+} boot_phase_t;
+
+// Only the boot CPU writes these, before any other core is up.
+static boot_phase_t boot_phases[BOOT_MAX_PHASES];
+static uint32_t boot_nr_phases;
+
+void boot_phase(const char *name) {
+    uint32_t idx = boot_nr_phases;
+    if (idx == BOOT_MAX_PHASES) {
+        idx--;
+    } else {
+        boot_nr_phases++;
+    }
+    boot_phases[idx].name = name;
+    boot_phases[idx].end = timer_read_counter();
+}
+
+static void print_us(uint64_t ticks) {
+    print_uint(timer_ticks_to_ns(ticks) / 1000);
+}
+
+void boot_time_report(void) {
+    uint64_t start = boot_start_ticks;
+    uint64_t now = timer_read_counter();
+
+    // CNTPCT_EL0 counts from reset, so 'start' is also the time spent in
+    // firmware and the loader.
+    uart_puts("Boot: ");
+    print_us(now - start);
+    uart_puts(" us to first task (loader ");
+    print_us(start);
+    for (uint32_t i = 0; i < boot_nr_phases; ++i) {
+        uart_puts(", ");
+        uart_puts(boot_phases[i].name);
+        uart_puts(" ");
+        print_us(boot_phases[i].end - start);
+        start = boot_phases[i].end;
+    }
+    uart_puts(")\n");
+}
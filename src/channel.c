@@ -0,0 +1,123 @@
+#include "channel.h"
+
+#include <stddef.h>
+
+#include "kmalloc.h"
+#include "spinlock.h"
+#include "task.h"
+#include "wait.h"
+
+// Caller holds ch->lock. Returns -1 if the ring is full.
+static int send_locked(channel_t *ch, channel_msg_t *msg) {
+    if (ch->head - ch->tail > ch->mask) {
+        return -1;
+    }
+    ch->slots[ch->head & ch->mask] = *msg;
+    ch->head++;
+    msg->buf = NULL;  // The receiver owns it now
+    // One message fills one slot, so one receiver is enough; if another
+    // task takes the message first, the woken one just waits again.
+    wake_up_one(&ch->not_empty);
+    return 0;
+}
+
+// Caller holds ch->lock. Returns -1 if the ring is empty.
+static int recv_locked(channel_t *ch, channel_msg_t *msg) {
+    if (ch->head == ch->tail) {
+        return -1;
+    }
+    *msg = ch->slots[ch->tail & ch->mask];
+    ch->tail++;
+    wake_up_one(&ch->not_full);
+    return 0;
+}
+
+// Unlocked peeks for wait_event(); the caller re-checks under ch->lock.
+static int has_room(channel_t *ch) {
+    return ch->closed || __atomic_load_n(&ch->head, __ATOMIC_RELAXED) -
+                                 __atomic_load_n(&ch->tail, __ATOMIC_RELAXED) <=
+                             ch->mask;
+}
+
+static int has_message(channel_t *ch) {
+    return ch->closed || __atomic_load_n(&ch->head, __ATOMIC_RELAXED) !=
+                             __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+}
+
+channel_t *channel_create(uint32_t slots) {
+    uint32_t size = 1;
+    while (size < slots) {
+        size <<= 1;
+    }
+    channel_t *ch = kzalloc(sizeof(*ch));
+    if (!ch) {
+        return NULL;
+    }
+    ch->slots = kmalloc(size * sizeof(channel_msg_t));
+    if (!ch->slots) {
+        kfree(ch);
+        return NULL;
+    }
+    spin_lock_init(&ch->lock);
+    wait_queue_init(&ch->not_full);
+    wait_queue_init(&ch->not_empty);
+    ch->mask = size - 1;
+    return ch;
+}
+
+void channel_destroy(channel_t *ch) {
+    while (ch->tail != ch->head) {
+        kfree(ch->slots[ch->tail++ & ch->mask].buf);
+    }
+    kfree(ch->slots);
+    kfree(ch);
+}
+
+void channel_close(channel_t *ch) {
+    uint64_t flags = spin_lock_irqsave(&ch->lock);
+    ch->closed = 1;
+    spin_unlock_irqrestore(&ch->lock, flags);
+    wake_up_all(&ch->not_full);
+    wake_up_all(&ch->not_empty);
+}
+
+int channel_send(channel_t *ch, channel_msg_t *msg) {
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&ch->lock);
+        int ret = ch->closed ? -1 : send_locked(ch, msg);
+        int closed = ch->closed;
+        spin_unlock_irqrestore(&ch->lock, flags);
+        if (ret == 0 || closed || !task_can_block()) {
+            return ret;
+        }
+        wait_event(&ch->not_full, has_room(ch));
+    }
+}
+
+int channel_recv(channel_t *ch, channel_msg_t *msg) {
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&ch->lock);
+        // Messages queued before a close are still delivered.
+        int ret = recv_locked(ch, msg);
+        int closed = ch->closed;
+        spin_unlock_irqrestore(&ch->lock, flags);
+        if (ret == 0 || closed || !task_can_block()) {
+            return ret;
+        }
+        wait_event(&ch->not_empty, has_message(ch));
+    }
+}
+
+int channel_try_send(channel_t *ch, channel_msg_t *msg) {
+    uint64_t flags = spin_lock_irqsave(&ch->lock);
+    int ret = ch->closed ? -1 : send_locked(ch, msg);
+    spin_unlock_irqrestore(&ch->lock, flags);
+    return ret;
+}
+
+int channel_try_recv(channel_t *ch, channel_msg_t *msg) {
+    uint64_t flags = spin_lock_irqsave(&ch->lock);
+    int ret = recv_locked(ch, msg);
+    spin_unlock_irqrestore(&ch->lock, flags);
+    return ret;
+}
@@ -1,74 +1,112 @@
 #include "exceptions.h"
 
 #include "common_macros.h"  // For INTERRUPT_ID_CNTPNSIRQ, etc.
+#include "fpsimd.h"         // For fpsimd_trap()
 #include "gic.h"
 #include "kernel.h"  // For enable_interrupts, disable_interrupts
+#include "kprintf.h"
+#include "kstack.h"  // For kstack_handle_fault()
+#include "smp.h"     // For this_cpu()
 #include "task.h"    // For schedule()
 #include "timer.h"
+#include "trace.h"
 #include "uart.h"
+#include "virtio.h"  // For virtio_irq_handler()
 
 // ... other code like g_tick_count ...
 
+_Static_assert(((sizeof(context_state_t) + 15) & ~15UL) == 272,
+               "vectors.s pushes a 272-byte frame (EXC_FRAME_SIZE)");
+
+// ESR_EL1.ISS data fault status codes 0b0001xx: translation fault, level xx
+#define DFSC_TRANSLATION_MASK 0x3C
+#define DFSC_TRANSLATION 0x04
+
 // Synchronous exception handler
 // ESR_EL1 contains the reason for the exception.
 // ctx points to the saved context on the stack, which includes ELR_EL1.
 void c_sync_handler(uint64_t esr_el1, context_state_t *ctx) {
+    uint8_t ec = (esr_el1 >> 26) & 0x3F;  // Exception Class
+
+    // Scheduler SVCs (the syscall form of task_yield() and friends). ELR_EL1
+    // already points past the svc instruction, so once schedule() returns
+    // here the frame can be resumed as-is.
+    if (ec == 0b010101) {
+        switch (esr_el1 & 0xFFFF) {  // ISS[15:0] = SVC immediate
+            case SVC_YIELD:
+            case SVC_BLOCK:
+            case SVC_EXIT:
+                schedule();
+                return;
+            default:
+                break;
+        }
+    }
+
+    // Lazy FP/SIMD switch: ELR_EL1 points at the trapped instruction, which
+    // is simply re-executed with the task's registers loaded.
+    if (ec == 0b000111) {
+        fpsimd_trap();
+        return;
+    }
+
+    // A task stack growing into its reserved range: map the page and retry
+    // the access. Overflowing the reservation kills the task instead.
+    if (ec == 0b100101 &&
+        (esr_el1 & DFSC_TRANSLATION_MASK) == DFSC_TRANSLATION) {
+        uint64_t far;
+        __asm__ __volatile__("mrs %0, far_el1" : "=r"(far));
+        if (kstack_handle_fault(far)) {
+            return;
+        }
+    }
+
     disable_interrupts();  // Should be safe to call, or ensure it's idempotent
-    uart_puts("\n--- Synchronous Exception Caught ---\n");
-    uart_puts("ESR_EL1: 0x");
-    print_hex(esr_el1);
-    uart_puts("\nELR_EL1 (from context): 0x");
-    print_hex(ctx->elr_el1);  // Access ELR_EL1 from the context structure
-    uart_puts("\nSPSR_EL1 (from context): 0x");
-    print_hex(ctx->spsr_el1);
-    uart_puts("\n");
+    klog_panic_begin();
+    kprintf("\n--- Synchronous Exception Caught ---\n");
+    kprintf("ESR_EL1: 0x%016lx\n", esr_el1);
+    kprintf("ELR_EL1 (from context): 0x%016lx\n", ctx->elr_el1);
+    kprintf("SPSR_EL1 (from context): 0x%016lx\n", ctx->spsr_el1);
 
     // Decode ESR_EL1
-    uint8_t ec = (esr_el1 >> 26) & 0x3F;  // Exception Class
     // uint32_t iss = esr_el1 & 0x1FFFFFF;  // Instruction Specific Syndrome
 
-    uart_puts("Exception Class (EC): 0x");
-    print_hex(ec);
+    kprintf("Exception Class (EC): 0x%x", ec);
 
     switch (ec) {
         case 0b010101:  // SVC instruction execution in AArch64 state
-            uart_puts(" (SVC instruction)\n");
-            // Handle SVC: extract SVC number from ISS, call appropriate
-            // handler. For now, just print and proceed. The ELR_EL1 in ctx
-            // points to the SVC instruction itself. To "return" past it,
-            // ELR_EL1 should be incremented by 4 before eret. ctx->elr_el1 +=
-            // 4; // Example: if SVC is handled and we want to resume
+            kprintf(" (SVC instruction)\n");
+            // Unknown SVC number: report it and resume after the svc
+            // (ELR_EL1 already points to the next instruction).
+            kprintf("Unknown SVC #%lu\n", esr_el1 & 0xFFFF);
             break;
         case 0b100100:  // Data Abort from lower Exception level (e.g., EL0
                         // trying to access restricted EL1 memory)
         case 0b100101:  // Data Abort from same Exception level (e.g., EL1 bad
                         // memory access)
-            uart_puts(" (Data Abort)\n");
+            kprintf(" (Data Abort)\n");
             // Read FAR_EL1 for faulting address
             uint64_t far_el1;
             __asm__ __volatile__("mrs %0, far_el1" : "=r"(far_el1));
-            uart_puts("FAR_EL1 (Fault Address Register): 0x");
-            print_hex(far_el1);
-            uart_puts("\n");
+            kprintf("FAR_EL1 (Fault Address Register): 0x%016lx\n", far_el1);
             break;
         case 0b100000:  // Instruction Abort from lower Exception level
         case 0b100001:  // Instruction Abort from same Exception level
-            uart_puts(" (Instruction Abort)\n");
+            kprintf(" (Instruction Abort)\n");
             uint64_t ifar_el1;  // Instruction Fault Address Register (alias for
                                 // FAR_EL1 for Ins Aborts)
             __asm__ __volatile__(
                 "mrs %0, far_el1"
                 : "=r"(ifar_el1));  // FAR_EL1 is used for Inst Aborts too
-            uart_puts("FAR_EL1 (Instruction Fault Address): 0x");
-            print_hex(ifar_el1);
-            uart_puts("\n");
+            kprintf("FAR_EL1 (Instruction Fault Address): 0x%016lx\n",
+                    ifar_el1);
             break;
         default:
-            uart_puts(" (Unhandled EC)\n");
+            kprintf(" (Unhandled EC)\n");
             break;
     }
 
-    uart_puts("------------------------------------\n");
+    kprintf("------------------------------------\n");
     // For critical unhandled synchronous exceptions, we might halt.
     // For now, we allow it to attempt to return via eret in vectors.s
     // If it was an SVC that the scheduler handled, eret will go to the new
@@ -78,15 +116,11 @@ void c_sync_handler(uint64_t esr_el1, context_state_t *ctx) {
 }
 
 void minimal_fiq_print(void) {
-    uart_puts("\n--- FIQ Exception Caught (Minimal Handler) ---\n");
-    // Loop forever or handle
-    while (1);
+    panic("\n--- FIQ Exception Caught (Minimal Handler) ---\n");
 }
 
 void minimal_serror_print(void) {
-    uart_puts("\n--- SError Exception Caught (Minimal Handler) ---\n");
-    // Loop forever or handle
-    while (1);
+    panic("\n--- SError Exception Caught (Minimal Handler) ---\n");
 }
 
 extern char
@@ -97,40 +131,52 @@ void exceptions_init(void) {
         (uint64_t)_exception_vector_table;  // Use the symbol directly
     __asm__ __volatile__("msr vbar_el1, %0" : : "r"(vector_table_addr));
 
-    uart_puts("Address of _exception_vector_table: 0x");
-    print_hex(vector_table_addr);
-    uart_puts("\n");
+    pr_debug("Address of _exception_vector_table: 0x%016lx\n",
+             vector_table_addr);
 
     uint64_t vbar_check;
     __asm__ __volatile__("mrs %0, vbar_el1" : "=r"(vbar_check));
-    uart_puts("VBAR_EL1 set to: 0x");
-    print_hex(vbar_check);
-    uart_puts("\n");
+    pr_debug("VBAR_EL1 set to: 0x%016lx\n", vbar_check);
 }
 
 // IRQ handler
 // ctx points to the saved context_state_t on the stack of the interrupted
-// execution. Returns the stack pointer (kernel_sp) of the next task to run.
-uint64_t c_irq_handler(context_state_t *ctx) {
-    uint64_t next_task_sp = (uint64_t)ctx;  // Default to current context SP
+// execution.
+void c_irq_handler(context_state_t *ctx) {
+    cpu_t *cpu = this_cpu();
 
-    uint32_t irq_id = gic_read_iar();
+    // For SGIs, IAR also carries the source CPU in bits [12:10]; the full
+    // value must be written back to EOIR.
+    uint32_t iar = gic_read_iar();
+    uint32_t irq_id = iar & 0x3FF;
+    TRACE_EVENT(TRACE_IRQ_ENTRY, irq_id, 0);
 
     if (irq_id == INTERRUPT_ID_CNTPNSIRQ) {
-        handle_timer_irq();  // This will re-arm the timer
-        // Timer interrupt is a good place to call the scheduler for preemption
-        next_task_sp = schedule((uint64_t)ctx);
+        // Runs expired hrtimers and re-arms the timer. The scheduler tick
+        // and task wakeups set need_resched when preemption is due.
+        handle_timer_irq();
+    } else if (irq_id == INTERRUPT_ID_IPI_RESCHEDULE) {
+        cpu->need_resched = 1;  // Another CPU queued work for us
+    } else if (irq_id == INTERRUPT_ID_UART0) {
+        uart_irq_handler();
+    } else if (irq_id >= INTERRUPT_ID_VIRTIO_MMIO &&
+               irq_id < INTERRUPT_ID_VIRTIO_MMIO + VIRTIO_MMIO_SLOTS) {
+        virtio_irq_handler(irq_id - INTERRUPT_ID_VIRTIO_MMIO);
     } else if (irq_id < 1020) {
-        uart_puts("Unhandled IRQ ID: ");
-        print_uint(irq_id);
-        uart_puts("\n");
+        pr_warn("Unhandled IRQ ID: %u\n", irq_id);
     } else {
-        uart_puts("Spurious or special IRQ ID: ");
-        print_uint(irq_id);
-        uart_puts("\n");
+        pr_warn("Spurious or special IRQ ID: %u\n", irq_id);
     }
 
-    gic_write_eoir(irq_id);
-    return next_task_sp;  // Return SP of the task to switch to (or current if
-                          // no switch)
+    if (irq_id < 1020) {
+        gic_write_eoir(iar);
+    }
+    TRACE_EVENT(TRACE_IRQ_EXIT, irq_id, 0);
+
+    if (cpu->need_resched) {
+        // Preemption: the interrupted task's full frame (ctx) stays on its
+        // stack. schedule() returns here once the task runs again, and the
+        // vector code then restores the frame and erets.
+        schedule();
+    }
 }
\ No newline at end of file
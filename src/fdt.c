@@ -0,0 +1,192 @@
+#include "fdt.h"
+
+#include <stddef.h>
+
+// Structure block tokens
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE 2
+#define FDT_PROP 3
+#define FDT_NOP 4
+#define FDT_END 9
+
+// Header fields, as 32-bit big-endian word offsets
+#define FDT_HDR_MAGIC 0
+#define FDT_HDR_TOTALSIZE 1
+#define FDT_HDR_OFF_STRUCT 2
+#define FDT_HDR_OFF_STRINGS 3
+#define FDT_HDR_VERSION 5
+
+// Reads are done a byte at a time: the blob may be parsed with the MMU off,
+// where unaligned (or merely wide) accesses to Device memory can fault.
+static uint32_t be32(const void *p) {
+    const uint8_t *b = p;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+           ((uint32_t)b[2] << 8) | b[3];
+}
+
+static uint32_t fdt_header(const void *fdt, int field) {
+    return be32((const uint8_t *)fdt + 4 * field);
+}
+
+static int str_eq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+// Does node name 'name' (e.g. "memory@40000000") have base name 'base'?
+static int node_is(const char *name, const char *base) {
+    while (*base && *name == *base) {
+        name++;
+        base++;
+    }
+    return *base == '\0' && (*name == '\0' || *name == '@');
+}
+
+static uint32_t align4(uint32_t off) { return (off + 3) & ~3U; }
+
+int fdt_valid(const void *fdt) {
+    if (!fdt || ((uint64_t)fdt & 7)) {
+        return 0;
+    }
+    return fdt_header(fdt, FDT_HDR_MAGIC) == FDT_MAGIC &&
+           fdt_header(fdt, FDT_HDR_VERSION) >= 16;
+}
+
+uint32_t fdt_total_size(const void *fdt) {
+    return fdt_header(fdt, FDT_HDR_TOTALSIZE);
+}
+
+// Read a 'cells'-cell big-endian number (1 or 2 cells).
+static uint64_t read_cells(const uint8_t *p, uint32_t cells) {
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < cells; ++i) {
+        value = (value << 32) | be32(p + 4 * i);
+    }
+    return value;
+}
+
+// Walk the structure block, calling 'prop' for every property with the
+// depth of its node (1 = root) and the node's name. A non-zero return from
+// 'prop' stops the walk and is returned; 0 means it ran to the end.
+typedef int (*fdt_prop_fn)(void *ctx, int depth, const char *node,
+                           const char *name, const uint8_t *value,
+                           uint32_t len);
+
+static int fdt_walk(const void *fdt, fdt_prop_fn prop, void *ctx) {
+    const uint8_t *blob = fdt;
+    const uint8_t *strings = blob + fdt_header(fdt, FDT_HDR_OFF_STRINGS);
+    uint32_t off = fdt_header(fdt, FDT_HDR_OFF_STRUCT);
+    uint32_t end = fdt_total_size(fdt);
+    const char *node = "";
+    int depth = 0;
+
+    while (off + 4 <= end) {
+        uint32_t token = be32(blob + off);
+        off += 4;
+
+        switch (token) {
+            case FDT_BEGIN_NODE: {
+                node = (const char *)blob + off;
+                uint32_t len = 0;
+                while (node[len]) {
+                    len++;
+                }
+                off = align4(off + len + 1);
+                depth++;
+                break;
+            }
+            case FDT_END_NODE:
+                depth--;
+                node = "";  // Back in the parent: only its children follow
+                break;
+            case FDT_PROP: {
+                uint32_t len = be32(blob + off);
+                const char *name = (const char *)strings + be32(blob + off + 4);
+                const uint8_t *value = blob + off + 8;
+                off = align4(off + 8 + len);
+                int ret = prop(ctx, depth, node, name, value, len);
+                if (ret) {
+                    return ret;
+                }
+                break;
+            }
+            case FDT_NOP:
+                break;
+            case FDT_END:
+            default:
+                return 0;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    // Defaults from the DT spec, overridden by the root node's properties.
+    uint32_t addr_cells;
+    uint32_t size_cells;
+    uint64_t base;
+    uint64_t size;
+} memory_ctx_t;
+
+static int memory_prop(void *ctx, int depth, const char *node,
+                       const char *name, const uint8_t *value, uint32_t len) {
+    memory_ctx_t *mem = ctx;
+    if (depth == 1 && str_eq(name, "#address-cells")) {
+        mem->addr_cells = be32(value);
+    } else if (depth == 1 && str_eq(name, "#size-cells")) {
+        mem->size_cells = be32(value);
+    } else if (depth == 2 && node_is(node, "memory") && str_eq(name, "reg") &&
+               len >= 4 * (mem->addr_cells + mem->size_cells) &&
+               mem->addr_cells <= 2 && mem->size_cells <= 2) {
+        mem->base = read_cells(value, mem->addr_cells);
+        mem->size = read_cells(value + 4 * mem->addr_cells, mem->size_cells);
+        return 1;
+    }
+    return 0;
+}
+
+int fdt_find_memory(const void *fdt, uint64_t *base, uint64_t *size) {
+    memory_ctx_t mem = {.addr_cells = 2, .size_cells = 1};
+    if (!fdt_walk(fdt, memory_prop, &mem)) {
+        return -1;
+    }
+    *base = mem.base;
+    *size = mem.size;
+    return 0;
+}
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint32_t found;  // Bit 0: start, bit 1: end
+} initrd_ctx_t;
+
+static int initrd_prop(void *ctx, int depth, const char *node,
+                       const char *name, const uint8_t *value, uint32_t len) {
+    initrd_ctx_t *initrd = ctx;
+    if (depth != 2 || !node_is(node, "chosen") || (len != 4 && len != 8)) {
+        return 0;
+    }
+    // Either one or two cells, whatever the root's #address-cells says.
+    if (str_eq(name, "linux,initrd-start")) {
+        initrd->start = read_cells(value, len / 4);
+        initrd->found |= 1;
+    } else if (str_eq(name, "linux,initrd-end")) {
+        initrd->end = read_cells(value, len / 4);
+        initrd->found |= 2;
+    }
+    return initrd->found == 3;
+}
+
+int fdt_find_initrd(const void *fdt, uint64_t *start, uint64_t *end) {
+    initrd_ctx_t initrd = {0};
+    if (!fdt_walk(fdt, initrd_prop, &initrd) || initrd.end <= initrd.start) {
+        return -1;
+    }
+    *start = initrd.start;
+    *end = initrd.end;
+    return 0;
+}
@@ -0,0 +1,48 @@
+// filepath: src/fp_tasks.c
+// Demo tasks that use FP/SIMD registers. This is the only file built without
+// -mgeneral-regs-only (see the Makefile); it exercises the lazy FP/SIMD
+// switch in fpsimd.c by keeping values live in vector registers while other
+// FP tasks run on the same CPU.
+
+#include "fp_tasks.h"
+
+#include "task.h"
+#include "uart.h"
+
+void fp_task(void *arg) {
+    uint64_t task_id = (uint64_t)arg;
+    uint64_t pattern = 0xF00D0000ULL | task_id;
+    double acc = 0.0;
+    uint32_t errors = 0;
+
+    uart_puts("FP task ");
+    print_uint(task_id);
+    uart_puts(" started.\n");
+
+    for (unsigned int i = 0; i < 8; ++i) {
+        // Leave a per-task pattern in d8 across a yield; another FP task
+        // overwrites it with its own in between.
+        uint64_t got;
+        __asm__ __volatile__("fmov d8, %0" ::"r"(pattern) : "d8");
+        task_yield();
+        __asm__ __volatile__("fmov %0, d8" : "=r"(got));
+        if (got != pattern) {
+            errors++;
+        }
+
+        acc += (double)task_id * 0.5;
+        task_sleep_ns(100000000ULL);  // 100 ms
+    }
+
+    // acc is 8 * id * 0.5 exactly in binary floating point.
+    if (acc != (double)(task_id * 4)) {
+        errors++;
+    }
+
+    uart_puts("FP task ");
+    print_uint(task_id);
+    uart_puts(errors ? " FAILED: FP/SIMD state corrupted " : " OK, errors: ");
+    print_uint(errors);
+    uart_puts("\n");
+    task_exit();
+}
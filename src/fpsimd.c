@@ -0,0 +1,96 @@
+#include "fpsimd.h"
+
+#include <stddef.h>
+
+#include "smp.h"
+#include "task.h"
+
+// CPACR_EL1.FPEN, bits [21:20]: 0b11 lets EL1 (and EL0) use FP/SIMD, 0b00
+// traps every FP/SIMD instruction with EC 0x07.
+#define CPACR_FPEN_MASK (3UL << 20)
+#define CPACR_FPEN_ENABLE (3UL << 20)
+
+_Static_assert(offsetof(fpsimd_state_t, fpsr) == 512,
+               "fpsimd.s expects FPSR at offset 512 of fpsimd_state_t");
+_Static_assert(offsetof(fpsimd_state_t, fpcr) == 516,
+               "fpsimd.s expects FPCR at offset 516 of fpsimd_state_t");
+
+static void fpsimd_set_access(cpu_t *cpu, uint32_t enable) {
+    uint64_t cpacr;
+    __asm__ __volatile__("mrs %0, cpacr_el1" : "=r"(cpacr));
+    cpacr &= ~CPACR_FPEN_MASK;
+    if (enable) {
+        cpacr |= CPACR_FPEN_ENABLE;
+    }
+    __asm__ __volatile__("msr cpacr_el1, %0; isb" ::"r"(cpacr) : "memory");
+    cpu->fpsimd_enabled = enable;
+}
+
+// Start the calling CPU with FP/SIMD trapped and no owner.
+void fpsimd_cpu_init(void) {
+    cpu_t *cpu = this_cpu();
+    cpu->fpsimd_owner = NULL;
+    fpsimd_set_access(cpu, 0);
+}
+
+// A new task starts with zeroed registers (FPCR = 0: round to nearest, no
+// traps) that are not live on any CPU.
+void fpsimd_task_init(tcb_t *task) {
+    for (int i = 0; i < 64; ++i) {
+        task->fpsimd.vregs[i] = 0;
+    }
+    task->fpsimd.fpsr = 0;
+    task->fpsimd.fpcr = 0;
+    task->fpsimd_cpu = -1;
+}
+
+// Does 'cpu' hold the only up-to-date copy of 'task''s FP/SIMD registers?
+// Such a task must not run anywhere else until they have been saved.
+int fpsimd_state_live_on(cpu_t *cpu, tcb_t *task) {
+    return __atomic_load_n(&task->fpsimd_cpu, __ATOMIC_ACQUIRE) ==
+           (int32_t)cpu->id;
+}
+
+// Called by schedule() with IRQs masked once 'next' has been picked. No
+// registers move here: access is simply left enabled if 'next' still owns
+// the register file, and trapped otherwise.
+void fpsimd_switch_to(cpu_t *cpu, tcb_t *next) {
+    uint32_t enable = (cpu->fpsimd_owner == next &&
+                       next->fpsimd_cpu == (int32_t)cpu->id);
+    if (enable != cpu->fpsimd_enabled) {
+        fpsimd_set_access(cpu, enable);
+    }
+}
+
+// 'task' is exiting on 'cpu': drop its claim on the register file so the
+// next owner does not save into a freed TCB.
+void fpsimd_task_exit(cpu_t *cpu, tcb_t *task) {
+    if (cpu->fpsimd_owner == task) {
+        cpu->fpsimd_owner = NULL;
+    }
+    task->fpsimd_cpu = -1;
+}
+
+// First FP/SIMD instruction of the running task since it was switched in.
+// Save the previous owner's registers, load the task's own and return to
+// re-execute the trapped instruction with access enabled.
+void fpsimd_trap(void) {
+    cpu_t *cpu = this_cpu();
+    tcb_t *task = cpu->curr_task;
+
+    fpsimd_set_access(cpu, 1);
+    if (!task || (cpu->fpsimd_owner == task &&
+                  task->fpsimd_cpu == (int32_t)cpu->id)) {
+        return;  // Registers are already the task's own
+    }
+
+    tcb_t *owner = cpu->fpsimd_owner;
+    if (owner) {
+        fpsimd_save_state(&owner->fpsimd);
+        // Publish the saved copy before steal_task() may move the owner.
+        __atomic_store_n(&owner->fpsimd_cpu, -1, __ATOMIC_RELEASE);
+    }
+    fpsimd_load_state(&task->fpsimd);
+    task->fpsimd_cpu = (int32_t)cpu->id;
+    cpu->fpsimd_owner = task;
+}
@@ -4,15 +4,36 @@
 #include <stdint.h>
 
 #include "common_macros.h"  // For TIMER_IRQ_ID if used directly, or GIC constants
+#include "kprintf.h"
 #include "mmio.h"
-#include "uart.h"  // For uart_puts, print_hex
 
 // Remove the local #defines for GIC registers, they are now in gic.h
 
+// Print how the distributor is set up for the timer PPI (IRQ 30): trigger
+// mode and CPU target. DEBUG=1 builds only.
+static void gic_dump_config(void) {
+    uintptr_t gicd_base = GICD_BASE;
+
+    // GICD_ICFGR1 covers IRQs 16-31. IRQ 30's two config bits are [29:28];
+    // for GICv2 PPIs bit [2m+1] is RAZ/WI and bit [2m] is RO, 0 = level.
+    uint32_t icfgr1_val = mmio_read(gicd_base + GICD_ICFGRn_OFFSET + 4);
+    uint32_t irq30_config_bits = (icfgr1_val >> 28) & 0x3;
+    pr_debug("GICD_ICFGR1 (IRQs 16-31 config): 0x%08x\n", icfgr1_val);
+    pr_debug("  IRQ 30 raw config bits [29:28] from ICFGR1: 0x%x (%s)\n",
+             irq30_config_bits,
+             (irq30_config_bits & 0x1) ? "Edge-triggered" : "Level-sensitive");
+
+    // GICD_ITARGETSR7 covers IRQs 28-31; IRQ 30 is byte 2, bits [23:16].
+    uint32_t itargetsr7_val =
+        mmio_read(gicd_base + GICD_ITARGETSRn_OFFSET + (7 * 4));
+    pr_debug("GICD_ITARGETSR7 (IRQs 28-31 target): 0x%08x\n", itargetsr7_val);
+    pr_debug("  IRQ 30 target byte from ITARGETSR7: 0x%x (Expected 0x01 for "
+             "CPU0)\n",
+             (itargetsr7_val >> 16) & 0xFF);
+}
+
 void gic_init(void) {
-    uart_puts("Initializing GIC...\n");
     uintptr_t gicd_base = GICD_BASE;
-    uintptr_t gicc_base = GICC_BASE;
     uint32_t num_irqs_to_configure;
 
     // Disable GIC Distributor before configuration
@@ -26,88 +47,80 @@ void gic_init(void) {
     if (num_irqs_to_configure > 1020) {  // Cap at GICv2 spec max
         num_irqs_to_configure = 1020;
     }
-    uart_puts("GICD_TYPER reports ");
-    print_uint(num_irqs_to_configure);
-    uart_puts(" IRQs\n");
 
     // Disable all interrupts, clear pending status
-    uart_puts(
-        "Disabling all IRQs via GICD_ICENABLERn...\n");  // <<< ADDED PRINT
     for (uint32_t i = 0; i < (num_irqs_to_configure / 32); ++i) {
         mmio_write(gicd_base + GICD_ICENABLERn_OFFSET + i * 4,
                    0xFFFFFFFF);  // Write to ICENABLER to disable
 
-        // Diagnostic: Verify by reading ISENABLER immediately after trying to
-        // clear it
-        uint32_t isenabler_val =
-            mmio_read(gicd_base + GICD_ISENABLERn_OFFSET + i * 4);
-        uart_puts("  GICD_ISENABLER");
-        print_uint(i);
-        uart_puts(" after disable op: 0x");
-        print_hex(isenabler_val);
-        uart_puts("\n");  // <<< ADDED PRINT
+        // Verify by reading ISENABLER back right after clearing it
+        pr_debug("  GICD_ISENABLER%u after disable op: 0x%08x\n", i,
+                 mmio_read(gicd_base + GICD_ISENABLERn_OFFSET + i * 4));
 
         mmio_write(gicd_base + GICD_ICPENDRn_OFFSET + i * 4,
                    0xFFFFFFFF);  // Clear pending
     }
 
     // Set a default priority (e.g., 0xA0) for all SPIs (Shared Peripheral
-    // Interrupts, ID 32-1019) And target all SPIs to CPU0 by default.
+    // Interrupts, ID 32-1019) and route them to the boot CPU by default.
+    // GICD_ITARGETSR0..7 are banked and read back the reading CPU's own
+    // target mask, so this works whichever core is booting.
+    uint32_t spi_targets = gic_cpu_mask() * 0x01010101U;
     for (uint32_t irq_id_base = 32; irq_id_base < num_irqs_to_configure;
          irq_id_base += 4) {
         mmio_write(gicd_base + GICD_IPRIORITYRn_OFFSET + (irq_id_base / 4) * 4,
                    0xA0A0A0A0);
         mmio_write(gicd_base + GICD_ITARGETSRn_OFFSET + (irq_id_base / 4) * 4,
-                   0x01010101);
+                   spi_targets);
     }
 
     // Enable GIC Distributor (Enable Group 1 Non-secure)
     mmio_write(gicd_base + GICD_CTLR, 0x01);  // Enable Group 1 non-secure
-    uart_puts("GIC Distributor initialized. GICD_CTLR: 0x1\n");
 
-    // Diagnostic: Read GICD_ICFGR1 for IRQ 30 configuration
-    // GICD_ICFGR1 is for IRQs 16-31. Offset is GICD_ICFGRn_OFFSET + 1*4
-    uint32_t icfgr1_val = mmio_read(gicd_base + GICD_ICFGRn_OFFSET + 4);
-    uart_puts("GICD_ICFGR1 (IRQs 16-31 config): 0x");
-    print_hex(icfgr1_val);
-    uart_puts("\n");
-    // IRQ 30 is (30 % 16) = 14th IRQ in this register. Config is 2 bits:
-    // [2*14+1 : 2*14] = [29:28]
-    uint32_t irq30_config_bits = (icfgr1_val >> 28) & 0x3;
-    uart_puts("  IRQ 30 raw config bits [29:28] from ICFGR1: 0x");
-    print_hex(irq30_config_bits);
-    // For GICv2 PPIs: bit [2m+1] is RAZ/WI. Bit [2m] is RO. 0=level, 1=edge.
-    // So we expect bit 29 to be 0, and bit 28 to be 0 for level-sensitive.
-    // Expected 0b00.
-    if ((irq30_config_bits & 0x1) == 0)
-        uart_puts(" (Level-sensitive)\n");
-    else
-        uart_puts(" (Edge-triggered)\n");
-
-    // Diagnostic: Read GICD_ITARGETSR7 for IRQ 30 target
-    // GICD_ITARGETSR7 is for IRQs 28-31. Offset is GICD_ITARGETSRn_OFFSET + (7
-    // * 4)
-    uint32_t itargetsr7_val =
-        mmio_read(gicd_base + GICD_ITARGETSRn_OFFSET + (7 * 4));
-    uart_puts("GICD_ITARGETSR7 (IRQs 28-31 target): 0x");
-    print_hex(itargetsr7_val);
-    uart_puts("\n");
-    // IRQ 30 is (30 % 4) = 2nd byte in this register (0-indexed). This is bits
-    // [23:16].
-    uint32_t irq30_target_byte = (itargetsr7_val >> 16) & 0xFF;
-    uart_puts("  IRQ 30 target byte from ITARGETSR7: 0x");
-    print_hex(irq30_target_byte);
-    uart_puts(" (Expected 0x01 for CPU0)\n");
+    if (klog_enabled(KLOG_DEBUG)) {
+        gic_dump_config();
+    }
+
+    gic_cpu_init();
+    pr_info("GIC: %u IRQs\n", num_irqs_to_configure);
+}
+
+uint8_t gic_cpu_mask(void) {
+    return (uint8_t)mmio_read(GICD_BASE + GICD_ITARGETSRn_OFFSET);
+}
+
+// Per-core GIC setup: the CPU interface and the banked SGI/PPI state.
+// Called by gic_init() on the boot CPU and by every secondary core.
+void gic_cpu_init(void) {
+    uintptr_t gicd_base = GICD_BASE;
+    uintptr_t gicc_base = GICC_BASE;
+
+    // Reschedule IPI. GICD_IPRIORITYR0-7 and GICD_ISENABLER0 are banked per
+    // CPU, so each core sets this up for itself.
+    uint32_t ipi = INTERRUPT_ID_IPI_RESCHEDULE;
+    uintptr_t prio_reg = gicd_base + GICD_IPRIORITYRn_OFFSET + (ipi / 4) * 4;
+    uint32_t prio_val = mmio_read(prio_reg);
+    prio_val &= ~(0xFFU << ((ipi % 4) * 8));
+    prio_val |= (0x80U << ((ipi % 4) * 8));
+    mmio_write(prio_reg, prio_val);
+    mmio_write(gicd_base + GICD_ISENABLERn_OFFSET, 1U << ipi);
 
     // Initialize GIC CPU Interface
     mmio_write(gicc_base + GICC_PMR, 0xF0);
     mmio_write(gicc_base + GICC_BPR, 0x00);
     mmio_write(gicc_base + GICC_CTLR, 0x01);
 
-    uart_puts(
+    pr_debug(
         "GIC CPU Interface initialized. GICC_CTLR: 0x1, GICC_PMR: 0xF0, "
         "GICC_BPR: 0x0\n");
-    uart_puts("GIC Initialized.\n");
+}
+
+// Send software-generated interrupt 'sgi_id' (0-15) to the CPUs in
+// 'cpu_target_mask'.
+void gic_send_sgi(uint32_t sgi_id, uint8_t cpu_target_mask) {
+    __asm__ __volatile__("dsb ishst" ::: "memory");  // Publish prior writes
+    mmio_write(GICD_BASE + GICD_SGIR,
+               ((uint32_t)cpu_target_mask << 16) | (sgi_id & 0xF));
 }
 
 void gic_enable_interrupt(uint32_t int_id, uint8_t core_target_mask,
@@ -154,33 +167,26 @@ void gic_enable_interrupt(uint32_t int_id, uint8_t core_target_mask,
 
     mmio_write(enable_reg_addr, enable_bit);
 
-    // Diagnostic: Read back the enable register immediately
-    uint32_t isenabler_val_after_write = mmio_read(enable_reg_addr);
-    uart_puts("  In gic_enable_interrupt for IRQ ");
-    print_uint(int_id);
-    uart_puts(": Wrote 0x");
-    print_hex(enable_bit);
-    uart_puts(" to GICD_ISENABLERn (addr 0x");
-    print_hex(enable_reg_addr);
-    uart_puts(")\n");
-    uart_puts("  Read back GICD_ISENABLERn: 0x");
-    print_hex(isenabler_val_after_write);
-    if (isenabler_val_after_write & enable_bit) {
-        uart_puts(" (Bit successfully set)\n");
-    } else {
-        uart_puts(" (BIT NOT SET - WRITE FAILED?)\n");
+    if (!klog_enabled(KLOG_DEBUG)) {
+        return;
     }
 
-    // Original print statement for enabling IRQ
-    uart_puts("Enabled IRQ: ");
-    print_uint(int_id);
-    uart_puts(" Priority: 0x");
-    print_hex(priority);
+    // Read back the enable register immediately
+    uint32_t isenabler_val_after_write = mmio_read(enable_reg_addr);
+    pr_debug("  In gic_enable_interrupt for IRQ %u: Wrote 0x%x to "
+             "GICD_ISENABLERn (addr 0x%x)\n",
+             int_id, enable_bit, enable_reg_addr);
+    pr_debug("  Read back GICD_ISENABLERn: 0x%08x (%s)\n",
+             isenabler_val_after_write,
+             (isenabler_val_after_write & enable_bit)
+                 ? "Bit successfully set"
+                 : "BIT NOT SET - WRITE FAILED?");
     if (int_id >= 32) {
-        uart_puts(" Target: 0x");
-        print_hex(core_target_mask);
+        pr_debug("Enabled IRQ: %u Priority: 0x%x Target: 0x%x\n", int_id,
+                 priority, core_target_mask);
+    } else {
+        pr_debug("Enabled IRQ: %u Priority: 0x%x\n", int_id, priority);
     }
-    uart_puts("\n");
 }
 
 uint32_t gic_read_iar(void) {
@@ -0,0 +1,190 @@
+#include "hrtimer.h"
+
+#include <stddef.h>
+
+#include "page_alloc.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "trace.h"
+#include "uart.h"
+
+// Heap helpers. Caller holds cpu->timer_lock.
+
+static void heap_set(cpu_t *cpu, uint32_t idx, hrtimer_t *timer) {
+    cpu->timer_heap[idx] = timer;
+    timer->heap_index = (int32_t)idx;
+}
+
+static void heap_sift_up(cpu_t *cpu, uint32_t idx) {
+    hrtimer_t *timer = cpu->timer_heap[idx];
+    while (idx > 0) {
+        uint32_t parent = (idx - 1) / 2;
+        if (cpu->timer_heap[parent]->expires <= timer->expires) {
+            break;
+        }
+        heap_set(cpu, idx, cpu->timer_heap[parent]);
+        idx = parent;
+    }
+    heap_set(cpu, idx, timer);
+}
+
+static void heap_sift_down(cpu_t *cpu, uint32_t idx) {
+    hrtimer_t *timer = cpu->timer_heap[idx];
+    uint32_t count = cpu->timer_count;
+    while (1) {
+        uint32_t child = 2 * idx + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && cpu->timer_heap[child + 1]->expires <
+                                     cpu->timer_heap[child]->expires) {
+            child++;
+        }
+        if (timer->expires <= cpu->timer_heap[child]->expires) {
+            break;
+        }
+        heap_set(cpu, idx, cpu->timer_heap[child]);
+        idx = child;
+    }
+    heap_set(cpu, idx, timer);
+}
+
+static void heap_remove(cpu_t *cpu, hrtimer_t *timer) {
+    uint32_t idx = (uint32_t)timer->heap_index;
+    uint32_t last = --cpu->timer_count;
+    timer->heap_index = -1;
+    if (idx == last) {
+        return;
+    }
+    heap_set(cpu, idx, cpu->timer_heap[last]);
+    if (idx > 0 &&
+        cpu->timer_heap[idx]->expires < cpu->timer_heap[(idx - 1) / 2]->expires) {
+        heap_sift_up(cpu, idx);
+    } else {
+        heap_sift_down(cpu, idx);
+    }
+}
+
+// Make room for at least one more timer by doubling the heap array (or
+// allocating the first one). Caller holds cpu->timer_lock. Returns 0, or -1
+// when out of memory.
+static int heap_grow(cpu_t *cpu) {
+    uint32_t capacity =
+        cpu->timer_capacity ? cpu->timer_capacity * 2 : HRTIMER_HEAP_INITIAL;
+    uint32_t order = page_order_for(capacity * sizeof(hrtimer_t *));
+    hrtimer_t **heap = page_alloc(order);
+    if (!heap) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < cpu->timer_count; ++i) {
+        heap[i] = cpu->timer_heap[i];
+    }
+    if (cpu->timer_heap) {
+        page_free(cpu->timer_heap,
+                  page_order_for(cpu->timer_capacity * sizeof(hrtimer_t *)));
+    }
+    cpu->timer_heap = heap;
+    // Use all of the block, not just what was asked for.
+    cpu->timer_capacity = (uint32_t)((PAGE_SIZE << order) / sizeof(hrtimer_t *));
+    return 0;
+}
+
+// Point CNTP_CVAL_EL0 at the earliest pending timer, or switch the timer off
+// when nothing is pending. Caller holds cpu->timer_lock on 'cpu' == this CPU.
+static void hrtimer_program(cpu_t *cpu) {
+    if (cpu->timer_count == 0) {
+        write_cntp_ctl_el0(0);
+        return;
+    }
+    timer_set_deadline(cpu->timer_heap[0]->expires);
+}
+
+void hrtimer_init(hrtimer_t *timer, void (*callback)(hrtimer_t *timer),
+                  void *data) {
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+    timer->heap_index = -1;
+    timer->cpu = 0;
+}
+
+int hrtimer_start(hrtimer_t *timer, uint64_t expires) {
+    hrtimer_cancel(timer);
+
+    uint64_t flags = local_irq_save();
+    cpu_t *cpu = this_cpu();
+    spin_lock(&cpu->timer_lock);
+
+    if (cpu->timer_count >= cpu->timer_capacity && heap_grow(cpu) < 0) {
+        spin_unlock(&cpu->timer_lock);
+        local_irq_restore(flags);
+        uart_puts("Error: hrtimer heap full!\n");
+        return -1;
+    }
+
+    timer->expires = expires;
+    timer->cpu = cpu->id;
+    uint32_t idx = cpu->timer_count++;
+    heap_set(cpu, idx, timer);
+    heap_sift_up(cpu, idx);
+
+    if (timer->heap_index == 0) {
+        hrtimer_program(cpu);  // New earliest deadline
+    }
+
+    spin_unlock(&cpu->timer_lock);
+    local_irq_restore(flags);
+    return 0;
+}
+
+int hrtimer_start_ns(hrtimer_t *timer, uint64_t delay_ns) {
+    return hrtimer_start(timer,
+                         timer_read_counter() + timer_ns_to_ticks(delay_ns));
+}
+
+int hrtimer_cancel(hrtimer_t *timer) {
+    if (timer->heap_index < 0) {
+        return 0;
+    }
+
+    uint64_t flags = local_irq_save();
+    cpu_t *cpu = &cpus[timer->cpu];
+    spin_lock(&cpu->timer_lock);
+
+    int was_pending = 0;
+    if (timer->heap_index >= 0) {  // Re-check under the lock
+        int was_first = (timer->heap_index == 0);
+        heap_remove(cpu, timer);
+        // Only the owning CPU can program its own timer registers; a remote
+        // cancel of the earliest timer just costs that CPU a spurious IRQ.
+        if (was_first && cpu == this_cpu()) {
+            hrtimer_program(cpu);
+        }
+        was_pending = 1;
+    }
+
+    spin_unlock(&cpu->timer_lock);
+    local_irq_restore(flags);
+    return was_pending;
+}
+
+void hrtimer_interrupt(void) {
+    cpu_t *cpu = this_cpu();
+
+    spin_lock(&cpu->timer_lock);
+    uint64_t now = timer_read_counter();
+    while (cpu->timer_count && cpu->timer_heap[0]->expires <= now) {
+        hrtimer_t *timer = cpu->timer_heap[0];
+        heap_remove(cpu, timer);
+
+        spin_unlock(&cpu->timer_lock);
+        TRACE_EVENT(TRACE_TIMER_EXPIRE, 0, (uint64_t)timer->callback);
+        timer->callback(timer);
+        spin_lock(&cpu->timer_lock);
+
+        now = timer_read_counter();
+    }
+    hrtimer_program(cpu);
+    spin_unlock(&cpu->timer_lock);
+}
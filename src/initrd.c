@@ -0,0 +1,257 @@
+#include "initrd.h"
+
+#include <stddef.h>
+
+#include "kmalloc.h"
+#include "kprintf.h"
+
+// cpio newc: a 110-byte ASCII header ("070701" and thirteen 8-digit hex
+// fields), the NUL-terminated name, then the data, with the name and data
+// each padded to a multiple of 4 from the start of the header. The
+// archive ends with an entry named TRAILER!!!.
+#define CPIO_HDR_SIZE 110
+#define CPIO_FIELD_MODE 1
+#define CPIO_FIELD_FILESIZE 6
+#define CPIO_FIELD_NAMESIZE 11
+
+#define S_IFMT 0170000
+#define S_IFREG 0100000
+
+typedef struct {
+    uint32_t hash;  // Of the path, to skip most string compares
+    uint32_t file;  // Index in initrd_files plus one, 0 when empty
+} initrd_slot_t;
+
+static initrd_file_t *initrd_files;
+static uint32_t initrd_nr_files;
+static initrd_slot_t *initrd_table;
+static uint32_t initrd_table_mask;
+
+static uint32_t fnv1a(const char *s) {
+    uint32_t hash = 2166136261U;
+    while (*s) {
+        hash ^= (uint8_t)*s++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static uint64_t align4(uint64_t off) { return (off + 3) & ~3UL; }
+
+// Field 'idx' of the header at 'hdr' (after the 6-byte magic). Returns -1
+// if it is not 8 hex digits.
+static int64_t cpio_field(const uint8_t *hdr, uint32_t idx) {
+    const uint8_t *p = hdr + 6 + 8 * idx;
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < 8; ++i) {
+        uint8_t c = p[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return -1;
+        }
+        value = (value << 4) | digit;
+    }
+    return (int64_t)value;
+}
+
+static int str_eq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+// Walk the archive, storing each regular file in 'files' and the length
+// of the archive in 'archive_size', either of which may be NULL. Returns
+// the number of regular files, or -(count + 1) if the walk stopped at a
+// damaged entry after 'count' files. Only byte reads, for initrd_probe().
+static int64_t cpio_scan(const uint8_t *start, const uint8_t *end,
+                         initrd_file_t *files, uint64_t *archive_size) {
+    uint64_t limit = (uint64_t)(end - start);
+    uint64_t off = 0;
+    int64_t count = 0;
+
+    while (off + CPIO_HDR_SIZE <= limit) {
+        const uint8_t *hdr = start + off;
+        if (hdr[0] != '0' || hdr[1] != '7' || hdr[2] != '0' || hdr[3] != '7' ||
+            hdr[4] != '0' || (hdr[5] != '1' && hdr[5] != '2')) {
+            return -(count + 1);
+        }
+        int64_t mode = cpio_field(hdr, CPIO_FIELD_MODE);
+        int64_t size = cpio_field(hdr, CPIO_FIELD_FILESIZE);
+        int64_t namesize = cpio_field(hdr, CPIO_FIELD_NAMESIZE);
+        if (mode < 0 || size < 0 || namesize <= 0) {
+            return -(count + 1);
+        }
+
+        uint64_t name_off = off + CPIO_HDR_SIZE;
+        uint64_t data_off = align4(name_off + (uint64_t)namesize);
+        uint64_t next = align4(data_off + (uint64_t)size);
+        const char *name = (const char *)start + name_off;
+        if (data_off > limit || data_off + (uint64_t)size > limit ||
+            name[namesize - 1] != '\0') {
+            return -(count + 1);
+        }
+        if (str_eq(name, "TRAILER!!!")) {
+            if (archive_size) {
+                *archive_size = next < limit ? next : limit;
+            }
+            return count;
+        }
+
+        if (((uint32_t)mode & S_IFMT) == S_IFREG) {
+            while (*name == '.' && name[1] == '/') {
+                name += 2;
+            }
+            while (*name == '/') {
+                name++;
+            }
+            if (files) {
+                files[count].path = name;
+                files[count].data = start + data_off;
+                files[count].size = (uint64_t)size;
+                files[count].mode = (uint32_t)mode;
+            }
+            count++;
+        }
+        off = next;
+    }
+    return -(count + 1);  // No trailer
+}
+
+// Add file 'idx'; a later entry for the same path replaces the earlier
+// one, as extracting the archive would. Returns 1 for a new path.
+static int index_insert(uint32_t idx) {
+    const char *path = initrd_files[idx].path;
+    uint32_t hash = fnv1a(path);
+    uint32_t slot = hash & initrd_table_mask;
+    while (initrd_table[slot].file) {
+        initrd_slot_t *s = &initrd_table[slot];
+        if (s->hash == hash && str_eq(initrd_files[s->file - 1].path, path)) {
+            s->file = idx + 1;
+            return 0;
+        }
+        slot = (slot + 1) & initrd_table_mask;
+    }
+    initrd_table[slot].hash = hash;
+    initrd_table[slot].file = idx + 1;
+    return 1;
+}
+
+uint64_t initrd_probe(uint64_t start, uint64_t limit) {
+    uint64_t size = 0;
+    if (limit <= start ||
+        cpio_scan((const uint8_t *)start, (const uint8_t *)limit, NULL,
+                  &size) < 0) {
+        return 0;
+    }
+    return size;
+}
+
+int64_t initrd_init(uint64_t start, uint64_t end) {
+    const uint8_t *base = (const uint8_t *)start;
+    const uint8_t *limit = (const uint8_t *)end;
+
+    int64_t scanned = cpio_scan(base, limit, NULL, NULL);
+    int damaged = scanned < 0;
+    uint64_t count = damaged ? (uint64_t)(-scanned - 1) : (uint64_t)scanned;
+    if (count == 0) {
+        return damaged ? -1 : 0;
+    }
+
+    // At most half full, so probe sequences stay short.
+    uint32_t table_size = 1;
+    while (table_size < 2 * count) {
+        table_size <<= 1;
+    }
+    initrd_files = kmalloc(count * sizeof(initrd_file_t));
+    initrd_table = kzalloc(table_size * sizeof(initrd_slot_t));
+    if (!initrd_files || !initrd_table) {
+        pr_err("initrd: no memory for the index of %lu files\n", count);
+        kfree(initrd_files);
+        kfree(initrd_table);
+        initrd_files = NULL;
+        initrd_table = NULL;
+        return -1;
+    }
+    initrd_table_mask = table_size - 1;
+
+    cpio_scan(base, limit, initrd_files, NULL);
+    int64_t unique = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        unique += index_insert(i);
+    }
+    initrd_nr_files = (uint32_t)count;
+
+    if (damaged) {
+        pr_warn("initrd: archive damaged after %ld files\n", unique);
+        return -1;
+    }
+    return unique;
+}
+
+const initrd_file_t *initrd_lookup(const char *path) {
+    if (!initrd_table) {
+        return NULL;
+    }
+    while (*path == '/') {
+        path++;
+    }
+    uint32_t hash = fnv1a(path);
+    uint32_t slot = hash & initrd_table_mask;
+    while (initrd_table[slot].file) {
+        initrd_slot_t *s = &initrd_table[slot];
+        const initrd_file_t *file = &initrd_files[s->file - 1];
+        if (s->hash == hash && str_eq(file->path, path)) {
+            return file;
+        }
+        slot = (slot + 1) & initrd_table_mask;
+    }
+    return NULL;
+}
+
+int initrd_open(const char *path, initrd_fd_t *fd) {
+    const initrd_file_t *file = initrd_lookup(path);
+    if (!file) {
+        return -1;
+    }
+    fd->file = file;
+    fd->pos = 0;
+    return 0;
+}
+
+uint64_t initrd_read(initrd_fd_t *fd, const void **data, uint64_t len) {
+    uint64_t left = fd->file->size - fd->pos;
+    if (len > left) {
+        len = left;
+    }
+    *data = fd->file->data + fd->pos;
+    fd->pos += len;
+    return len;
+}
+
+const void *initrd_map(const char *path, uint64_t *size) {
+    const initrd_file_t *file = initrd_lookup(path);
+    if (!file) {
+        return NULL;
+    }
+    *size = file->size;
+    return file->data;
+}
+
+void initrd_for_each(void (*fn)(const initrd_file_t *file, void *arg),
+                     void *arg) {
+    for (uint32_t i = 0; i < initrd_nr_files; ++i) {
+        // Skip entries a later one for the same path replaced.
+        if (initrd_lookup(initrd_files[i].path) == &initrd_files[i]) {
+            fn(&initrd_files[i], arg);
+        }
+    }
+}
@@ -1,10 +1,134 @@
 #include "kernel.h"  // For print_uint, print_hex if used directly here
 
+#include "bench.h"
+#include "boottime.h"
 #include "exceptions.h"
+#include "fp_tasks.h"
+#include "fpsimd.h"
+#include "fdt.h"
 #include "gic.h"
+#include "initrd.h"
+#include "kmalloc.h"
+#include "kprintf.h"
+#include "kstack.h"
+#include "mmu.h"
+#include "page_alloc.h"
+#include "smp.h"
+#include "string.h"
 #include "task.h"  // <<< Ensure this is included for task_exit()
 #include "timer.h"
+#include "trace.h"
 #include "uart.h"
+#include "virtio_blk.h"
+
+extern char __end__[];         // End of the kernel image, from linker.ld
+extern uint64_t boot_dtb_addr;  // x0 at entry, saved by boot.s
+
+// Where the initrd was loaded (both 0 without one), set by memory_init().
+static uint64_t initrd_start;
+static uint64_t initrd_end;
+
+// Give [start, end) to the page allocator, less the 'nr' ranges in
+// 'reserved' (sorted by address, not overlapping).
+static void free_ram_except(uint64_t start, uint64_t end,
+                            const uint64_t reserved[][2], uint32_t nr) {
+    for (uint32_t i = 0; i < nr; ++i) {
+        if (reserved[i][1] <= reserved[i][0]) {
+            continue;
+        }
+        if (reserved[i][0] > start) {
+            page_free_range(start, reserved[i][0] & ~(PAGE_SIZE - 1));
+        }
+        if (reserved[i][1] > start) {
+            start = reserved[i][1];
+        }
+    }
+    if (start < end) {
+        page_free_range(start, end);
+    }
+}
+
+// Find out how much RAM there is (device tree, or RAM_SIZE_DEFAULT), hand
+// everything after the kernel image except the DTB and the initrd to the
+// page allocator, and turn on the MMU.
+static void memory_init(void) {
+    uint64_t ram_base = RAM_BASE;
+    uint64_t ram_size = RAM_SIZE_DEFAULT;
+    // A loader that boots us like Linux passes the DTB in x0; QEMU does not
+    // for an ELF, so 'make run' puts one at DTB_LOAD_ADDR instead. RAM
+    // there is zero without it, which fdt_valid() rejects.
+    const void *fdt = (const void *)boot_dtb_addr;
+    if (!fdt_valid(fdt)) {
+        fdt = (const void *)DTB_LOAD_ADDR;
+    }
+    uint64_t dtb_start = 0;
+    uint64_t dtb_end = 0;
+
+    if (fdt_valid(fdt) && fdt_find_memory(fdt, &ram_base, &ram_size) == 0) {
+        dtb_start = (uint64_t)fdt;
+        dtb_end = dtb_start + fdt_total_size(fdt);
+        if (fdt_find_initrd(fdt, &initrd_start, &initrd_end) < 0) {
+            initrd_start = initrd_end = 0;
+        }
+        uart_puts("Memory: from device tree at 0x");
+        print_hex(dtb_start);
+    } else {
+        ram_base = RAM_BASE;
+        ram_size = RAM_SIZE_DEFAULT;
+        uart_puts("Memory: no device tree, using the default");
+    }
+    uart_puts(", RAM 0x");
+    print_hex(ram_base);
+    uart_puts(" + ");
+    print_uint(ram_size >> 20);
+    uart_puts(" MiB\n");
+
+    uint64_t ram_end = ram_base + ram_size;
+    if (ram_end > KSTACK_VA_BASE) {
+        uart_puts("Memory: ignoring RAM above the task stack window\n");
+        ram_end = KSTACK_VA_BASE;
+    }
+    if (initrd_end <= initrd_start && INITRD_LOAD_ADDR < ram_end) {
+        // Not in /chosen: see if 'make run' loaded one. It can reach up to
+        // the DTB, which sits above it.
+        uint64_t limit = DTB_LOAD_ADDR < ram_end ? DTB_LOAD_ADDR : ram_end;
+        uint64_t size = initrd_probe(INITRD_LOAD_ADDR, limit);
+        if (size) {
+            initrd_start = INITRD_LOAD_ADDR;
+            initrd_end = INITRD_LOAD_ADDR + size;
+        }
+    }
+    // page_alloc_init() writes its page_t map from __end__ on, over
+    // whatever was loaded there. The DTB has been read by now and is not
+    // needed again, but the initrd would be lost.
+    uint64_t map_end = page_alloc_map_end((uint64_t)__end__, ram_end);
+    if (dtb_start < map_end || dtb_end > ram_end) {
+        dtb_start = dtb_end = 0;  // Nothing to keep
+    }
+    if (initrd_end > initrd_start &&
+        (initrd_start < map_end || initrd_end > ram_end)) {
+        uart_puts("Memory: initrd overlaps the kernel or its page map, "
+                  "ignoring it\n");
+        initrd_start = initrd_end = 0;
+    }
+    page_alloc_init((uint64_t)__end__, ram_end);
+    // Keep them out of the allocator in address order.
+    uint64_t reserved[2][2] = {{dtb_start, dtb_end},
+                               {initrd_start, initrd_end}};
+    if (initrd_start < dtb_start) {
+        reserved[0][0] = initrd_start;
+        reserved[0][1] = initrd_end;
+        reserved[1][0] = dtb_start;
+        reserved[1][1] = dtb_end;
+    }
+    free_ram_except(map_end, ram_end, reserved, 2);
+    if (klog_enabled(KLOG_DEBUG)) {
+        page_alloc_dump_stats();
+    }
+
+    mmu_init(ram_base, ram_end);  // Everything from here on runs with caches on
+    string_init();                // DC ZVA needs Normal memory
+}
 
 // Simple task function 1
 void simple_task_1(void *arg) {
@@ -19,8 +143,7 @@ void simple_task_1(void *arg) {
         uart_puts(" says: Hello! Count: ");
         print_uint(i);
         uart_puts("\n");
-        // Simple delay loop
-        for (volatile int k = 0; k < 2000000; ++k);  // Adjust delay as needed
+        task_sleep_ns(500000000ULL);  // 500 ms, off the run queue
     }
     uart_puts("Task ");
     print_uint(task_id);
@@ -46,8 +169,7 @@ void simple_task_2(void *arg) {
         uart_puts(" says: World! Count: ");
         print_uint(i);
         uart_puts("\n");
-        // Simple delay loop
-        for (volatile int k = 0; k < 1500000; ++k);  // Adjust delay as needed
+        task_sleep_ns(300000000ULL);  // 300 ms, off the run queue
     }
     uart_puts("Task ");
     print_uint(task_id);
@@ -60,15 +182,134 @@ void simple_task_2(void *arg) {
     while (1);
 }
 
+// Backing pages for the address-space demo, one per task.
+static uint8_t as_demo_pages[2][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+// Runs in its own address space with a private page at MMU_TASK_VA_BASE.
+// Both demo tasks use the same address, and must keep seeing their own
+// value across switches.
+void as_task(void *arg) {
+    uint64_t id = (uint64_t)arg;
+    volatile uint64_t *word = (volatile uint64_t *)MMU_TASK_VA_BASE;
+    *word = id;
+    for (int i = 0; i < 5; ++i) {
+        task_yield();
+        if (*word != id) {
+            uart_puts("AS task ");
+            print_uint(id);
+            uart_puts(": ERROR, private page changed under us!\n");
+            task_exit();
+        }
+    }
+    uart_puts("AS task ");
+    print_uint(id);
+    uart_puts(": private mapping intact.\n");
+    task_exit();
+}
+
+// Uses about 'depth' KiB of stack.
+static uint64_t stack_recurse(uint32_t depth) {
+    volatile uint8_t frame[1024];
+    frame[0] = (uint8_t)depth;
+    if (depth <= 1) {
+        return frame[0];
+    }
+    return stack_recurse(depth - 1) + frame[0];
+}
+
+static void print_stack_mapped(const char *label) {
+    kstack_t *stack = &task_current()->stack;
+    uart_puts(label);
+    print_uint((kstack_top(stack) - stack->mapped) / 1024);
+    uart_puts(" KiB of ");
+    print_uint(stack->size / 1024);
+    uart_puts(" KiB stack mapped\n");
+}
+
+// Demand-grown stacks: memory follows the real depth. With arg != 0 the
+// recursion is deeper than the reservation and the task is killed.
+void stack_task(void *arg) {
+    print_stack_mapped("Stack task: before recursion, ");
+    stack_recurse(arg ? 64 : 24);
+    print_stack_mapped("Stack task: after recursion, ");
+    task_exit();
+}
+
+static int str_eq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void console_ls(const initrd_file_t *file, void *arg) {
+    (void)arg;
+    uart_puts("  ");
+    uart_puts(file->path);
+    uart_puts(" (");
+    print_uint(file->size);
+    uart_puts(" bytes)\n");
+}
+
+// Interactive console alongside the compute tasks. uart_read() sleeps
+// until a whole line has been typed, so waiting for input costs nothing.
+void console_task(void *arg) {
+    (void)arg;
+    char line[UART_RX_LINE_MAX];
+    while (1) {
+        uart_puts("> ");
+        int64_t n = uart_read(line, sizeof(line) - 1);
+        if (n <= 0) {
+            continue;
+        }
+        if (line[n - 1] == '\n') {
+            n--;
+        }
+        line[n] = '\0';
+
+        if (n == 0) {
+            continue;
+        } else if (str_eq(line, "help")) {
+            uart_puts("Commands: help, uptime, mem, ls\n");
+        } else if (str_eq(line, "uptime")) {
+            print_uint(timer_ticks_to_ns(timer_read_counter()) / 1000000);
+            uart_puts(" ms\n");
+        } else if (str_eq(line, "mem")) {
+            page_alloc_dump_stats();
+            kmalloc_dump_stats();
+        } else if (str_eq(line, "ls")) {
+            initrd_for_each(console_ls, NULL);
+        } else {
+            uart_puts("Unknown command: ");
+            uart_puts(line);
+            uart_puts("\n");
+        }
+    }
+}
+
+#ifdef CONFIG_TRACE
+// Dump the trace rings once the demo tasks have had time to run. Capture
+// the console (e.g. make run > uart.log) and feed it to
+// tools/trace2perfetto.py.
+void trace_dump_task(void *arg) {
+    (void)arg;
+    task_sleep_ns(2000000000ULL);  // 2 s
+    trace_dump();
+    task_exit();
+}
+#endif
+
 // Idle task function
 void idle_task_function(void *arg) {
     // Argument is not used for the idle task, but signature matches task_create
     (void)arg;
 
-    uart_puts("Idle task started.\n");
+    pr_info("Idle task started.\n");
     while (1) {
-        // uart_puts("Idle task WFI...\n"); // Optional: for debugging, can be
-        // very noisy
+        // Nothing else to do: let the flusher write out what the CPUs have
+        // logged.
+        klog_kick();
         __asm__ __volatile__("wfi");
         // When an interrupt occurs and is handled, execution will resume here
         // after the interrupt handler and scheduler (if a context switch
@@ -78,93 +319,132 @@ void idle_task_function(void *arg) {
     }
 }
 
+// The demo and console tasks.
+static void start_demo_tasks(void) {
+    if (task_create(simple_task_1, (void *)1, "Task1", TASK_PRIO_DEFAULT,
+                    0) < 0) {
+        uart_puts("Failed to create task 1\n");
+    }
+    if (task_create(simple_task_2, (void *)2, "Task2", TASK_PRIO_DEFAULT,
+                    0) < 0) {
+        uart_puts("Failed to create task 2\n");
+    }
+
+    // Two FP/SIMD users sharing a register file exercise the lazy switch.
+    for (uint64_t i = 3; i <= 4; ++i) {
+        if (task_create(fp_task, (void *)i, "FPTask", TASK_PRIO_DEFAULT,
+                        0) < 0) {
+            uart_puts("Failed to create FP task\n");
+        }
+    }
+
+    // Same VA, different pages: isolation without TLB flushes.
+    for (uint64_t i = 0; i < 2; ++i) {
+        addr_space_t *as = mmu_as_create();
+        if (!as || mmu_as_map(as, MMU_TASK_VA_BASE,
+                              (uint64_t)as_demo_pages[i], PAGE_SIZE,
+                              MMU_PROT_KERNEL_RW) < 0 ||
+            task_create_in(as, as_task, (void *)(5 + i), "ASTask",
+                           TASK_PRIO_DEFAULT, 0) < 0) {
+            uart_puts("Failed to create address-space task\n");
+        }
+        if (as) {
+            mmu_as_put(as);  // The task holds its own reference
+        }
+    }
+
+    // One stack grows to fit, the other overflows its 32 KiB and is killed.
+    task_create(stack_task, NULL, "StackTask", TASK_PRIO_DEFAULT, 0);
+    task_create(stack_task, (void *)1, "StackOverflow", TASK_PRIO_DEFAULT,
+                32 * 1024);
+
+    task_create(console_task, NULL, "Console", TASK_PRIO_DEFAULT, 0);
+
+#ifdef CONFIG_TRACE
+    task_create(trace_dump_task, NULL, "TraceDump", TASK_PRIO_HIGHEST, 0);
+#endif
+}
+
+#ifdef CONFIG_BENCH
+// The benchmarks that need blocking and wakeups, one after another and
+// before the demo tasks start, so each has the CPUs to itself.
+static void bench_task(void *arg) {
+    (void)arg;
+    bench_virtio_blk();
+    bench_ipc();
+    bench_sync();
+    start_demo_tasks();
+    task_exit();
+}
+#endif
+
 void kernel_main(void) {
+    smp_init_boot_cpu();  // this_cpu() is valid from here on
+    trace_init();
     uart_init();
     uart_puts("\n-----------------------------------\n");
     uart_puts("picOS Kernel (AArch64) Booting...\n");
     uart_puts("-----------------------------------\n");
 
+    boot_phase("early");
+
+    memory_init();
+    kmalloc_init();
+    boot_phase("memory");
+    if (initrd_end > initrd_start) {
+        // Only the index is built; file data stays where it was loaded.
+        int64_t files = initrd_init(initrd_start, initrd_end);
+        if (files >= 0) {
+            pr_info("initrd: %ld files in %lu KiB at 0x%lx\n", files,
+                    (initrd_end - initrd_start) >> 10, initrd_start);
+        }
+        boot_phase("initrd");
+    }
     exceptions_init();
+    fpsimd_cpu_init();
     gic_init();
+    uart_irq_init();  // Console output is buffered from here on
     timer_init_periodic(1000000);  // 1 second timer (1MHz clock, 1M ticks)
+    boot_phase("irq");
+    virtio_blk_init();
+    boot_phase("devices");
     task_init_system();
+#ifdef CONFIG_BENCH
+    bench_kmalloc();
+    bench_tlb();
+    bench_string();
+    boot_phase("bench");
+#endif
 
-    uart_puts("Creating idle task...\n");
-    int idle_pid = task_create(idle_task_function, NULL, "IdleTask");
-    if (idle_pid < 0) {
-        uart_puts("FATAL: Failed to create idle task!\n");
-        // Potentially halt or panic here
-        while (1);
-    } else {
-        // Find the TCB for the idle task and store it.
-        // task_create adds to ready_queue, we need to remove it and store it
-        // separately. This is a bit clunky; task_create could be modified not
-        // to auto-add to ready_queue or take a flag. For now, we find it and
-        // remove it.
-
-        // Find the idle task's TCB (it was just created and added to ready
-        // queue) And remove it from the ready queue.
-        tcb_t *temp_idle_tcb = NULL;
-        if (ready_queue_head && ready_queue_head->pid == (uint32_t)idle_pid) {
-            temp_idle_tcb = ready_queue_head;
-            ready_queue_head = ready_queue_head->next_in_queue;
-        } else if (ready_queue_head) {
-            tcb_t *current = ready_queue_head;
-            while (current->next_in_queue) {
-                if (current->next_in_queue->pid == (uint32_t)idle_pid) {
-                    temp_idle_tcb = current->next_in_queue;
-                    current->next_in_queue =
-                        temp_idle_tcb->next_in_queue;  // Unlink
-                    break;
-                }
-                current = current->next_in_queue;
-            }
-        }
-
-        if (temp_idle_tcb) {
-            idle_task_tcb = temp_idle_tcb;        // Store the global pointer
-            idle_task_tcb->next_in_queue = NULL;  // Ensure it's isolated
-            idle_task_tcb->state =
-                TASK_READY;  // It's ready, just not in the main queue
-            uart_puts("Idle task created with PID: ");
-            print_uint(idle_pid);
-            uart_puts(" and set aside.\n");
-        } else {
-            uart_puts("FATAL: Could not find and set aside idle task TCB!\n");
-            while (1);
-        }
+    // Idle tasks are kept aside from the run queues and only run when
+    // nothing else is ready on their CPU.
+    tcb_t *idle = task_create_idle(idle_task_function, this_cpu()->id);
+    if (!idle) {
+        panic("FATAL: Failed to create idle task!\n");
     }
 
-    uart_puts("Creating tasks...\n");
-    int pid1 = task_create(simple_task_1, (void *)1, "Task1");
-    if (pid1 < 0) {
-        uart_puts("Failed to create task 1\n");
-    } else {
-        uart_puts("Task 1 created with PID: ");
-        print_uint(pid1);
-        uart_puts("\n");
-    }
+    smp_boot_secondaries(idle_task_function);
+    boot_phase("smp");
 
-    int pid2 = task_create(simple_task_2, (void *)2, "Task2");
-    if (pid2 < 0) {
-        uart_puts("Failed to create task 2\n");
-    } else {
-        uart_puts("Task 2 created with PID: ");
-        print_uint(pid2);
-        uart_puts("\n");
+#ifdef CONFIG_BENCH
+    if (task_create(bench_task, NULL, "Bench", TASK_PRIO_DEFAULT, 0) < 0) {
+        uart_puts("Failed to create the benchmark task\n");
+        start_demo_tasks();
     }
+#else
+    start_demo_tasks();
+#endif
 
-    uart_puts(
-        "All tasks created. Enabling interrupts and starting scheduler "
-        "(conceptually).\n");
-    enable_interrupts();
+    klog_init();  // Log text is buffered per CPU from here on
+    boot_phase("tasks");
+    boot_time_report();
 
-    uart_puts("Kernel entering idle loop (WFI). Tasks are ready.\n");
+    // Hand the boot CPU to the first task now rather than at the first
+    // tick, up to a full period later. IRQs have not been unmasked yet, as
+    // schedule() requires; ret_from_fork unmasks them for the task. Like
+    // on the secondaries, this boot context is abandoned.
+    schedule();
     while (1) {
-        // The kernel_main's WFI is now less critical as the idle task will take
-        // over when no other tasks are scheduled. However, before the first
-        // schedule call, this WFI is still what the "implicit kernel task"
-        // does.
         __asm__ __volatile__("wfi");
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,135 @@
+#include "kmalloc.h"
+
+#include <stddef.h>
+
+#include "common_macros.h"
+#include "page_alloc.h"
+#include "slab.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "string.h"
+#include "uart.h"
+
+typedef struct {
+    uint32_t count;
+    void *objs[KMALLOC_MAG_SIZE];
+} kmalloc_mag_t;
+
+static kmem_cache_t kmalloc_caches[KMALLOC_NR_CLASSES];
+
+// Only ever touched by the owning CPU with IRQs masked, which is all the
+// exclusion the fast path needs.
+static kmalloc_mag_t kmalloc_mags[MAX_CPUS][KMALLOC_NR_CLASSES];
+
+static const char *const kmalloc_names[KMALLOC_NR_CLASSES] = {
+    "kmalloc-16",   "kmalloc-32",   "kmalloc-64",   "kmalloc-128",
+    "kmalloc-256",  "kmalloc-512",  "kmalloc-1024", "kmalloc-2048",
+    "kmalloc-4096", "kmalloc-8192",
+};
+
+_Static_assert(sizeof(kmalloc_names) / sizeof(kmalloc_names[0]) ==
+                   KMALLOC_NR_CLASSES,
+               "one name per kmalloc size class");
+
+// Index of the smallest class holding 'size' (1..KMALLOC_MAX_SIZE).
+static uint32_t size_class(uint64_t size) {
+    if (size <= (1U << KMALLOC_MIN_SHIFT)) {
+        return 0;
+    }
+    uint32_t shift = 64 - (uint32_t)__builtin_clzl(size - 1);
+    return shift - KMALLOC_MIN_SHIFT;
+}
+
+void kmalloc_init(void) {
+    for (uint32_t i = 0; i < KMALLOC_NR_CLASSES; ++i) {
+        kmem_cache_init(&kmalloc_caches[i], kmalloc_names[i],
+                        1U << (i + KMALLOC_MIN_SHIFT), 16);
+    }
+}
+
+void *kmalloc(uint64_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    if (size > KMALLOC_MAX_SIZE) {
+        // page_alloc() records the order in the head page for kfree().
+        return page_alloc(page_order_for(size));
+    }
+
+    uint32_t cls = size_class(size);
+    uint64_t flags = local_irq_save();
+    kmalloc_mag_t *mag = &kmalloc_mags[this_cpu()->id][cls];
+    if (mag->count == 0) {
+        mag->count = kmem_cache_alloc_bulk(&kmalloc_caches[cls], mag->objs,
+                                           KMALLOC_MAG_SIZE / 2);
+    }
+    void *obj = mag->count ? mag->objs[--mag->count] : NULL;
+    local_irq_restore(flags);
+    return obj;
+}
+
+void *kzalloc(uint64_t size) {
+    void *ptr = kmalloc(size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void kfree(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    page_t *page = virt_to_page(ptr);
+    if (!page) {
+        uart_puts("Error: kfree of unmanaged address 0x");
+        print_hex((uint64_t)ptr);
+        uart_puts("\n");
+        return;
+    }
+    if (!(page->flags & PAGE_SLAB)) {
+        page_free(ptr, page->order);
+        return;
+    }
+
+    kmem_cache_t *cache = page->slab_cache;
+    if (cache < &kmalloc_caches[0] ||
+        cache >= &kmalloc_caches[KMALLOC_NR_CLASSES]) {
+        uart_puts("Error: kfree of an object from slab cache ");
+        uart_puts(cache->name);
+        uart_puts("\n");
+        return;
+    }
+
+    uint64_t flags = local_irq_save();
+    kmalloc_mag_t *mag = &kmalloc_mags[this_cpu()->id][cache - kmalloc_caches];
+    if (mag->count == KMALLOC_MAG_SIZE) {
+        // Hand the older half back so a steady alloc/free mix on this CPU
+        // keeps hitting the magazine instead of bouncing off the cache.
+        kmem_cache_free_bulk(cache, mag->objs, KMALLOC_MAG_SIZE / 2);
+        for (uint32_t i = 0; i < KMALLOC_MAG_SIZE / 2; ++i) {
+            mag->objs[i] = mag->objs[i + KMALLOC_MAG_SIZE / 2];
+        }
+        mag->count = KMALLOC_MAG_SIZE / 2;
+    }
+    mag->objs[mag->count++] = ptr;
+    local_irq_restore(flags);
+}
+
+void kmalloc_dump_stats(void) {
+    // Objects parked in per-CPU magazines count as active.
+    uart_puts("kmalloc classes (active objects / slabs):\n");
+    for (uint32_t i = 0; i < KMALLOC_NR_CLASSES; ++i) {
+        kmem_cache_t *cache = &kmalloc_caches[i];
+        if (cache->nr_slabs == 0) {
+            continue;
+        }
+        uart_puts("  ");
+        uart_puts(cache->name);
+        uart_puts(": ");
+        print_uint(cache->nr_active);
+        uart_puts(" / ");
+        print_uint(cache->nr_slabs);
+        uart_puts("\n");
+    }
+}
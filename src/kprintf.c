@@ -0,0 +1,337 @@
+#include "kprintf.h"
+
+#include <stddef.h>
+
+#include "common_macros.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "task.h"
+#include "uart.h"
+#include "wait.h"
+
+#define KLOG_BUF_MASK (KLOG_BUF_SIZE - 1)
+
+_Static_assert((KLOG_BUF_SIZE & KLOG_BUF_MASK) == 0,
+               "KLOG_BUF_SIZE must be a power of two");
+
+enum { KLOG_MODE_DIRECT, KLOG_MODE_BUFFERED, KLOG_MODE_PANIC };
+
+static volatile uint32_t klog_mode;  // KLOG_MODE_DIRECT until klog_init()
+
+// Single-producer, single-consumer ring per CPU. The owning CPU appends
+// with IRQs masked and publishes 'head'; whoever holds klog_flush_lock
+// consumes and publishes 'tail'.
+typedef struct {
+    char data[KLOG_BUF_SIZE];
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;   // Messages that did not fit, owner only
+    uint64_t reported;  // 'dropped' as last reported, flusher only
+} klog_buf_t;
+
+static klog_buf_t klog_bufs[MAX_CPUS];
+static spinlock_t klog_flush_lock = SPINLOCK_INIT;
+static wait_queue_t klog_wq = WAIT_QUEUE_INIT;  // The flusher, when idle
+
+// Formatting
+
+typedef struct {
+    char *buf;
+    uint32_t size;
+    uint32_t len;  // Length the full output would have
+} kfmt_out_t;
+
+static void out_char(kfmt_out_t *out, char c) {
+    if (out->len + 1 < out->size) {
+        out->buf[out->len] = c;
+    }
+    out->len++;
+}
+
+static void out_pad(kfmt_out_t *out, char c, uint32_t count) {
+    while (count--) {
+        out_char(out, c);
+    }
+}
+
+static void out_string(kfmt_out_t *out, const char *s, uint32_t width,
+                       int left) {
+    uint32_t len = 0;
+    while (s[len]) {
+        len++;
+    }
+    uint32_t fill = width > len ? width - len : 0;
+    if (!left) {
+        out_pad(out, ' ', fill);
+    }
+    for (uint32_t i = 0; i < len; ++i) {
+        out_char(out, s[i]);
+    }
+    if (left) {
+        out_pad(out, ' ', fill);
+    }
+}
+
+static void out_number(kfmt_out_t *out, uint64_t val, uint32_t base,
+                       int upper, int negative, uint32_t width, char pad,
+                       int left) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[24];
+    uint32_t n = 0;
+    do {
+        tmp[n++] = digits[val % base];
+        val /= base;
+    } while (val);
+
+    uint32_t len = n + (negative ? 1 : 0);
+    uint32_t fill = width > len ? width - len : 0;
+    if (!left && pad == ' ') {
+        out_pad(out, ' ', fill);
+    }
+    if (negative) {
+        out_char(out, '-');
+    }
+    if (!left && pad == '0') {
+        out_pad(out, '0', fill);
+    }
+    while (n) {
+        out_char(out, tmp[--n]);
+    }
+    if (left) {
+        out_pad(out, ' ', fill);
+    }
+}
+
+uint32_t kvsnprintf(char *buf, uint32_t size, const char *fmt, va_list ap) {
+    kfmt_out_t out = {buf, size, 0};
+
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            out_char(&out, *fmt);
+            continue;
+        }
+        fmt++;
+
+        int left = 0;
+        char pad = ' ';
+        for (; *fmt == '-' || *fmt == '0'; fmt++) {
+            if (*fmt == '-') {
+                left = 1;
+            } else {
+                pad = '0';
+            }
+        }
+        uint32_t width = 0;
+        for (; *fmt >= '0' && *fmt <= '9'; fmt++) {
+            width = width * 10 + (uint32_t)(*fmt - '0');
+        }
+        int is_long = 0;
+        for (; *fmt == 'l' || *fmt == 'z'; fmt++) {
+            is_long = 1;  // long, long long and size_t are all 64-bit
+        }
+
+        switch (*fmt) {
+            case 'd':
+            case 'i': {
+                int64_t val = is_long ? va_arg(ap, int64_t) : va_arg(ap, int);
+                uint64_t mag = val < 0 ? -(uint64_t)val : (uint64_t)val;
+                out_number(&out, mag, 10, 0, val < 0, width, pad, left);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X': {
+                uint64_t val =
+                    is_long ? va_arg(ap, uint64_t) : va_arg(ap, unsigned int);
+                out_number(&out, val, *fmt == 'u' ? 10 : 16, *fmt == 'X', 0,
+                           width, pad, left);
+                break;
+            }
+            case 'p':
+                out_char(&out, '0');
+                out_char(&out, 'x');
+                out_number(&out, (uint64_t)va_arg(ap, void *), 16, 0, 0,
+                           width, pad, left);
+                break;
+            case 's': {
+                const char *s = va_arg(ap, const char *);
+                out_string(&out, s ? s : "(null)", width, left);
+                break;
+            }
+            case 'c':
+                out_char(&out, (char)va_arg(ap, int));
+                break;
+            case '%':
+                out_char(&out, '%');
+                break;
+            case '\0':
+                fmt--;  // Lone '%' at the end
+                break;
+            default:  // Unknown conversion: print it as is
+                out_char(&out, '%');
+                out_char(&out, *fmt);
+                break;
+        }
+    }
+
+    if (size) {
+        buf[out.len < size ? out.len : size - 1] = '\0';
+    }
+    return out.len < size ? out.len : (size ? size - 1 : 0);
+}
+
+uint32_t ksnprintf(char *buf, uint32_t size, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    uint32_t len = kvsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    return len;
+}
+
+// Logging
+
+static void klog_append(const char *text, uint32_t len) {
+    uint64_t flags = local_irq_save();
+    klog_buf_t *log = &klog_bufs[this_cpu()->id];
+    uint64_t head = log->head;
+    uint64_t tail = __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE);
+    int wake = 0;
+    if (KLOG_BUF_SIZE - (head - tail) < len) {
+        log->dropped++;  // Whole messages or nothing
+    } else {
+        for (uint32_t i = 0; i < len; ++i) {
+            log->data[(head + i) & KLOG_BUF_MASK] = text[i];
+        }
+        __atomic_store_n(&log->head, head + len, __ATOMIC_RELEASE);
+        // Pairs with the fence in klog_pending(): either we see the
+        // flusher queued, or it sees this text before it blocks.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        wake = __atomic_load_n(&klog_wq.head, __ATOMIC_RELAXED) != NULL;
+    }
+    local_irq_restore(flags);
+    if (wake) {
+        wake_up_one(&klog_wq);
+    }
+}
+
+void kprintf(const char *fmt, ...) {
+    char line[KLOG_LINE_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    uint32_t len = kvsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    if (klog_mode == KLOG_MODE_BUFFERED) {
+        klog_append(line, len);
+    } else {
+        uart_write(line, len);
+    }
+}
+
+// Send one CPU's buffered text to the UART. Caller is the only consumer.
+static void klog_drain(klog_buf_t *log, uint32_t cpu) {
+    uint64_t head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = log->tail;
+    while (tail != head) {
+        uint64_t off = tail & KLOG_BUF_MASK;
+        uint64_t len = head - tail;
+        if (len > KLOG_BUF_SIZE - off) {
+            len = KLOG_BUF_SIZE - off;  // Up to the wrap, then the rest
+        }
+        uart_write(&log->data[off], len);
+        tail += len;
+        __atomic_store_n(&log->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    uint64_t dropped = __atomic_load_n(&log->dropped, __ATOMIC_RELAXED);
+    if (dropped != log->reported) {
+        char note[64];
+        uint32_t len = ksnprintf(note, sizeof(note),
+                                 "[klog: CPU %u dropped %lu messages]\n", cpu,
+                                 dropped - log->reported);
+        uart_write(note, len);
+        log->reported = dropped;
+    }
+}
+
+// Move everything buffered on all CPUs to the UART. Only the flusher task
+// calls this, at its own pace: a drainer preempted with klog_flush_lock
+// held would otherwise stall every other one.
+static void klog_flush(void) {
+    if (!spin_trylock(&klog_flush_lock)) {
+        return;
+    }
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; ++cpu) {
+        klog_drain(&klog_bufs[cpu], cpu);
+    }
+    spin_unlock(&klog_flush_lock);
+}
+
+// Non-zero if any CPU has buffered text.
+static int klog_pending(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);  // See klog_append()
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; ++cpu) {
+        klog_buf_t *log = &klog_bufs[cpu];
+        if (__atomic_load_n(&log->head, __ATOMIC_RELAXED) !=
+            __atomic_load_n(&log->tail, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Blocks while the buffers are empty, so a quiet system never wakes it;
+// the first message after that does. It then gives the burst
+// KLOG_FLUSH_DELAY_NS to collect before writing it out.
+void klog_kick(void) {
+    if (__atomic_load_n(&klog_wq.head, __ATOMIC_RELAXED) && klog_pending()) {
+        wake_up_one(&klog_wq);
+    }
+}
+
+static void klog_flush_task(void *arg) {
+    (void)arg;
+    while (1) {
+        wait_event(&klog_wq, klog_pending());
+        task_sleep_ns(KLOG_FLUSH_DELAY_NS);
+        klog_flush();
+    }
+}
+
+void klog_init(void) {
+    if (task_create(klog_flush_task, NULL, "KlogFlush", TASK_PRIO_LOWEST,
+                    0) < 0) {
+        kprintf("klog: no flusher task, logging unbuffered\n");
+        return;
+    }
+    __atomic_store_n(&klog_mode, KLOG_MODE_BUFFERED, __ATOMIC_RELEASE);
+}
+
+void klog_panic_begin(void) {
+    uint64_t flags = local_irq_save();
+    uart_panic_begin();
+    if (klog_mode != KLOG_MODE_PANIC) {
+        klog_mode = KLOG_MODE_PANIC;
+        // As in uart_panic_begin(): the flush lock's holder may never
+        // release it.
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; ++cpu) {
+            klog_drain(&klog_bufs[cpu], cpu);
+        }
+    }
+    local_irq_restore(flags);
+}
+
+void panic(const char *fmt, ...) {
+    char line[KLOG_LINE_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    uint32_t len = kvsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    local_irq_save();  // For good
+    klog_panic_begin();
+    uart_write(line, len);
+    while (1) {
+        __asm__ __volatile__("wfi");
+    }
+}
@@ -0,0 +1,199 @@
+#include "kstack.h"
+
+#include <stddef.h>
+
+#include "common_macros.h"
+#include "kprintf.h"
+#include "mmu.h"
+#include "page_alloc.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "task.h"
+#include "uart.h"
+
+_Static_assert(KSTACK_VA_BASE + KSTACK_VA_SIZE <= MMU_KERNEL_VA_END,
+               "stack slots must be in the shared kernel mappings");
+_Static_assert((2UL << 20) % KSTACK_SLOT_SIZE == 0,
+               "a slot must not straddle two level 3 tables");
+
+static spinlock_t kstack_lock = SPINLOCK_INIT;
+static uint64_t slot_map[KSTACK_NR_SLOTS / 64];
+static uint32_t slot_next;  // Where the search for a free slot resumes
+
+// Only touched by the owning CPU with IRQs masked.
+static struct {
+    uint32_t count;
+    void *pages[KSTACK_RESERVE_PAGES];
+} reserve[MAX_CPUS];
+
+static int slot_alloc(void) {
+    uint64_t flags = spin_lock_irqsave(&kstack_lock);
+    for (uint32_t n = 0; n < KSTACK_NR_SLOTS; ++n) {
+        uint32_t slot = (slot_next + n) % KSTACK_NR_SLOTS;
+        if (!(slot_map[slot / 64] & (1UL << (slot % 64)))) {
+            slot_map[slot / 64] |= 1UL << (slot % 64);
+            slot_next = slot + 1;
+            spin_unlock_irqrestore(&kstack_lock, flags);
+            return (int)slot;
+        }
+    }
+    spin_unlock_irqrestore(&kstack_lock, flags);
+    return -1;
+}
+
+static void slot_free(uint32_t slot) {
+    uint64_t flags = spin_lock_irqsave(&kstack_lock);
+    slot_map[slot / 64] &= ~(1UL << (slot % 64));
+    spin_unlock_irqrestore(&kstack_lock, flags);
+}
+
+void kstack_refill_reserve(void) {
+    uint64_t flags = local_irq_save();
+    uint32_t cpu = this_cpu()->id;
+    while (reserve[cpu].count < KSTACK_RESERVE_PAGES) {
+        void *page = page_alloc(0);
+        if (!page) {
+            break;
+        }
+        reserve[cpu].pages[reserve[cpu].count++] = page;
+    }
+    local_irq_restore(flags);
+}
+
+int kstack_alloc(kstack_t *stack, uint32_t size) {
+    size = (uint32_t)((size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    if (size == 0 || size > KSTACK_MAX_SIZE) {
+        uart_puts("Error: Task stack size out of range!\n");
+        return -1;
+    }
+    int slot = slot_alloc();
+    if (slot < 0) {
+        return -1;
+    }
+    void *page = page_alloc(0);
+    uint64_t top = KSTACK_VA_BASE + ((uint64_t)(slot + 1) << KSTACK_SLOT_SHIFT);
+    // Also creates the level 3 table the fault path relies on.
+    if (!page || mmu_map_range(top - PAGE_SIZE, (uint64_t)page, PAGE_SIZE,
+                               MMU_PROT_KERNEL_RW) < 0) {
+        if (page) {
+            page_free(page, 0);
+        }
+        slot_free((uint32_t)slot);
+        return -1;
+    }
+
+    stack->slot = (uint32_t)slot;
+    stack->size = size;
+    stack->base = top - size;
+    stack->mapped = top - PAGE_SIZE;
+    kstack_refill_reserve();
+    return 0;
+}
+
+void kstack_free(kstack_t *stack) {
+    for (uint64_t va = stack->mapped; va < kstack_top(stack); va += PAGE_SIZE) {
+        uint64_t pa;
+        if (mmu_lookup(va, &pa) == 0) {
+            mmu_unmap_range(va, PAGE_SIZE);
+            page_free((void *)pa, 0);
+        }
+    }
+    slot_free(stack->slot);
+    stack->base = 0;
+    stack->mapped = 0;
+    stack->size = 0;
+}
+
+// Task whose stack slot holds 'addr' (inside the stack window): the running
+// task, or the one being switched away from, since schedule() updates
+// curr_task before it leaves the old stack. NULL if neither.
+static tcb_t *stack_owner(cpu_t *cpu, uint64_t addr) {
+    uint32_t slot = (uint32_t)((addr - KSTACK_VA_BASE) >> KSTACK_SLOT_SHIFT);
+    if (cpu->curr_task && cpu->curr_task->stack.slot == slot) {
+        return cpu->curr_task;
+    }
+    if (cpu->prev_task && cpu->prev_task->stack.slot == slot) {
+        return cpu->prev_task;
+    }
+    return NULL;
+}
+
+// Map 'task''s stack down to 'addr'. IRQs are masked. Returns 0, or -1 if
+// 'addr' is outside the reservation or the reserve ran dry.
+static int kstack_grow(cpu_t *cpu, tcb_t *task, uint64_t addr) {
+    kstack_t *stack = &task->stack;
+    if (addr < stack->base || addr >= kstack_top(stack)) {
+        return -1;
+    }
+    uint64_t target = addr & ~(PAGE_SIZE - 1);
+    while (stack->mapped > target) {
+        // The reserve only covers faults taken inside the page allocator.
+        void *page = page_alloc_atomic(0);
+        if (!page) {
+            if (reserve[cpu->id].count == 0) {
+                return -1;
+            }
+            page = reserve[cpu->id].pages[--reserve[cpu->id].count];
+        }
+        if (mmu_map_page_prealloc(stack->mapped - PAGE_SIZE, (uint64_t)page,
+                                  MMU_PROT_KERNEL_RW) < 0) {
+            // Cannot happen (kstack_alloc() created the table), and
+            // page_free() could deadlock here: keep the page if there is room.
+            if (reserve[cpu->id].count < KSTACK_RESERVE_PAGES) {
+                reserve[cpu->id].pages[reserve[cpu->id].count++] = page;
+            }
+            return -1;
+        }
+        stack->mapped -= PAGE_SIZE;
+    }
+    if (task == cpu->curr_task) {
+        cpu->stack_limit = stack->mapped;
+    }
+    return 0;
+}
+
+// A stack access at 'addr' could not be satisfied: the running task ran
+// off the end of its stack (or it could not grow) and is killed.
+static void kstack_overflow(cpu_t *cpu, tcb_t *task, uint64_t addr) {
+    cpu->stack_limit = 0;  // We may be on the fault stack from here on
+    if (!task || task != cpu->curr_task || task == cpu->idle_task) {
+        panic("Stack overflow at 0x%lx outside a killable task\n", addr);
+    }
+    pr_err("Stack overflow at 0x%lx in task PID %u, killing it\n", addr,
+           task->pid);
+    task_exit();
+}
+
+static int in_stack_window(uint64_t addr) {
+    return addr >= KSTACK_VA_BASE && addr < KSTACK_VA_BASE + KSTACK_VA_SIZE;
+}
+
+// Grow the stack holding 'addr' to cover it, or kill the running task.
+static void kstack_fault(cpu_t *cpu, uint64_t addr) {
+    tcb_t *task = stack_owner(cpu, addr);
+    if (task && kstack_grow(cpu, task, addr) == 0) {
+        return;
+    }
+    // Below the reservation, possibly in a neighbouring slot: blame the
+    // running task.
+    kstack_overflow(cpu, task ? task : cpu->curr_task, addr);
+}
+
+int kstack_handle_fault(uint64_t far) {
+    if (!in_stack_window(far)) {
+        return 0;
+    }
+    kstack_fault(this_cpu(), far);
+    return 1;
+}
+
+void kstack_entry_fault(uint64_t frame_low) {
+    cpu_t *cpu = this_cpu();
+    if (in_stack_window(frame_low)) {
+        // Also covers a stale cpu->stack_limit (it is switched just before
+        // the stack itself): growing a stack that is mapped is a no-op.
+        kstack_fault(cpu, frame_low);
+    } else if (mmu_lookup(frame_low, NULL) < 0) {
+        kstack_overflow(cpu, cpu->curr_task, frame_low);
+    }
+}
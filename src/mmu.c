@@ -0,0 +1,628 @@
+#include "mmu.h"
+
+#include <stddef.h>
+
+#include "common_macros.h"
+#include "gic.h"
+#include "kmalloc.h"
+#include "kprintf.h"
+#include "page_alloc.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "string.h"
+#include "uart.h"
+#include "virtio.h"
+
+// Section boundaries from linker.ld, all 4K aligned.
+extern char __text_start[], __text_end[];
+extern char __rodata_start[], __rodata_end[];
+extern char __data_start[];
+
+// MAIR_EL1: one attribute byte per MT_* index.
+#define MAIR_VALUE                                                     \
+    ((0x00UL << (8 * MT_DEVICE_nGnRnE)) |                              \
+     (0x04UL << (8 * MT_DEVICE_nGnRE)) | (0xFFUL << (8 * MT_NORMAL)) | \
+     (0x44UL << (8 * MT_NORMAL_NC)))
+
+// TCR_EL1 fields
+#define TCR_T0SZ (64UL - MMU_VA_BITS)
+#define TCR_IRGN0_WBWA (1UL << 8)  // Table walks: inner write-back
+#define TCR_ORGN0_WBWA (1UL << 10) // Table walks: outer write-back
+#define TCR_SH0_INNER (3UL << 12)
+#define TCR_TG0_4K (0UL << 14)
+#define TCR_EPD1 (1UL << 23)  // No TTBR1 walks: nothing lives up there
+#define TCR_IPS_SHIFT 32
+#define TCR_AS (1UL << 36)  // 16-bit ASIDs
+
+#define TTBR_ASID_SHIFT 48
+
+// SCTLR_EL1 bits
+#define SCTLR_M (1UL << 0)   // MMU enable
+#define SCTLR_A (1UL << 1)   // Alignment checking
+#define SCTLR_C (1UL << 2)   // Data cache enable
+#define SCTLR_I (1UL << 12)  // Instruction cache enable
+
+#define PT_ENTRIES 512
+#define PT_INDEX(va, level) \
+    (((va) >> (PAGE_SHIFT + 9 * (3 - (level)))) & (PT_ENTRIES - 1))
+// Bytes mapped by one entry at 'level'
+#define PT_LEVEL_SIZE(level) (1UL << (PAGE_SHIFT + 9 * (3 - (level))))
+
+#define KERNEL_L1_SLOTS (MMU_KERNEL_VA_END >> (PAGE_SHIFT + 18))
+
+// Read by secondaries while their MMU and caches are still off, so it is
+// cleaned to memory once built (see mmu_init()).
+static struct {
+    uint64_t *root;  // Level 1 table
+    uint64_t tcr;
+} mmu_boot_state;
+
+static spinlock_t mmu_lock = SPINLOCK_INIT;  // All page table updates
+static volatile uint32_t mmu_enabled;
+
+// ASID allocation, after Linux's arm64 scheme. An address space's 'asid'
+// holds a generation in the bits above asid_bits. Once every ASID of the
+// current generation is handed out, the generation is bumped and the
+// bitmap cleared (rollover); each CPU then flushes its whole TLB once,
+// before it next installs an ASID. Switching to an address space whose
+// ASID is still of the current generation takes no lock and no TLB
+// maintenance. ASID 0 is the kernel-only root's and is never handed out.
+static uint32_t asid_bits;
+static uint64_t asid_generation;  // Multiple of (1 << asid_bits)
+static uint64_t asid_map[(1UL << 16) / 64];
+static uint64_t asid_next = 1;  // Where the search for a free ASID resumes
+static spinlock_t asid_lock = SPINLOCK_INIT;
+// ASID each CPU is running with. Zeroed by a rollover, which forces that
+// CPU through the locked path (and its TLB flush) on its next switch.
+static volatile uint64_t active_asids[MAX_CPUS];
+// ASID each CPU was running with at the last rollover. It stays valid in
+// the new generation: that CPU may still hold TLB entries tagged with it.
+static uint64_t reserved_asids[MAX_CPUS];
+static volatile uint32_t tlb_flush_pending;  // CPU mask
+static uint64_t cpu_ttbr0[MAX_CPUS];  // Last value written to TTBR0_EL1
+
+#define ASID_MASK ((1UL << asid_bits) - 1)
+
+void dcache_clean_range(const void *start, uint64_t size) {
+    uint64_t ctr;
+    __asm__ __volatile__("mrs %0, ctr_el0" : "=r"(ctr));
+    uint64_t line = 4UL << ((ctr >> 16) & 0xF);  // CTR_EL0.DminLine
+    uint64_t addr = (uint64_t)start & ~(line - 1);
+    uint64_t end = (uint64_t)start + size;
+    for (; addr < end; addr += line) {
+        __asm__ __volatile__("dc cvac, %0" ::"r"(addr) : "memory");
+    }
+    __asm__ __volatile__("dsb sy" ::: "memory");
+}
+
+static uint64_t *pt_alloc(void) {
+    uint64_t *table = page_alloc(0);
+    if (table) {
+        memset(table, 0, PAGE_SIZE);
+    }
+    return table;
+}
+
+// Drop every cached translation and walk on every core.
+static void tlb_flush_all(void) {
+    if (!mmu_enabled) {
+        return;
+    }
+    __asm__ __volatile__(
+        "dsb ishst\n"
+        "tlbi vmalle1is\n"
+        "dsb ish\n"
+        "isb" ::: "memory");
+}
+
+// Drop any cached translation of 'va' on every core.
+static void tlb_flush_page(uint64_t va) {
+    if (!mmu_enabled) {
+        return;
+    }
+    __asm__ __volatile__(
+        "dsb ishst\n"
+        "tlbi vaae1is, %0\n"
+        "dsb ish\n"
+        "isb" ::"r"(va >> PAGE_SHIFT)
+        : "memory");
+}
+
+// Drop the translation of 'va' tagged with 'asid' on every core.
+static void tlb_flush_asid_page(uint64_t asid, uint64_t va) {
+    __asm__ __volatile__(
+        "dsb ishst\n"
+        "tlbi vae1is, %0\n"
+        "dsb ish\n"
+        "isb" ::"r"((asid << TTBR_ASID_SHIFT) | (va >> PAGE_SHIFT))
+        : "memory");
+}
+
+// Replace the level 'level' block at 'entry' with a table mapping the same
+// memory with the same attributes, one level down. Caller holds mmu_lock.
+// This changes the block size of a live mapping without breaking it first,
+// which the architecture only guarantees with FEAT_BBM; nothing maps
+// memory that is in use with a different size, so it is left to splits of
+// idle ranges (mmu_map_range_pages() and unmaps inside a block).
+static int pt_split_block(uint64_t *entry, int level) {
+    uint64_t *table = pt_alloc();
+    if (!table) {
+        return -1;
+    }
+    uint64_t child_size = PT_LEVEL_SIZE(level + 1);
+    uint64_t pa = *entry & PTE_ADDR_MASK & ~(PT_LEVEL_SIZE(level) - 1);
+    uint64_t attrs = *entry & ~PTE_ADDR_MASK & ~PTE_TYPE_MASK;
+    // Level 3 entries need the page type bit; level 2 ones stay blocks.
+    uint64_t type = (level + 1 == 3) ? PTE_PAGE | PTE_VALID : PTE_VALID;
+    for (int i = 0; i < PT_ENTRIES; ++i) {
+        table[i] = (pa + i * child_size) | attrs | type;
+    }
+    __asm__ __volatile__("dsb ishst" ::: "memory");
+    *entry = (uint64_t)table | PTE_TABLE | PTE_VALID;
+    tlb_flush_all();
+    return 0;
+}
+
+// Entry for 'va' at 'level' (1-3) under level 1 table 'root', or NULL.
+// With 'create' set, missing tables on the way are allocated and blocks in
+// the way are split; without it either one ends the walk with NULL. Caller
+// holds mmu_lock (or is the only CPU running, or only reads).
+static uint64_t *pt_entry(uint64_t *root, uint64_t va, int level,
+                          int create) {
+    uint64_t *table = root;
+    for (int l = 1; l < level; ++l) {
+        uint64_t *entry = &table[PT_INDEX(va, l)];
+        if (!(*entry & PTE_VALID)) {
+            if (!create) {
+                return NULL;
+            }
+            uint64_t *next = pt_alloc();
+            if (!next) {
+                return NULL;
+            }
+            // Make the zeroed table visible to the walker before linking it.
+            __asm__ __volatile__("dsb ishst" ::: "memory");
+            *entry = (uint64_t)next | PTE_TABLE | PTE_VALID;
+        } else if (!(*entry & PTE_TABLE)) {  // Block
+            if (!create || pt_split_block(entry, l) < 0) {
+                return NULL;
+            }
+        }
+        table = (uint64_t *)(*entry & PTE_ADDR_MASK);
+    }
+    return &table[PT_INDEX(va, level)];
+}
+
+// Level 3 entry for 'va', see pt_entry().
+static uint64_t *pt_walk(uint64_t *root, uint64_t va, int create) {
+    return pt_entry(root, va, 3, create);
+}
+
+// Map [va, va + size) in the kernel tables, with 2 MiB level 2 blocks
+// wherever va and pa are both aligned to one and it fits, if 'blocks' is
+// set. Level 1 (1 GiB) blocks are not used: kernel level 1 entries are
+// copied into every address space (see mmu_as_create()) and must stay
+// table pointers. Caller holds mmu_lock.
+static int map_range_locked(uint64_t va, uint64_t pa, uint64_t size,
+                            uint64_t prot, int blocks) {
+    uint64_t off = 0;
+    while (off < size) {
+        uint64_t v = va + off;
+        uint64_t p = pa + off;
+        if (blocks && ((v | p) & (MMU_BLOCK_SIZE - 1)) == 0 &&
+            size - off >= MMU_BLOCK_SIZE) {
+            uint64_t *entry = pt_entry(mmu_boot_state.root, v, 2, 1);
+            if (!entry) {
+                return -1;
+            }
+            uint64_t old = *entry;
+            if (old & PTE_VALID) {
+                *entry = 0;  // Break before make
+                if (old & PTE_TABLE) {
+                    // Pages being merged into the block.
+                    tlb_flush_all();
+                    page_free((void *)(old & PTE_ADDR_MASK), 0);
+                } else {
+                    tlb_flush_page(v);
+                }
+            }
+            *entry = (p & PTE_ADDR_MASK) | prot | PTE_VALID;  // Block
+            off += MMU_BLOCK_SIZE;
+            continue;
+        }
+
+        uint64_t *pte = pt_walk(mmu_boot_state.root, v, 1);
+        if (!pte) {
+            return -1;
+        }
+        if (*pte & PTE_VALID) {
+            *pte = 0;  // Break before make
+            tlb_flush_page(v);
+        }
+        *pte = (p & PTE_ADDR_MASK) | prot | PTE_PAGE | PTE_VALID;
+        off += PAGE_SIZE;
+    }
+    return 0;
+}
+
+static int map_range(uint64_t va, uint64_t pa, uint64_t size, uint64_t prot,
+                     int blocks) {
+    if (va + size > MMU_KERNEL_VA_END) {
+        uart_puts("Error: Kernel mapping outside the shared kernel range!\n");
+        return -1;
+    }
+    uint64_t flags = spin_lock_irqsave(&mmu_lock);
+    int ret = map_range_locked(va, pa, size, prot, blocks);
+    __asm__ __volatile__("dsb ishst\nisb" ::: "memory");
+    spin_unlock_irqrestore(&mmu_lock, flags);
+    if (ret < 0) {
+        uart_puts("Error: Out of memory for page tables!\n");
+    }
+    return ret;
+}
+
+int mmu_map_range(uint64_t va, uint64_t pa, uint64_t size, uint64_t prot) {
+    return map_range(va, pa, size, prot, 1);
+}
+
+int mmu_map_range_pages(uint64_t va, uint64_t pa, uint64_t size,
+                        uint64_t prot) {
+    return map_range(va, pa, size, prot, 0);
+}
+
+void mmu_unmap_range(uint64_t va, uint64_t size) {
+    uint64_t flags = spin_lock_irqsave(&mmu_lock);
+    uint64_t off = 0;
+    while (off < size) {
+        uint64_t v = va + off;
+        uint64_t *entry = pt_entry(mmu_boot_state.root, v, 2, 0);
+        if (entry && (*entry & PTE_VALID) && !(*entry & PTE_TABLE) &&
+            (v & (MMU_BLOCK_SIZE - 1)) == 0 && size - off >= MMU_BLOCK_SIZE) {
+            *entry = 0;  // Whole block
+            tlb_flush_page(v);
+            off += MMU_BLOCK_SIZE;
+            continue;
+        }
+        // Splits a block that is only partly unmapped.
+        int split = entry && (*entry & PTE_VALID) && !(*entry & PTE_TABLE);
+        uint64_t *pte = pt_walk(mmu_boot_state.root, v, split);
+        if (pte && (*pte & PTE_VALID)) {
+            *pte = 0;
+            tlb_flush_page(v);
+        }
+        off += PAGE_SIZE;
+    }
+    spin_unlock_irqrestore(&mmu_lock, flags);
+}
+
+int mmu_lookup(uint64_t va, uint64_t *pa) {
+    uint64_t *table = mmu_boot_state.root;
+    for (int level = 1; level <= 3; ++level) {
+        uint64_t entry = table[PT_INDEX(va, level)];
+        if (!(entry & PTE_VALID)) {
+            return -1;
+        }
+        if (level == 3 || !(entry & PTE_TABLE)) {  // Page or block
+            uint64_t mask = PT_LEVEL_SIZE(level) - 1;
+            if (pa) {
+                *pa = (entry & PTE_ADDR_MASK & ~mask) | (va & mask);
+            }
+            return 0;
+        }
+        table = (uint64_t *)(entry & PTE_ADDR_MASK);
+    }
+    return -1;
+}
+
+int mmu_map_page_prealloc(uint64_t va, uint64_t pa, uint64_t prot) {
+    uint64_t *pte = pt_walk(mmu_boot_state.root, va, 0);
+    if (!pte) {
+        return -1;
+    }
+    // The entry was invalid, so no TLB can hold it: no invalidation, just
+    // make the store visible to the walker before the access is retried.
+    *pte = (pa & PTE_ADDR_MASK) | prot | PTE_PAGE | PTE_VALID;
+    __asm__ __volatile__("dsb ishst\nisb" ::: "memory");
+    return 0;
+}
+
+// Program the translation registers and turn on the MMU and both caches on
+// the calling core. Execution continues at the same (identity-mapped) PC.
+static void mmu_cpu_enable(void) {
+    __asm__ __volatile__("msr mair_el1, %0" ::"r"(MAIR_VALUE));
+    __asm__ __volatile__("msr tcr_el1, %0" ::"r"(mmu_boot_state.tcr));
+    __asm__ __volatile__("msr ttbr0_el1, %0" ::"r"(mmu_boot_state.root));
+    cpu_ttbr0[this_cpu()->id] = (uint64_t)mmu_boot_state.root;
+    __asm__ __volatile__(
+        "isb\n"
+        "tlbi vmalle1\n"
+        "dsb nsh\n"
+        "isb" ::: "memory");
+
+    uint64_t sctlr;
+    __asm__ __volatile__("mrs %0, sctlr_el1" : "=r"(sctlr));
+    sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+    sctlr &= ~SCTLR_A;
+    __asm__ __volatile__("msr sctlr_el1, %0\nisb" ::"r"(sctlr) : "memory");
+}
+
+void mmu_init(uint64_t ram_base, uint64_t ram_end) {
+    spin_lock_init(&mmu_lock);
+    mmu_enabled = 0;
+
+    mmu_boot_state.root = pt_alloc();
+    if (!mmu_boot_state.root) {
+        panic("FATAL: No memory for the kernel page table! Halting.\n");
+    }
+
+    uint64_t mmfr0;
+    __asm__ __volatile__("mrs %0, id_aa64mmfr0_el1" : "=r"(mmfr0));
+    uint64_t ips = mmfr0 & 0xF;  // PARange
+    if (ips > 5) {
+        ips = 5;  // 52-bit PAs need FEAT_LPA2 with 4K pages; 48 is plenty
+    }
+    mmu_boot_state.tcr = TCR_T0SZ | TCR_IRGN0_WBWA | TCR_ORGN0_WBWA |
+                         TCR_SH0_INNER | TCR_TG0_4K | TCR_EPD1 |
+                         (ips << TCR_IPS_SHIFT);
+    if (((mmfr0 >> 4) & 0xF) == 2) {  // ASIDBits
+        asid_bits = 16;
+        mmu_boot_state.tcr |= TCR_AS;
+    } else {
+        asid_bits = 8;
+    }
+    asid_generation = 1UL << asid_bits;
+
+    // Level 2 tables for the whole shared kernel range up front: address
+    // spaces copy these level 1 entries when created, so kernel mappings
+    // added later show up in every one of them.
+    for (uint64_t slot = 0; slot < KERNEL_L1_SLOTS; ++slot) {
+        if (!pt_entry(mmu_boot_state.root, slot << (PAGE_SHIFT + 18), 2, 1)) {
+            panic("FATAL: No memory for the kernel page table! Halting.\n");
+        }
+    }
+
+    // Devices, as whole 2 MiB blocks: the GIC block also holds GICC, and
+    // the rest of each window is other QEMU virt MMIO (nothing is ever
+    // speculatively accessed with Device attributes).
+    mmu_map_range(GICD_BASE & ~(MMU_BLOCK_SIZE - 1),
+                  GICD_BASE & ~(MMU_BLOCK_SIZE - 1), MMU_BLOCK_SIZE,
+                  MMU_PROT_DEVICE);
+    mmu_map_range(UART_BASE & ~(MMU_BLOCK_SIZE - 1),
+                  UART_BASE & ~(MMU_BLOCK_SIZE - 1), MMU_BLOCK_SIZE,
+                  MMU_PROT_DEVICE);
+    mmu_map_range(VIRTIO_MMIO_BASE & ~(MMU_BLOCK_SIZE - 1),
+                  VIRTIO_MMIO_BASE & ~(MMU_BLOCK_SIZE - 1), MMU_BLOCK_SIZE,
+                  MMU_PROT_DEVICE);
+
+    // RAM, with the kernel image split by segment (see the PHDRS in
+    // linker.ld). Everything from .data on, including the page allocator's
+    // memory, is read/write and never executable. mmu_map_range() uses
+    // 2 MiB blocks from the first aligned boundary after .data on, so only
+    // the block holding the image itself is mapped with pages.
+    uint64_t text = (uint64_t)__text_start;
+    uint64_t data = (uint64_t)__data_start;
+    if (text > ram_base) {
+        mmu_map_range(ram_base, ram_base, text - ram_base, MMU_PROT_KERNEL_RW);
+    }
+    mmu_map_range(text, text, (uint64_t)__text_end - text, MMU_PROT_KERNEL_RX);
+    mmu_map_range((uint64_t)__rodata_start, (uint64_t)__rodata_start,
+                  (uint64_t)__rodata_end - (uint64_t)__rodata_start,
+                  MMU_PROT_KERNEL_RO);
+    mmu_map_range(data, data, ram_end - data, MMU_PROT_KERNEL_RW);
+
+    mmu_cpu_enable();
+    mmu_enabled = 1;
+    dcache_clean_range(&mmu_boot_state, sizeof(mmu_boot_state));
+
+    uart_puts("MMU: Enabled, identity map with caches on. TTBR0_EL1: 0x");
+    print_hex((uint64_t)mmu_boot_state.root);
+    uart_puts(", ");
+    print_uint(asid_bits);
+    uart_puts("-bit ASIDs\n");
+}
+
+void mmu_enable_secondary(void) { mmu_cpu_enable(); }
+
+addr_space_t *mmu_as_create(void) {
+    addr_space_t *as = kmalloc(sizeof(addr_space_t));
+    if (!as) {
+        return NULL;
+    }
+    as->root = pt_alloc();
+    if (!as->root) {
+        kfree(as);
+        return NULL;
+    }
+    for (uint64_t slot = 0; slot < KERNEL_L1_SLOTS; ++slot) {
+        as->root[slot] = mmu_boot_state.root[slot];
+    }
+    as->asid = 0;  // Assigned on first switch
+    as->users = 1;
+    return as;
+}
+
+void mmu_as_get(addr_space_t *as) {
+    __atomic_add_fetch(&as->users, 1, __ATOMIC_RELAXED);
+}
+
+// Free the private level 2/3 tables. Only the task range has any: the
+// kernel's entries point at shared tables.
+static void as_free_tables(addr_space_t *as) {
+    for (uint64_t i = PT_INDEX(MMU_TASK_VA_BASE, 1); i < PT_ENTRIES; ++i) {
+        if (!(as->root[i] & PTE_VALID)) {
+            continue;
+        }
+        uint64_t *l2 = (uint64_t *)(as->root[i] & PTE_ADDR_MASK);
+        for (uint64_t j = 0; j < PT_ENTRIES; ++j) {
+            if (l2[j] & PTE_VALID) {
+                page_free((void *)(l2[j] & PTE_ADDR_MASK), 0);
+            }
+        }
+        page_free(l2, 0);
+    }
+    page_free(as->root, 0);
+}
+
+void mmu_as_put(addr_space_t *as) {
+    if (__atomic_sub_fetch(&as->users, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    // No CPU runs in 'as' any more, but TLBs may still cache its entries
+    // (and walks through its tables). The ASID itself stays allocated until
+    // the next rollover.
+    if (as->asid) {
+        __asm__ __volatile__(
+            "dsb ishst\n"
+            "tlbi aside1is, %0\n"
+            "dsb ish\n"
+            "isb" ::"r"((as->asid & ASID_MASK) << TTBR_ASID_SHIFT)
+            : "memory");
+    }
+    as_free_tables(as);
+    kfree(as);
+}
+
+int mmu_as_map(addr_space_t *as, uint64_t va, uint64_t pa, uint64_t size,
+               uint64_t prot) {
+    if (va < MMU_TASK_VA_BASE || va + size > MMU_TASK_VA_END ||
+        va + size < va) {
+        uart_puts("Error: Task mapping outside the task range!\n");
+        return -1;
+    }
+    uint64_t flags = spin_lock_irqsave(&mmu_lock);
+    for (uint64_t off = 0; off < size; off += PAGE_SIZE) {
+        uint64_t *pte = pt_walk(as->root, va + off, 1);
+        if (!pte) {
+            spin_unlock_irqrestore(&mmu_lock, flags);
+            uart_puts("Error: Out of memory for page tables!\n");
+            return -1;
+        }
+        if (*pte & PTE_VALID) {
+            *pte = 0;  // Break before make
+            tlb_flush_asid_page(as->asid & ASID_MASK, va + off);
+        }
+        // Non-global: cached under this address space's ASID only.
+        *pte = ((pa + off) & PTE_ADDR_MASK) | prot | PTE_NG | PTE_PAGE |
+               PTE_VALID;
+    }
+    __asm__ __volatile__("dsb ishst\nisb" ::: "memory");
+    spin_unlock_irqrestore(&mmu_lock, flags);
+    return 0;
+}
+
+// Returns 1 if some CPU was running with 'asid' at the last rollover, and
+// moves that reservation to 'newasid'. Caller holds asid_lock.
+static int asid_update_reserved(uint64_t asid, uint64_t newasid) {
+    int hit = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; ++cpu) {
+        if (reserved_asids[cpu] == asid) {
+            hit = 1;
+            reserved_asids[cpu] = newasid;
+        }
+    }
+    return hit;
+}
+
+// Start a new generation. Caller holds asid_lock.
+static void asid_rollover(void) {
+    for (uint64_t i = 0; i < (1UL << asid_bits) / 64; ++i) {
+        asid_map[i] = 0;
+    }
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; ++cpu) {
+        uint64_t asid = __atomic_exchange_n(&active_asids[cpu], 0,
+                                            __ATOMIC_RELAXED);
+        // A CPU that already lost its active ASID to an earlier rollover
+        // (and has not switched since) is still running with the reserved one.
+        if (asid == 0) {
+            asid = reserved_asids[cpu];
+        }
+        asid_map[(asid & ASID_MASK) / 64] |= 1UL << ((asid & ASID_MASK) % 64);
+        reserved_asids[cpu] = asid;
+    }
+    __atomic_store_n(&tlb_flush_pending, (1U << MAX_CPUS) - 1,
+                     __ATOMIC_RELAXED);
+}
+
+// ASID (with generation) for an address space whose ASID is stale or
+// unset. Caller holds asid_lock.
+static uint64_t asid_new(addr_space_t *as) {
+    uint64_t asid = as->asid;
+    if (asid) {
+        uint64_t newasid = asid_generation | (asid & ASID_MASK);
+        // Still running somewhere: keep the number, its TLB entries are
+        // this address space's own.
+        if (asid_update_reserved(asid, newasid)) {
+            return newasid;
+        }
+        uint64_t idx = asid & ASID_MASK;
+        if (!(asid_map[idx / 64] & (1UL << (idx % 64)))) {
+            asid_map[idx / 64] |= 1UL << (idx % 64);
+            return newasid;
+        }
+    }
+
+    uint64_t num = 1UL << asid_bits;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (uint64_t idx = asid_next; idx < num; ++idx) {
+            if (!(asid_map[idx / 64] & (1UL << (idx % 64)))) {
+                asid_map[idx / 64] |= 1UL << (idx % 64);
+                asid_next = idx + 1;
+                return asid_generation | idx;
+            }
+        }
+        // Out of ASIDs in this generation.
+        asid_generation += num;
+        asid_rollover();
+        asid_next = 1;
+    }
+    return 0;  // Unreachable: a rollover leaves at most MAX_CPUS ASIDs taken
+}
+
+// ASID to run 'as' with on 'cpu' (the calling CPU).
+static uint64_t asid_check(addr_space_t *as, uint32_t cpu) {
+    uint64_t asid = __atomic_load_n(&as->asid, __ATOMIC_RELAXED);
+    uint64_t old_active =
+        __atomic_load_n(&active_asids[cpu], __ATOMIC_RELAXED);
+    // Fast path: current generation, and no rollover has zeroed our active
+    // ASID since we last looked. The exchange races with asid_rollover().
+    if (old_active && ((asid ^ __atomic_load_n(&asid_generation,
+                                               __ATOMIC_RELAXED)) >>
+                       asid_bits) == 0 &&
+        __atomic_compare_exchange_n(&active_asids[cpu], &old_active, asid, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return asid;
+    }
+
+    spin_lock(&asid_lock);
+    asid = as->asid;
+    if (((asid ^ asid_generation) >> asid_bits) != 0) {
+        asid = asid_new(as);
+        __atomic_store_n(&as->asid, asid, __ATOMIC_RELAXED);
+    }
+    if (tlb_flush_pending & (1U << cpu)) {
+        __atomic_and_fetch(&tlb_flush_pending, ~(1U << cpu), __ATOMIC_RELAXED);
+        __asm__ __volatile__(
+            "tlbi vmalle1\n"
+            "dsb nsh\n"
+            "isb" ::: "memory");
+    }
+    __atomic_store_n(&active_asids[cpu], asid, __ATOMIC_RELAXED);
+    spin_unlock(&asid_lock);
+    return asid;
+}
+
+void mmu_switch_to(addr_space_t *as) {
+    uint32_t cpu = this_cpu()->id;
+    uint64_t ttbr = (uint64_t)mmu_boot_state.root;  // ASID 0
+    if (as) {
+        uint64_t asid = asid_check(as, cpu);
+        ttbr = (uint64_t)as->root | ((asid & ASID_MASK) << TTBR_ASID_SHIFT);
+    }
+    if (ttbr == cpu_ttbr0[cpu]) {
+        return;
+    }
+    cpu_ttbr0[cpu] = ttbr;
+    // No TLB maintenance: entries of other address spaces are tagged with
+    // their own ASIDs, and kernel entries are global.
+    __asm__ __volatile__("msr ttbr0_el1, %0\nisb" ::"r"(ttbr) : "memory");
+}
@@ -0,0 +1,272 @@
+#include "page_alloc.h"
+
+#include <stddef.h>
+
+#include "smp.h"
+#include "spinlock.h"
+#include "uart.h"
+
+static spinlock_t page_lock = SPINLOCK_INIT;
+// CPU holding page_lock, -1 if none; see page_alloc_atomic().
+static volatile int32_t page_lock_cpu = -1;
+static page_t *free_lists[PAGE_MAX_ORDER + 1];
+static uint32_t free_counts[PAGE_MAX_ORDER + 1];
+static page_t *page_map;  // Descriptor of every managed page
+static uint64_t base_pfn;  // First managed page frame
+static uint64_t end_pfn;   // One past the last managed page frame
+static uint64_t free_pages;
+
+#define PFN(addr) ((uint64_t)(addr) >> PAGE_SHIFT)
+
+static page_t *pfn_to_page(uint64_t pfn) { return &page_map[pfn - base_pfn]; }
+
+static uint64_t page_to_pfn(page_t *page) {
+    return base_pfn + (uint64_t)(page - page_map);
+}
+
+static uint64_t page_lock_irqsave(void) {
+    uint64_t flags = spin_lock_irqsave(&page_lock);
+    page_lock_cpu = (int32_t)this_cpu()->id;
+    return flags;
+}
+
+static void page_unlock_irqrestore(uint64_t flags) {
+    page_lock_cpu = -1;
+    spin_unlock_irqrestore(&page_lock, flags);
+}
+
+// Free list helpers. Caller holds page_lock.
+
+static void list_add(page_t *page, uint32_t order) {
+    page->order = (uint8_t)order;
+    page->flags |= PAGE_FREE;
+    page->prev = NULL;
+    page->next = free_lists[order];
+    if (page->next) {
+        page->next->prev = page;
+    }
+    free_lists[order] = page;
+    free_counts[order]++;
+}
+
+static void list_del(page_t *page, uint32_t order) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        free_lists[order] = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+    page->flags &= ~PAGE_FREE;
+    free_counts[order]--;
+}
+
+uint64_t page_alloc_map_end(uint64_t start, uint64_t end) {
+    // The descriptor array itself lives at the bottom of the range.
+    start = (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    end &= ~(PAGE_SIZE - 1);
+    uint64_t npages = (end - start) >> PAGE_SHIFT;
+    return start + ((npages * sizeof(page_t) + PAGE_SIZE - 1) &
+                    ~(PAGE_SIZE - 1));
+}
+
+void page_alloc_init(uint64_t start, uint64_t end) {
+    spin_lock_init(&page_lock);
+    for (uint32_t order = 0; order <= PAGE_MAX_ORDER; ++order) {
+        free_lists[order] = NULL;
+        free_counts[order] = 0;
+    }
+    free_pages = 0;
+
+    uint64_t map_end = page_alloc_map_end(start, end);
+    start = (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    end &= ~(PAGE_SIZE - 1);
+    uint64_t map_bytes = map_end - start;
+
+    page_map = (page_t *)start;
+    base_pfn = PFN(map_end);
+    end_pfn = PFN(end);
+    for (uint64_t pfn = base_pfn; pfn < end_pfn; ++pfn) {
+        page_t *page = pfn_to_page(pfn);
+        page->next = NULL;
+        page->prev = NULL;
+        page->slab_cache = NULL;
+        page->order = 0;
+        page->flags = 0;  // Allocated until page_free_range()
+    }
+
+    uart_puts("Page allocator: 0x");
+    print_hex(base_pfn << PAGE_SHIFT);
+    uart_puts(" - 0x");
+    print_hex(end);
+    uart_puts(" (");
+    print_uint(end_pfn - base_pfn);
+    uart_puts(" pages, ");
+    print_uint(map_bytes >> PAGE_SHIFT);
+    uart_puts(" for descriptors)\n");
+}
+
+page_t *virt_to_page(const void *addr) {
+    uint64_t pfn = PFN(addr);
+    if (pfn < base_pfn || pfn >= end_pfn) {
+        return NULL;
+    }
+    return pfn_to_page(pfn);
+}
+
+uint32_t page_order_for(uint64_t bytes) {
+    uint32_t order = 0;
+    while ((PAGE_SIZE << order) < bytes) {
+        order++;
+    }
+    return order;
+}
+
+// Free a block and merge it with its buddy as far up as possible.
+// Caller holds page_lock.
+static void free_block_locked(uint64_t pfn, uint32_t order) {
+    free_pages += 1UL << order;
+    while (order < PAGE_MAX_ORDER) {
+        uint64_t buddy_pfn = pfn ^ (1UL << order);
+        if (buddy_pfn < base_pfn || buddy_pfn + (1UL << order) > end_pfn) {
+            break;
+        }
+        page_t *buddy = pfn_to_page(buddy_pfn);
+        if (!(buddy->flags & PAGE_FREE) || buddy->order != order) {
+            break;
+        }
+        list_del(buddy, order);
+        pfn &= ~(1UL << order);  // Merged block starts at the lower buddy
+        order++;
+    }
+    list_add(pfn_to_page(pfn), order);
+}
+
+void page_free_range(uint64_t start, uint64_t end) {
+    uint64_t pfn = PFN(start + PAGE_SIZE - 1);
+    uint64_t last = PFN(end);
+    if (pfn < base_pfn) {
+        pfn = base_pfn;
+    }
+    if (last > end_pfn) {
+        last = end_pfn;
+    }
+
+    uint64_t flags = page_lock_irqsave();
+    // Largest naturally aligned blocks that fit.
+    while (pfn < last) {
+        uint32_t order = pfn ? (uint32_t)__builtin_ctzl(pfn) : PAGE_MAX_ORDER;
+        if (order > PAGE_MAX_ORDER) {
+            order = PAGE_MAX_ORDER;
+        }
+        while (pfn + (1UL << order) > last) {
+            order--;
+        }
+        free_block_locked(pfn, order);
+        pfn += 1UL << order;
+    }
+    page_unlock_irqrestore(flags);
+}
+
+void *page_alloc(uint32_t order) {
+    if (order > PAGE_MAX_ORDER) {
+        return NULL;
+    }
+
+    uint64_t flags = page_lock_irqsave();
+
+    uint32_t found = order;
+    while (found <= PAGE_MAX_ORDER && !free_lists[found]) {
+        found++;
+    }
+    if (found > PAGE_MAX_ORDER) {
+        page_unlock_irqrestore(flags);
+        return NULL;
+    }
+
+    page_t *page = free_lists[found];
+    list_del(page, found);
+    uint64_t pfn = page_to_pfn(page);
+
+    // Split: give back the upper half at each level down to 'order'.
+    while (found > order) {
+        found--;
+        list_add(pfn_to_page(pfn + (1UL << found)), found);
+    }
+    page->order = (uint8_t)order;  // kfree() of large blocks reads it back
+    free_pages -= 1UL << order;
+
+    page_unlock_irqrestore(flags);
+    return (void *)(pfn << PAGE_SHIFT);
+}
+
+void *page_alloc_atomic(uint32_t order) {
+    // IRQs are masked in fault context, so this CPU cannot take the lock
+    // between the check and page_alloc().
+    if (page_lock_cpu == (int32_t)this_cpu()->id) {
+        return NULL;
+    }
+    return page_alloc(order);
+}
+
+void page_free(void *addr, uint32_t order) {
+    if (!addr || order > PAGE_MAX_ORDER) {
+        return;
+    }
+    uint64_t pfn = PFN(addr);
+    if (pfn < base_pfn || pfn + (1UL << order) > end_pfn) {
+        uart_puts("Error: page_free() of unmanaged address 0x");
+        print_hex((uint64_t)addr);
+        uart_puts("\n");
+        return;
+    }
+    uint64_t flags = page_lock_irqsave();
+    free_block_locked(pfn, order);
+    page_unlock_irqrestore(flags);
+}
+
+uint64_t page_alloc_free_bytes(void) {
+    return __atomic_load_n(&free_pages, __ATOMIC_RELAXED) << PAGE_SHIFT;
+}
+
+void page_alloc_get_stats(page_stats_t *stats) {
+    uint64_t flags = page_lock_irqsave();
+    stats->total_pages = end_pfn - base_pfn;
+    stats->free_pages = free_pages;
+    for (uint32_t order = 0; order <= PAGE_MAX_ORDER; ++order) {
+        stats->free_blocks[order] = free_counts[order];
+    }
+    page_unlock_irqrestore(flags);
+}
+
+uint32_t page_frag_index(const page_stats_t *stats, uint32_t order) {
+    if (!stats->free_pages) {
+        return 0;
+    }
+    uint64_t usable = 0;  // Free pages in blocks of at least 'order'
+    for (uint32_t o = order; o <= PAGE_MAX_ORDER; ++o) {
+        usable += (uint64_t)stats->free_blocks[o] << o;
+    }
+    return (uint32_t)(100 - (usable * 100) / stats->free_pages);
+}
+
+void page_alloc_dump_stats(void) {
+    page_stats_t stats;
+    page_alloc_get_stats(&stats);
+
+    uart_puts("Pages: ");
+    print_uint(stats.free_pages);
+    uart_puts(" free of ");
+    print_uint(stats.total_pages);
+    uart_puts("\n  order: free blocks (unusable free %)\n");
+    for (uint32_t order = 0; order <= PAGE_MAX_ORDER; ++order) {
+        uart_puts("  ");
+        print_uint(order);
+        uart_puts(": ");
+        print_uint(stats.free_blocks[order]);
+        uart_puts(" (");
+        print_uint(page_frag_index(&stats, order));
+        uart_puts("%)\n");
+    }
+}
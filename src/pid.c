@@ -0,0 +1,107 @@
+#include "pid.h"
+
+#include <stddef.h>
+
+#include "common_macros.h"
+#include "page_alloc.h"
+#include "spinlock.h"
+
+// Slots live in page-sized chunks allocated as the table grows, so an idle
+// system pays for one chunk, not PID_MAX_SLOTS slots.
+typedef struct {
+    struct tcb *task;   // NULL while free
+    uint32_t gen;       // Generation of the PID currently (or next) issued
+    uint32_t next_free; // Next slot on the free list while free
+} pid_slot_t;
+
+#define PID_SLOTS_PER_CHUNK (PAGE_SIZE / sizeof(pid_slot_t))
+#define PID_MAX_CHUNKS (PID_MAX_SLOTS / PID_SLOTS_PER_CHUNK)
+#define PID_NO_SLOT 0xFFFFFFFFU
+
+static spinlock_t pid_lock = SPINLOCK_INIT;
+static pid_slot_t *pid_chunks[PID_MAX_CHUNKS];
+static uint32_t pid_free_head;   // LIFO free list of released slots
+static uint32_t pid_next_unused; // Slots below this have been handed out
+
+static pid_slot_t *pid_slot(uint32_t index) {
+    pid_slot_t *chunk = pid_chunks[index / PID_SLOTS_PER_CHUNK];
+    return chunk ? &chunk[index % PID_SLOTS_PER_CHUNK] : NULL;
+}
+
+void pid_init(void) {
+    spin_lock_init(&pid_lock);
+    for (uint32_t i = 0; i < PID_MAX_CHUNKS; ++i) {
+        pid_chunks[i] = NULL;
+    }
+    pid_free_head = PID_NO_SLOT;
+    pid_next_unused = 0;
+}
+
+int32_t pid_alloc(struct tcb *task) {
+    uint64_t flags = spin_lock_irqsave(&pid_lock);
+
+    uint32_t index = pid_free_head;
+    pid_slot_t *slot;
+    if (index != PID_NO_SLOT) {
+        slot = pid_slot(index);
+        pid_free_head = slot->next_free;
+    } else {
+        // Free list empty: take a never-used slot, adding a chunk if needed.
+        index = pid_next_unused;
+        if (index >= PID_MAX_SLOTS) {
+            spin_unlock_irqrestore(&pid_lock, flags);
+            return -1;
+        }
+        uint32_t chunk = index / PID_SLOTS_PER_CHUNK;
+        if (!pid_chunks[chunk]) {
+            pid_slot_t *slots = page_alloc(0);
+            if (!slots) {
+                spin_unlock_irqrestore(&pid_lock, flags);
+                return -1;
+            }
+            for (uint32_t i = 0; i < PID_SLOTS_PER_CHUNK; ++i) {
+                slots[i].task = NULL;
+                slots[i].gen = 0;
+                slots[i].next_free = PID_NO_SLOT;
+            }
+            pid_chunks[chunk] = slots;
+        }
+        pid_next_unused++;
+        slot = pid_slot(index);
+    }
+
+    slot->task = task;
+    uint32_t pid = (slot->gen << PID_INDEX_BITS) | index;
+
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return (int32_t)pid;
+}
+
+void pid_free(uint32_t pid) {
+    uint32_t index = PID_INDEX(pid);
+    uint64_t flags = spin_lock_irqsave(&pid_lock);
+
+    pid_slot_t *slot = index < pid_next_unused ? pid_slot(index) : NULL;
+    if (slot && slot->task && slot->gen == PID_GEN(pid)) {
+        slot->task = NULL;
+        slot->gen = (slot->gen + 1) & ((1U << PID_GEN_BITS) - 1);
+        slot->next_free = pid_free_head;
+        pid_free_head = index;
+    }
+
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+struct tcb *task_lookup(uint32_t pid) {
+    uint32_t index = PID_INDEX(pid);
+    struct tcb *task = NULL;
+    uint64_t flags = spin_lock_irqsave(&pid_lock);
+
+    pid_slot_t *slot = index < pid_next_unused ? pid_slot(index) : NULL;
+    if (slot && slot->gen == PID_GEN(pid)) {
+        task = slot->task;
+    }
+
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return task;
+}
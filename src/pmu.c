@@ -0,0 +1,46 @@
+#include "pmu.h"
+
+#define PMCR_E (1UL << 0)  // Enable all counters
+#define PMCR_N_SHIFT 11
+#define PMCR_N_MASK 0x1F
+
+uint32_t pmu_num_counters(void) {
+    uint64_t pmcr;
+    __asm__ __volatile__("mrs %0, pmcr_el0" : "=r"(pmcr));
+    return (uint32_t)((pmcr >> PMCR_N_SHIFT) & PMCR_N_MASK);
+}
+
+int pmu_event_supported(uint32_t event) {
+    uint64_t ceid;
+    if (event < 32) {
+        __asm__ __volatile__("mrs %0, pmceid0_el0" : "=r"(ceid));
+    } else if (event < 64) {
+        __asm__ __volatile__("mrs %0, pmceid1_el0" : "=r"(ceid));
+    } else {
+        return 0;
+    }
+    return (int)((ceid >> (event % 32)) & 1);
+}
+
+void pmu_counter_start(uint32_t idx, uint32_t event) {
+    uint64_t pmcr;
+    __asm__ __volatile__("mrs %0, pmcr_el0" : "=r"(pmcr));
+    __asm__ __volatile__("msr pmcr_el0, %0" ::"r"(pmcr | PMCR_E));
+    __asm__ __volatile__("msr pmselr_el0, %0\nisb" ::"r"((uint64_t)idx));
+    __asm__ __volatile__("msr pmxevtyper_el0, %0" ::"r"((uint64_t)event));
+    __asm__ __volatile__("msr pmxevcntr_el0, xzr");
+    __asm__ __volatile__("msr pmcntenset_el0, %0\nisb" ::"r"(1UL << idx)
+                         : "memory");
+}
+
+void pmu_counter_stop(uint32_t idx) {
+    __asm__ __volatile__("msr pmcntenclr_el0, %0\nisb" ::"r"(1UL << idx)
+                         : "memory");
+}
+
+uint64_t pmu_counter_read(uint32_t idx) {
+    uint64_t val;
+    __asm__ __volatile__("msr pmselr_el0, %0\nisb" ::"r"((uint64_t)idx));
+    __asm__ __volatile__("mrs %0, pmxevcntr_el0" : "=r"(val)::"memory");
+    return val;
+}
@@ -0,0 +1,158 @@
+#include "slab.h"
+
+#include <stddef.h>
+
+#include "page_alloc.h"
+#include "uart.h"
+
+// Aim for at least this many objects per slab so the header and the tail
+// left over are a small fraction of it.
+#define SLAB_MIN_OBJECTS 8
+
+static uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+void kmem_cache_init(kmem_cache_t *cache, const char *name, uint32_t size,
+                     uint32_t align) {
+    if (align < sizeof(void *)) {
+        align = sizeof(void *);
+    }
+    cache->name = name;
+    spin_lock_init(&cache->lock);
+    cache->obj_size = align_up(size, align);
+    cache->obj_offset = align_up(sizeof(slab_t), align);
+    cache->order = page_order_for(cache->obj_offset +
+                                  SLAB_MIN_OBJECTS * (uint64_t)cache->obj_size);
+    cache->objs_per_slab =
+        (uint32_t)(((PAGE_SIZE << cache->order) - cache->obj_offset) /
+                   cache->obj_size);
+    cache->partial = NULL;
+    cache->nr_slabs = 0;
+    cache->nr_active = 0;
+}
+
+// Allocate and carve up a new slab. Caller holds cache->lock.
+static slab_t *slab_grow(kmem_cache_t *cache) {
+    slab_t *slab = page_alloc(cache->order);
+    if (!slab) {
+        return NULL;
+    }
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free = NULL;
+
+    // Tag every page so kfree() can find the cache from any object address.
+    for (uint64_t i = 0; i < (1UL << cache->order); ++i) {
+        page_t *page = virt_to_page((uint8_t *)slab + i * PAGE_SIZE);
+        page->slab_cache = cache;
+        page->flags |= PAGE_SLAB;
+    }
+
+    // Chain the objects so they are handed out in address order.
+    uint8_t *base = (uint8_t *)slab + cache->obj_offset;
+    for (uint32_t i = cache->objs_per_slab; i-- > 0;) {
+        void **obj = (void **)(base + i * cache->obj_size);
+        *obj = slab->free;
+        slab->free = obj;
+    }
+
+    slab->next = cache->partial;
+    slab->on_partial = 1;
+    cache->partial = slab;
+    cache->nr_slabs++;
+    return slab;
+}
+
+// Take one object off the first partial slab, growing the cache if there is
+// none. Caller holds cache->lock.
+static void *slab_alloc_locked(kmem_cache_t *cache) {
+    slab_t *slab = cache->partial;
+    if (!slab) {
+        slab = slab_grow(cache);
+        if (!slab) {
+            return NULL;
+        }
+    }
+
+    void **obj = slab->free;
+    slab->free = *obj;
+    slab->inuse++;
+    cache->nr_active++;
+    if (!slab->free) {
+        // Full: off the partial list until an object comes back.
+        cache->partial = slab->next;
+        slab->next = NULL;
+        slab->on_partial = 0;
+    }
+    return obj;
+}
+
+// Caller holds cache->lock.
+static void slab_free_locked(kmem_cache_t *cache, void *obj) {
+    slab_t *slab =
+        (slab_t *)((uint64_t)obj & ~((PAGE_SIZE << cache->order) - 1));
+
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    slab->inuse--;
+    cache->nr_active--;
+    if (!slab->on_partial) {
+        slab->next = cache->partial;
+        slab->on_partial = 1;
+        cache->partial = slab;
+    }
+    // Empty slabs are kept for reuse: TCB churn then never touches the page
+    // allocator once the cache has grown to the peak task count.
+}
+
+static void slab_oom(kmem_cache_t *cache) {
+    uart_puts("Error: Out of memory for slab cache ");
+    uart_puts(cache->name);
+    uart_puts("\n");
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    void *obj = slab_alloc_locked(cache);
+    spin_unlock_irqrestore(&cache->lock, flags);
+    if (!obj) {
+        slab_oom(cache);
+    }
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!obj) {
+        return;
+    }
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    slab_free_locked(cache, obj);
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+uint32_t kmem_cache_alloc_bulk(kmem_cache_t *cache, void **objs,
+                               uint32_t count) {
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    uint32_t done = 0;
+    while (done < count) {
+        void *obj = slab_alloc_locked(cache);
+        if (!obj) {
+            break;
+        }
+        objs[done++] = obj;
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+    if (done == 0 && count != 0) {
+        slab_oom(cache);
+    }
+    return done;
+}
+
+void kmem_cache_free_bulk(kmem_cache_t *cache, void **objs, uint32_t count) {
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    for (uint32_t i = 0; i < count; ++i) {
+        slab_free_locked(cache, objs[i]);
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
@@ -0,0 +1,150 @@
+#include "smp.h"
+
+#include <stddef.h>
+
+#include "exceptions.h"
+#include "fpsimd.h"
+#include "gic.h"
+#include "kernel.h"  // For enable_interrupts
+#include "mmu.h"
+#include "timer.h"
+#include "uart.h"
+
+// PSCI 0.2+ function IDs (SMC64/HVC64 calling convention)
+#define PSCI_CPU_ON_64 0xC4000003
+#define PSCI_AFFINITY_INFO_64 0xC4000004
+#define PSCI_SUCCESS 0
+#define PSCI_ALREADY_ON (-4)
+
+cpu_t cpus[MAX_CPUS];
+uint32_t smp_num_cpus = 1;
+
+// Boot stacks for the secondary cores (the boot CPU uses the stack in boot.s).
+static uint8_t cpu_boot_stacks[MAX_CPUS][CPU_BOOT_STACK_SIZE]
+    __attribute__((aligned(16)));
+
+// Entry stacks for growing task stacks (see kstack.c).
+static uint8_t cpu_fault_stacks[MAX_CPUS][CPU_FAULT_STACK_SIZE]
+    __attribute__((aligned(16)));
+
+_Static_assert(offsetof(cpu_t, boot_stack_top) == 0,
+               "boot.s expects boot_stack_top at offset 0 of cpu_t");
+_Static_assert(offsetof(cpu_t, stack_limit) == 8 &&
+                   offsetof(cpu_t, fault_stack_top) == 16 &&
+                   offsetof(cpu_t, entry_scratch) == 24,
+               "vectors.s expects the stack check fields at offsets 8-24");
+
+extern char _secondary_entry[];  // In boot.s
+
+static void cpu_struct_init(cpu_t *cpu, uint32_t id) {
+    uint8_t *p = (uint8_t *)cpu;
+    for (uint64_t i = 0; i < sizeof(cpu_t); ++i) {
+        p[i] = 0;  // BSS is not cleared by boot.s, so start from scratch
+    }
+    cpu->id = id;
+    cpu->mpidr = id;  // QEMU virt: Aff0 is the core number for <= 8 cores
+    cpu->boot_stack_top = (uint64_t)&cpu_boot_stacks[id][CPU_BOOT_STACK_SIZE];
+    cpu->fault_stack_top =
+        (uint64_t)&cpu_fault_stacks[id][CPU_FAULT_STACK_SIZE];
+    spin_lock_init(&cpu->rq.lock);
+    spin_lock_init(&cpu->timer_lock);
+}
+
+// Set up the boot CPU's per-CPU area. Must run before anything touches
+// this_cpu(), i.e. before task_init_system().
+void smp_init_boot_cpu(void) {
+    for (uint32_t i = 0; i < MAX_CPUS; ++i) {
+        cpu_struct_init(&cpus[i], i);
+    }
+    uint64_t mpidr;
+    __asm__ __volatile__("mrs %0, mpidr_el1" : "=r"(mpidr));
+    cpus[0].mpidr = mpidr & 0xFFFFFF;
+    cpus[0].online = 1;
+    __asm__ __volatile__("msr tpidr_el1, %0" ::"r"(&cpus[0]) : "memory");
+    smp_num_cpus = 1;
+}
+
+// Start every secondary core QEMU gives us (-smp N) through PSCI CPU_ON.
+// Each core gets its own idle task before it is started; the first core
+// PSCI does not know about marks the end of the CPU list.
+void smp_boot_secondaries(void (*idle_entry)(void *arg)) {
+    for (uint32_t id = 1; id < MAX_CPUS; ++id) {
+        cpu_t *cpu = &cpus[id];
+
+        // AFFINITY_INFO fails with INVALID_PARAMETERS for a missing core.
+        if (psci_call(PSCI_AFFINITY_INFO_64, cpu->mpidr, 0, 0) < 0) {
+            break;
+        }
+
+        if (!task_create_idle(idle_entry, id)) {
+            uart_puts("SMP: Failed to create idle task for CPU ");
+            print_uint(id);
+            uart_puts("\n");
+            break;
+        }
+
+        // The core starts with its MMU and caches off and reads its cpu_t
+        // straight from memory.
+        dcache_clean_range(cpu, sizeof(cpu_t));
+
+        int64_t ret = psci_call(PSCI_CPU_ON_64, cpu->mpidr,
+                                (uint64_t)_secondary_entry, (uint64_t)cpu);
+        if (ret != PSCI_SUCCESS && ret != PSCI_ALREADY_ON) {
+            uart_puts("SMP: PSCI CPU_ON failed for CPU ");
+            print_uint(id);
+            uart_puts("\n");
+            break;
+        }
+
+        while (!cpu->online) {
+            cpu_relax();
+        }
+        smp_num_cpus++;
+    }
+
+    uart_puts("SMP: ");
+    print_uint(smp_num_cpus);
+    uart_puts(" CPU(s) online.\n");
+}
+
+// C entry point for secondary cores, called from _secondary_entry with the
+// stack and TPIDR_EL1 already set up.
+void secondary_main(cpu_t *cpu) {
+    mmu_enable_secondary();  // Before touching any shared data
+    exceptions_init();
+    fpsimd_cpu_init();
+    gic_cpu_init();
+    timer_init_secondary();
+
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+    enable_interrupts();
+
+    // Like kernel_main, this boot context is abandoned by the first schedule.
+    while (1) {
+        __asm__ __volatile__("wfi");
+    }
+}
+
+void smp_send_reschedule(uint32_t cpu_id) {
+    if (cpu_id == this_cpu()->id) {
+        this_cpu()->need_resched = 1;
+        return;
+    }
+    gic_send_sgi(INTERRUPT_ID_IPI_RESCHEDULE, (uint8_t)(1U << cpu_id));
+}
+
+// Wake one idle core (if any) so it can steal newly queued work.
+void smp_kick_idle_cpu(void) {
+    uint32_t self = this_cpu()->id;
+    for (uint32_t id = 0; id < smp_num_cpus; ++id) {
+        cpu_t *cpu = &cpus[id];
+        if (id == self || !cpu->online) {
+            continue;
+        }
+        tcb_t *running = __atomic_load_n(&cpu->curr_task, __ATOMIC_RELAXED);
+        if (running == NULL || running == cpu->idle_task) {
+            smp_send_reschedule(id);
+            return;
+        }
+    }
+}
@@ -0,0 +1,244 @@
+// filepath: src/string.s
+// Freestanding memset/memcpy/memmove/memcmp (see string.h).
+//
+// Wide accesses use general-purpose ldp/stp only, 64 bytes per loop
+// iteration: kernel code must not touch the FP/SIMD registers, which hold
+// whichever task's state was loaded last (see fpsimd.c).
+//
+// Stores are always aligned (the destination is aligned to 16 first), so
+// memset() also works with the MMU off, where all memory is Device.
+// memcpy() and memmove() may load from unaligned addresses and need the
+// MMU on.
+//
+// AAPCS64: x0 = dst (returned unchanged), x1 = value/src, x2 = count.
+
+.global memset
+.global memcpy
+.global memmove
+.global memcmp
+.global string_init
+
+.data
+.balign 8
+// DC ZVA block size in bytes, 0 until string_init() (DC ZVA faults on
+// Device memory, i.e. before the MMU is on) or if DCZID_EL0 prohibits it.
+zva_block_size:
+    .quad 0
+
+.text
+
+// void string_init(void)
+string_init:
+    mrs x0, dczid_el0
+    tbnz x0, #4, 1f             // DZP: DC ZVA prohibited
+    and x0, x0, #0xf            // BS: log2 of the block size in words
+    mov x1, #4
+    lsl x1, x1, x0
+    adrp x2, zva_block_size
+    str x1, [x2, :lo12:zva_block_size]
+1:  ret
+
+// void *memset(void *dst, int c, size_t n)
+memset:
+    mov x3, x0                  // Cursor
+    and x1, x1, #0xff
+    mov x4, #0x0101010101010101
+    mul x1, x1, x4              // Byte replicated to all 8 lanes
+    cmp x2, #16
+    b.lo .Lset_bytes
+
+.Lset_align:                    // Head: bytes up to a 16-byte boundary
+    tst x3, #15
+    b.eq .Lset_aligned
+    strb w1, [x3], #1
+    sub x2, x2, #1
+    b .Lset_align
+
+.Lset_aligned:
+    // Zeroing at least two DC ZVA blocks: stp up to a block boundary, then
+    // clear whole blocks without reading them into the cache.
+    cbnz x1, .Lset_64
+    adrp x5, zva_block_size
+    ldr x5, [x5, :lo12:zva_block_size]
+    cbz x5, .Lset_64
+    cmp x2, x5, lsl #1
+    b.lo .Lset_64
+    sub x6, x5, #1
+.Lset_zva_align:
+    tst x3, x6
+    b.eq .Lset_zva
+    stp xzr, xzr, [x3], #16
+    sub x2, x2, #16
+    b .Lset_zva_align
+.Lset_zva:
+    dc zva, x3
+    add x3, x3, x5
+    sub x2, x2, x5
+    cmp x2, x5
+    b.hs .Lset_zva
+
+.Lset_64:
+    cmp x2, #64
+    b.lo .Lset_16
+1:  stp x1, x1, [x3]
+    stp x1, x1, [x3, #16]
+    stp x1, x1, [x3, #32]
+    stp x1, x1, [x3, #48]
+    add x3, x3, #64
+    sub x2, x2, #64
+    cmp x2, #64
+    b.hs 1b
+.Lset_16:
+    cmp x2, #16
+    b.lo .Lset_tail
+    stp x1, x1, [x3], #16
+    sub x2, x2, #16
+    b .Lset_16
+
+.Lset_tail:                     // < 16 bytes left, cursor 16-byte aligned
+    tbz x2, #3, 1f
+    str x1, [x3], #8
+1:  tbz x2, #2, 2f
+    str w1, [x3], #4
+2:  tbz x2, #1, 3f
+    strh w1, [x3], #2
+3:  tbz x2, #0, 4f
+    strb w1, [x3]
+4:  ret
+
+.Lset_bytes:                    // Short fills: no alignment to rely on
+    cbz x2, 1f
+    strb w1, [x3], #1
+    sub x2, x2, #1
+    b .Lset_bytes
+1:  ret
+
+// void *memcpy(void *dst, const void *src, size_t n)
+// Forward copy; also what memmove() uses when that is safe.
+memcpy:
+    mov x3, x0
+    cmp x2, #16
+    b.lo .Lcpy_bytes
+
+.Lcpy_align:                    // Align the stores; loads may stay unaligned
+    tst x3, #15
+    b.eq .Lcpy_64
+    ldrb w4, [x1], #1
+    strb w4, [x3], #1
+    sub x2, x2, #1
+    b .Lcpy_align
+
+.Lcpy_64:
+    cmp x2, #64
+    b.lo .Lcpy_16
+1:  ldp x4, x5, [x1]
+    ldp x6, x7, [x1, #16]
+    ldp x8, x9, [x1, #32]
+    ldp x10, x11, [x1, #48]
+    add x1, x1, #64
+    stp x4, x5, [x3]
+    stp x6, x7, [x3, #16]
+    stp x8, x9, [x3, #32]
+    stp x10, x11, [x3, #48]
+    add x3, x3, #64
+    sub x2, x2, #64
+    cmp x2, #64
+    b.hs 1b
+.Lcpy_16:
+    cmp x2, #16
+    b.lo .Lcpy_tail
+    ldp x4, x5, [x1], #16
+    stp x4, x5, [x3], #16
+    sub x2, x2, #16
+    b .Lcpy_16
+
+.Lcpy_tail:                     // < 16 bytes left, dst 16-byte aligned
+    tbz x2, #3, 1f
+    ldr x4, [x1], #8
+    str x4, [x3], #8
+1:  tbz x2, #2, 2f
+    ldr w4, [x1], #4
+    str w4, [x3], #4
+2:  tbz x2, #1, 3f
+    ldrh w4, [x1], #2
+    strh w4, [x3], #2
+3:  tbz x2, #0, 4f
+    ldrb w4, [x1]
+    strb w4, [x3]
+4:  ret
+
+.Lcpy_bytes:
+    cbz x2, 1f
+    ldrb w4, [x1], #1
+    strb w4, [x3], #1
+    sub x2, x2, #1
+    b .Lcpy_bytes
+1:  ret
+
+// void *memmove(void *dst, const void *src, size_t n)
+// A forward copy is safe unless dst lies inside [src, src + n); each
+// 64-byte block is loaded in full before it is stored, so overlap within a
+// block is fine either way. Otherwise copy backwards from the end.
+memmove:
+    sub x4, x0, x1
+    cmp x4, x2
+    b.hs memcpy                 // dst < src, or no overlap (unsigned)
+    add x1, x1, x2              // One past the end of each buffer
+    add x3, x0, x2
+    cmp x2, #16
+    b.lo .Lmove_bytes
+
+.Lmove_align:
+    tst x3, #15
+    b.eq .Lmove_64
+    ldrb w4, [x1, #-1]!
+    strb w4, [x3, #-1]!
+    sub x2, x2, #1
+    b .Lmove_align
+
+.Lmove_64:
+    cmp x2, #64
+    b.lo .Lmove_16
+1:  ldp x4, x5, [x1, #-16]
+    ldp x6, x7, [x1, #-32]
+    ldp x8, x9, [x1, #-48]
+    ldp x10, x11, [x1, #-64]!
+    stp x4, x5, [x3, #-16]
+    stp x6, x7, [x3, #-32]
+    stp x8, x9, [x3, #-48]
+    stp x10, x11, [x3, #-64]!
+    sub x2, x2, #64
+    cmp x2, #64
+    b.hs 1b
+.Lmove_16:
+    cmp x2, #16
+    b.lo .Lmove_bytes
+    ldp x4, x5, [x1, #-16]!
+    stp x4, x5, [x3, #-16]!
+    sub x2, x2, #16
+    b .Lmove_16
+
+.Lmove_bytes:
+    cbz x2, 1f
+    ldrb w4, [x1, #-1]!
+    strb w4, [x3, #-1]!
+    sub x2, x2, #1
+    b .Lmove_bytes
+1:  ret
+
+// int memcmp(const void *a, const void *b, size_t n)
+// Only here because the compiler may emit calls to it; nothing hot uses it.
+memcmp:
+    cbz x2, 2f
+1:  ldrb w3, [x0], #1
+    ldrb w4, [x1], #1
+    subs w3, w3, w4
+    b.ne 3f
+    subs x2, x2, #1
+    b.ne 1b
+2:  mov w0, #0
+    ret
+3:  mov w0, w3
+    ret
+
+.end
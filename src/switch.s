@@ -0,0 +1,52 @@
+// filepath: src/switch.s
+// Cooperative task switch. Every switch between tasks, voluntary or
+// preemptive, ends up here from schedule(): a preempted task's full
+// exception frame simply stays on its own stack below the schedule() call,
+// and is unwound by the vector code once the task is switched back in.
+
+// Offset of cpu_context in tcb_t, checked by a _Static_assert in task.c.
+.equ TCB_CPU_CONTEXT, 0
+
+.global cpu_switch_to
+.global ret_from_fork
+
+// void cpu_switch_to(tcb_t *prev, tcb_t *next)
+// Saves the callee-saved registers x19-x29, lr, sp and tpidr_el0 of the
+// caller into prev->cpu_context (skipped if prev is NULL, i.e. the boot
+// context that is abandoned on the first switch), loads next's, and returns
+// into next. Called with IRQs masked.
+cpu_switch_to:
+    cbz x0, 1f
+    add x8, x0, #TCB_CPU_CONTEXT
+    stp x19, x20, [x8, #16*0]
+    stp x21, x22, [x8, #16*1]
+    stp x23, x24, [x8, #16*2]
+    stp x25, x26, [x8, #16*3]
+    stp x27, x28, [x8, #16*4]
+    stp x29, x30, [x8, #16*5]
+    mov x9, sp
+    mrs x10, tpidr_el0
+    stp x9, x10, [x8, #16*6]
+1:
+    add x8, x1, #TCB_CPU_CONTEXT
+    ldp x19, x20, [x8, #16*0]
+    ldp x21, x22, [x8, #16*1]
+    ldp x23, x24, [x8, #16*2]
+    ldp x25, x26, [x8, #16*3]
+    ldp x27, x28, [x8, #16*4]
+    ldp x29, x30, [x8, #16*5]
+    ldp x9, x10, [x8, #16*6]
+    mov sp, x9
+    msr tpidr_el0, x10
+    ret
+
+// First return of a new task out of cpu_switch_to(). task_setup() leaves
+// the entry point in x20 and its argument in x19.
+ret_from_fork:
+    bl finish_task_switch
+    msr daifclr, #2         // Tasks start with IRQs enabled
+    mov x0, x19
+    blr x20
+    bl task_exit            // The entry point returned
+2:
+    b 2b
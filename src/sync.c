@@ -0,0 +1,78 @@
+#include "sync.h"
+
+#include "spinlock.h"
+#include "task.h"
+#include "wait.h"
+
+void mutex_init(mutex_t *m) {
+    m->state = 0;
+    wait_queue_init(&m->waiters);
+}
+
+int mutex_trylock(mutex_t *m) {
+    uint32_t expected = 0;
+    return __atomic_compare_exchange_n(&m->state, &expected, 1, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_lock(mutex_t *m) {
+    if (mutex_trylock(m)) {
+        return;  // Fast path
+    }
+    // Mark the mutex contended whenever we take it from here on: we cannot
+    // tell whether other waiters remain, so the unlock must check.
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        wait_event(&m->waiters,
+                   __atomic_load_n(&m->state, __ATOMIC_RELAXED) != 2);
+    }
+}
+
+void mutex_unlock(mutex_t *m) {
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2) {
+        wake_up_one(&m->waiters);
+    }
+}
+
+void sem_init(semaphore_t *sem, int64_t count) {
+    sem->count = count;
+    wait_queue_init(&sem->waiters);
+}
+
+int sem_trydown(semaphore_t *sem) {
+    int64_t count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+    while (count > 0) {
+        if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void sem_down(semaphore_t *sem) {
+    wait_event(&sem->waiters, sem_trydown(sem));
+}
+
+void sem_up(semaphore_t *sem) {
+    __atomic_fetch_add(&sem->count, 1, __ATOMIC_RELEASE);
+    wake_up_one(&sem->waiters);
+}
+
+void cond_init(condvar_t *cv) { wait_queue_init(&cv->waiters); }
+
+void cond_wait(condvar_t *cv, mutex_t *m) {
+    // Queued before the mutex is released, so a signal sent by whoever
+    // takes it next cannot be missed.
+    wait_entry_t entry = {0};
+    uint64_t flags = local_irq_save();
+    prepare_to_wait(&cv->waiters, &entry);
+    mutex_unlock(m);
+    task_block();
+    finish_wait(&cv->waiters, &entry);
+    local_irq_restore(flags);
+    mutex_lock(m);
+}
+
+void cond_signal(condvar_t *cv) { wake_up_one(&cv->waiters); }
+
+void cond_broadcast(condvar_t *cv) { wake_up_all(&cv->waiters); }
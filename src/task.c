@@ -1,339 +1,523 @@
 #include "task.h"
 
+#include <stddef.h>
+
 #include "common_macros.h"
-#include "exceptions.h"  // For context_state_t to know its size/layout for stack setup
+#include "fpsimd.h"
 #include "kernel.h"  // For disable_interrupts/enable_interrupts if needed for critical sections
-#include "string.h"  // For simple_memset or a real memset
-#include "uart.h"
-
-// Define global task management variables from task.h
-tcb_t task_table[MAX_TASKS];
-tcb_t *current_task = NULL;
-uint32_t next_pid = 0;
-tcb_t *ready_queue_head = NULL;
-tcb_t *idle_task_tcb = NULL;
-
-// Statically allocated stacks for simplicity
-static uint8_t task_stacks[MAX_TASKS][TASK_STACK_SIZE]
-    __attribute__((aligned(16)));
-// static uint32_t next_stack_idx = 0; // This is now managed by
-// task_stacks_status
-uint8_t
-    task_stacks_status[MAX_TASKS];  // 0 for free, 1 for used. Define it here.
-
-// A simple memset (if not available from a standard library equivalent)
-void simple_memset(void *ptr, int value, uint64_t num) {
-    unsigned char *p = ptr;
-    while (num--) {
-        *p++ = (unsigned char)value;
-    }
-}
+#include "kprintf.h"
+#include "kstack.h"
+#include "mmu.h"
+#include "pid.h"
+#include "slab.h"    // TCB cache
+#include "smp.h"     // Per-CPU current task, idle task and run queue
+#include "string.h"
+#include "timer.h"   // Dynamic tick
+#include "trace.h"
+
+static kmem_cache_t tcb_cache;
+
+#define PRIO_BIT(prio) (0x80000000U >> (prio))
+
+_Static_assert(offsetof(tcb_t, cpu_context) == 0,
+               "switch.s expects cpu_context at TCB_CPU_CONTEXT (0) of tcb_t");
+
+extern char ret_from_fork[];  // In switch.s
 
 void task_init_system(void) {
-    uart_puts("Initializing Tasking System...\n");
-    simple_memset(task_table, 0, sizeof(task_table));  // Zero out the TCB table
-
-    for (int i = 0; i < MAX_TASKS; ++i) {
-        task_table[i].state = TASK_UNUSED;
-        task_table[i].pid = (uint32_t)-1;  // Indicate invalid/unused PID
-        task_table[i].stack_base = NULL;   // Will be assigned in task_create
-        task_table[i].stack_size = TASK_STACK_SIZE;
-        task_table[i].next_in_queue = NULL;
-        task_table[i].page_table_base = NULL;  // Initialize placeholder
-    }
-    current_task = NULL;  // No task is running initially
-    ready_queue_head = NULL;
-    next_pid = 0;
-    // next_stack_idx = 0; // Not needed if using task_stacks_status
-    simple_memset(task_stacks_status, 0,
-                  sizeof(task_stacks_status));  // Initialize all stacks as free
+    kmem_cache_init(&tcb_cache, "tcb", sizeof(tcb_t), _Alignof(tcb_t));
+    pid_init();
+    // Per-CPU run queues and current/idle tasks are reset by
+    // smp_init_boot_cpu(); no task is running initially.
 
     // The kernel itself runs in an implicit "task 0" context before scheduling
     // starts. We might create an explicit "idle" task later.
-    uart_puts("Tasking System Initialized.\n");
 }
 
-// Function to allocate a stack from the static pool
-// Returns stack index on success, -1 on failure.
-static int allocate_static_stack(void) {  // Changed return type to int
-    for (int i = 0; i < MAX_TASKS; ++i) {
-        if (task_stacks_status[i] == 0) {
-            task_stacks_status[i] = 1;  // Mark as used
-            uart_puts("Allocated stack at index: ");
-            print_uint(i);
-            uart_puts("\n");
-            return i;  // Return the index
-        }
+// Allocate a TCB and a stack of at least 'stack_size' bytes (0 for the
+// default) and prepare the task's first switch-in. The task is not placed
+// on any run queue. Returns NULL on failure.
+static tcb_t *task_setup(void (*entry_point)(void *arg), void *arg,
+                         uint8_t priority, uint32_t stack_size) {
+    if (priority >= NUM_PRIORITY_LEVELS) {
+        pr_err("Error: Invalid task priority %u!\n", priority);
+        return NULL;
+    }
+
+    tcb_t *new_tcb = kmem_cache_alloc(&tcb_cache);
+    if (!new_tcb) {
+        pr_err("Error: No free TCBs available!\n");
+        return NULL;  // No free TCBs
     }
-    uart_puts("Error: No more static stacks available!\n");
-    return -1;  // No stack available
+    memset(new_tcb, 0, sizeof(tcb_t));
+
+    if (kstack_alloc(&new_tcb->stack,
+                     stack_size ? stack_size : TASK_STACK_SIZE) < 0) {
+        kmem_cache_free(&tcb_cache, new_tcb);
+        pr_err("Error: Failed to allocate stack for new task!\n");
+        return NULL;
+    }
+
+    // Initialize the TCB
+    int32_t pid = pid_alloc(new_tcb);
+    if (pid < 0) {
+        kstack_free(&new_tcb->stack);
+        kmem_cache_free(&tcb_cache, new_tcb);
+        pr_err("Error: No free PIDs available!\n");
+        return NULL;
+    }
+    new_tcb->pid = (uint32_t)pid;
+    new_tcb->state = TASK_READY;
+    new_tcb->priority = priority;
+    new_tcb->cpu = 0;
+    new_tcb->on_cpu = 0;
+    fpsimd_task_init(new_tcb);
+    new_tcb->next_in_queue = NULL;
+    new_tcb->entry_point = entry_point;
+    new_tcb->arg = arg;
+
+    // Set up the first cpu_switch_to() into the task: it "returns" into
+    // ret_from_fork (switch.s) on an empty stack, which enables IRQs and
+    // calls entry_point(arg). No exception frame is needed until the task
+    // is first interrupted.
+    uint64_t stack_top = kstack_top(&new_tcb->stack);  // Page aligned
+    new_tcb->cpu_context.x19 = (uint64_t)arg;
+    new_tcb->cpu_context.x20 = (uint64_t)entry_point;
+    new_tcb->cpu_context.lr = (uint64_t)ret_from_fork;
+    new_tcb->cpu_context.sp = stack_top;
+
+    pr_debug("Task created: PID %u, Prio: %u, Entry: %p, Stack Base: 0x%lx, "
+             "Stack Size: %u, Initial SP: 0x%lx, Arg: %p\n",
+             new_tcb->pid, new_tcb->priority, (void *)entry_point,
+             new_tcb->stack.base, new_tcb->stack.size,
+             new_tcb->cpu_context.sp, arg);
+
+    return new_tcb;
 }
 
 // Create a new task
 // entry_point: function pointer for the task to start execution.
 // arg: argument to be passed to the entry_point function (in x0).
 // name: a string name for the task (optional, for debugging).
+// priority: scheduling level, TASK_PRIO_HIGHEST (0) .. TASK_PRIO_LOWEST.
+// stack_size: stack to reserve in bytes (up to KSTACK_MAX_SIZE), 0 for
+// TASK_STACK_SIZE. Pages are only mapped as the stack grows into them.
 // Returns PID on success, -1 on failure.
-int task_create(void (*entry_point)(void *arg), void *arg, const char *name) {
-    // disable_interrupts(); // Protect critical sections for finding TCB and
-    // stack
-
-    tcb_t *new_tcb = NULL;
-    int i;
-    for (i = 0; i < MAX_TASKS; ++i) {
-        if (task_table[i].state == TASK_UNUSED) {
-            new_tcb = &task_table[i];
-            break;
-        }
-    }
+int task_create(void (*entry_point)(void *arg), void *arg, const char *name,
+                uint8_t priority, uint32_t stack_size) {
+    return task_create_in(NULL, entry_point, arg, name, priority, stack_size);
+}
 
+int task_create_in(addr_space_t *as, void (*entry_point)(void *arg), void *arg,
+                   const char *name, uint8_t priority, uint32_t stack_size) {
+    (void)name;
+    tcb_t *new_tcb = task_setup(entry_point, arg, priority, stack_size);
     if (!new_tcb) {
-        uart_puts("Error: No free TCBs available!\n");
-        // enable_interrupts();
-        return -1;  // No free TCBs
+        return -1;
+    }
+    if (as) {
+        mmu_as_get(as);
+        new_tcb->addr_space = as;
     }
+    uint32_t pid = new_tcb->pid;  // The task may run (and exit) once queued
+    TRACE_EVENT(TRACE_TASK_STATE, pid, TASK_READY);
 
-    int stack_idx = allocate_static_stack();  // Get stack index
-    if (stack_idx < 0) {                      // Check for failure
-        uart_puts("Error: Failed to allocate stack for new task!\n");
-        new_tcb->state = TASK_UNUSED;  // Release TCB if stack allocation failed
-        // enable_interrupts();
-        return -1;
+    add_to_ready_queue(new_tcb);
+    smp_kick_idle_cpu();  // Let an idle core steal it right away
+    return (int)pid;
+}
+
+// Create the idle task for CPU 'cpu_id'. Idle tasks never sit on a run
+// queue; schedule() falls back to them when nothing else is ready.
+tcb_t *task_create_idle(void (*entry_point)(void *arg), uint32_t cpu_id) {
+    tcb_t *idle = task_setup(entry_point, NULL, TASK_PRIO_LOWEST, 0);
+    if (!idle) {
+        return NULL;
     }
-    uint8_t *stack_memory =
-        task_stacks[stack_idx];  // Get stack pointer from index
+    idle->cpu = cpu_id;
+    cpus[cpu_id].idle_task = idle;
+    return idle;
+}
 
-    // Initialize the TCB
-    new_tcb->pid =
-        next_pid++;  // Assuming PIDs are assigned sequentially and might not
-                     // match task_table index directly If PID is meant to be
-                     // the index, then new_tcb->pid = i;
-    new_tcb->state = TASK_READY;
-    new_tcb->stack_base = (uint64_t *)stack_memory;
-    new_tcb->stack_size = TASK_STACK_SIZE;
-    new_tcb->stack_idx = (uint8_t)stack_idx;  // Store the allocated stack index
-
-    // Now, set up the initial stack frame for the new task.
-    // The stack grows downwards. The "top" of the stack is at the highest
-    // address. kernel_sp will point to the "bottom" of the saved
-    // context_state_t structure (i.e., the lowest address of the context data
-    // on the stack).
-
-    // Point to the highest address of the stack memory.
-    uint64_t stack_top = (uint64_t)stack_memory + TASK_STACK_SIZE;
-
-    // Align the stack pointer to 16 bytes, context_state_t will be pushed below
-    // this. The actual SP for the task when it starts will be stack_top -
-    // sizeof(context_state_t). The context_state_t itself must be 16-byte
-    // aligned if SP must be. The `stp` and `ldp` instructions used for context
-    // saving/restoring require 16-byte alignment for SP. So, the address where
-    // context_state_t begins (new_tcb->kernel_sp) must be 16-byte aligned.
-
-    // Calculate the starting address for context_state_t on the stack
-    // Ensure it's aligned. sizeof(context_state_t) is (31 GPRs + SPSR + ELR) *
-    // 8 bytes = 33 * 8 = 264 bytes. 264 is not 16-byte aligned. The
-    // save_gprs_lr macro pushes 256 bytes, then SPSR/ELR push 16 bytes. Total
-    // context size on stack = 256 (GPRs) + 16 (SPSR/ELR) = 272 bytes. This IS
-    // 16-byte aligned.
-    uint64_t context_frame_start = (stack_top - sizeof(context_state_t)) &
-                                   ~0xFLL;  // Align down to 16 bytes
-
-    new_tcb->kernel_sp = context_frame_start;
-
-    // Get a pointer to where the context_state_t structure will live on the new
-    // task's stack.
-    context_state_t *ctx = (context_state_t *)new_tcb->kernel_sp;
-
-    // Zero out the entire context state area initially
-    simple_memset(ctx, 0, sizeof(context_state_t));
-
-    // Set up the crucial registers for the new task to start
-    ctx->elr_el1 = (uint64_t)
-        entry_point;  // Address to return to (start of the task function)
-
-    // SPSR_EL1: EL1h (using SP_EL1), No FIQ/IRQ/SError masked (0x00000000)
-    // DAIF bits: D=0, A=0, I=0, F=0. Mode EL1h = 0b0101.
-    // SPSR_EL1 = 0x0000000000000005 (for EL1h, all interrupts unmasked)
-    // Or, to start with interrupts masked: SPSR_EL1 = 0x00000000000003C5 (DAIF
-    // all set, EL1h) Let's start with interrupts enabled for EL1 tasks.
-    ctx->spsr_el1 =
-        0x0000000000000005;  // EL1h, DAIF all clear (interrupts enabled)
-
-    // Pass the argument to the task's entry function via x0
-    ctx->x0 = (uint64_t)arg;
-
-    // Other GPRs (x1-x29, lr) are already zeroed by simple_memset.
-    // lr (x30) could be set to a specific exit point if desired, but for now, 0
-    // is fine. If the task function returns, it will return to address 0, which
-    // will fault. A proper task should loop or call a task_exit() function.
-
-    uart_puts("Task created: PID ");
-    print_uint(new_tcb->pid);
-    uart_puts(", Entry: 0x");
-    print_hex((uint64_t)entry_point);
-    uart_puts(", Stack Base: 0x");
-    print_hex((uint64_t)new_tcb->stack_base);
-    uart_puts(", Initial SP (kernel_sp): 0x");
-    print_hex(new_tcb->kernel_sp);
-    uart_puts("\n");
-    uart_puts("  Initial ELR_EL1: 0x");
-    print_hex(ctx->elr_el1);
-    uart_puts(", SPSR_EL1: 0x");
-    print_hex(ctx->spsr_el1);
-    uart_puts(", X0 (arg): 0x");
-    print_hex(ctx->x0);
-    uart_puts("\n");
+// The task running on this CPU. Reads the per-CPU pointer with IRQs masked
+// so the task cannot be migrated half-way through the lookup.
+tcb_t *task_current(void) {
+    uint64_t flags = local_irq_save();
+    tcb_t *task = this_cpu()->curr_task;
+    local_irq_restore(flags);
+    return task;
+}
 
-    add_to_ready_queue(new_tcb);
+// Give up the CPU but stay runnable: switch right away instead of waiting
+// for the tick. The task goes to the tail of its level.
+void task_yield(void) {
+    uint64_t flags = local_irq_save();
+    schedule();
+    local_irq_restore(flags);
+}
 
-    // enable_interrupts(); // Restore interrupts if disabled at the start
-    return new_tcb->pid;
+int task_can_block(void) {
+    uint64_t flags = local_irq_save();
+    tcb_t *self = current_task;
+    int ret = self && self != idle_task_tcb;
+    local_irq_restore(flags);
+    return ret;
+}
+
+// Switch away from the calling task, which must already have marked itself
+// TASK_BLOCKED (with IRQs masked, or under the lock its waker takes, so the
+// wakeup cannot be missed). Returns once task_wake() has made it runnable
+// and it has been scheduled again. If the wakeup already happened,
+// task_wake() has set the task back to TASK_RUNNING and this is just a yield.
+void task_block(void) {
+    uint64_t flags = local_irq_save();
+    schedule();
+    local_irq_restore(flags);
 }
 
 void task_exit(void) {
-    if (current_task &&
-        current_task != idle_task_tcb) {  // Idle task should not exit
-        uart_puts("Task PID ");
-        print_uint(current_task->pid);
-        uart_puts(" calling task_exit(). Setting state to ZOMBIE.\n");
-        current_task->state = TASK_ZOMBIE;
-
-        // The task will now spin here. The next timer interrupt will trigger
-        // the scheduler. The scheduler will see its ZOMBIE state, clean it up,
-        // and pick another task. This task will not run again.
-        while (1) {
-            __asm__ __volatile__(
-                "wfi");  // Wait for interrupt to be descheduled
-        }
-    } else if (current_task == idle_task_tcb) {
-        uart_puts("Error: Idle task attempted to exit!\n");
+    disable_interrupts();  // Pin this task to the CPU while we look it up
+    tcb_t *self = current_task;
+    if (self && self != idle_task_tcb) {  // Idle task should not exit
+        pr_info("Task PID %u calling task_exit(). Setting state to ZOMBIE.\n",
+                self->pid);
+        self->state = TASK_ZOMBIE;
+        TRACE_EVENT(TRACE_TASK_STATE, self->pid, TASK_ZOMBIE);
+
+        // Switch away for good; the next task's finish_task_switch() then
+        // frees the TCB and stack.
+        schedule();
+        while (1);  // Not reached
+    } else if (self == idle_task_tcb) {
+        enable_interrupts();
+        pr_err("Error: Idle task attempted to exit!\n");
         // Idle task should loop forever.
     } else {
-        uart_puts(
+        enable_interrupts();
+        pr_err(
             "Error: task_exit() called with no current_task or invalid "
             "task!\n");
     }
 }
 
-// Add a task to the end of the ready queue (FIFO)
+// Append a task to the tail of its priority level in 'rq'. O(1).
+// Caller must hold rq->lock.
+static void rq_enqueue_locked(cpu_t *cpu, tcb_t *task) {
+    run_queue_t *rq = &cpu->rq;
+    ready_list_t *list = &rq->lists[task->priority];
+    task->next_in_queue = NULL;  // Ensure it's the new tail
+    task->cpu = cpu->id;
+
+    if (list->tail) {
+        list->tail->next_in_queue = task;
+    } else {
+        // Level was empty
+        list->head = task;
+        rq->bitmap |= PRIO_BIT(task->priority);
+    }
+    list->tail = task;
+    rq->nr_ready++;
+}
+
+// Take the head of the most urgent non-empty level of 'rq'. O(1).
+// Caller must hold rq->lock.
+static tcb_t *rq_dequeue_locked(run_queue_t *rq) {
+    if (!rq->bitmap) {
+        return NULL;  // No tasks ready
+    }
+
+    uint32_t prio = (uint32_t)__builtin_clz(rq->bitmap);
+    ready_list_t *list = &rq->lists[prio];
+    tcb_t *task_to_run = list->head;
+
+    list->head = task_to_run->next_in_queue;  // Dequeue
+    if (!list->head) {
+        list->tail = NULL;
+        rq->bitmap &= ~PRIO_BIT(prio);
+    }
+    rq->nr_ready--;
+
+    task_to_run->next_in_queue = NULL;  // Isolate the dequeued task
+    return task_to_run;
+}
+
+// Add a task to this CPU's run queue. O(1).
 void add_to_ready_queue(tcb_t *task) {
     if (!task) {
-        uart_puts("Error: Tried to add NULL task to ready queue.\n");
+        pr_err("Error: Tried to add NULL task to ready queue.\n");
         return;
     }
-    task->next_in_queue = NULL;  // Ensure it's the new tail
+    cpu_t *cpu;
+    uint64_t flags = local_irq_save();
+    cpu = this_cpu();
+    spin_lock(&cpu->rq.lock);
+    rq_enqueue_locked(cpu, task);
+    spin_unlock(&cpu->rq.lock);
+    local_irq_restore(flags);
+}
 
-    // uart_puts("add_to_ready_queue: Adding PID "); print_uint(task->pid);
-    // uart_puts("\n");
+// Take the most urgent ready task from this CPU's run queue. O(1).
+tcb_t *get_next_ready_task(void) {
+    uint64_t flags = local_irq_save();
+    run_queue_t *rq = &this_cpu()->rq;
+    spin_lock(&rq->lock);
+    tcb_t *task = rq_dequeue_locked(rq);
+    spin_unlock(&rq->lock);
+    local_irq_restore(flags);
+    return task;
+}
 
-    if (!ready_queue_head) {
-        // Queue was empty
-        ready_queue_head = task;
-    } else {
-        // Find the end of the queue
-        tcb_t *current = ready_queue_head;
-        while (current->next_in_queue != NULL) {
-            current = current->next_in_queue;
+// Make a BLOCKED task runnable again. Safe from IRQ context and from any
+// CPU. The task goes back on the run queue of the CPU it last ran on, and
+// that CPU is asked to reschedule if the task is more urgent than what it
+// is running.
+void task_wake(tcb_t *task) {
+    uint64_t flags = local_irq_save();
+    cpu_t *cpu;
+
+    // task->cpu only changes while the task is runnable, which a BLOCKED
+    // task is not; re-check once the lock is held.
+    while (1) {
+        cpu = &cpus[task->cpu];
+        spin_lock(&cpu->rq.lock);
+        if (cpu == &cpus[task->cpu]) {
+            break;
         }
-        current->next_in_queue = task;
+        spin_unlock(&cpu->rq.lock);
     }
+
+    if (task->state != TASK_BLOCKED) {
+        spin_unlock(&cpu->rq.lock);
+        local_irq_restore(flags);
+        return;  // Already awake, or never slept
+    }
+
+    if (cpu->curr_task == task) {
+        // Marked BLOCKED but its CPU has not switched away yet: cancel the
+        // block and let it carry on.
+        task->state = TASK_RUNNING;
+        spin_unlock(&cpu->rq.lock);
+        local_irq_restore(flags);
+        return;
+    }
+
+    task->state = TASK_READY;
+    TRACE_EVENT(TRACE_TASK_STATE, task->pid, TASK_READY);
+    rq_enqueue_locked(cpu, task);
+    tcb_t *running = cpu->curr_task;
+    int preempt = (running == NULL || running == cpu->idle_task ||
+                   task->priority < running->priority);
+    spin_unlock(&cpu->rq.lock);
+
+    if (preempt) {
+        smp_send_reschedule(cpu->id);
+    }
+    local_irq_restore(flags);
 }
 
-// Get the next task from the head of the ready queue (FIFO)
-tcb_t *get_next_ready_task(void) {
-    if (!ready_queue_head) {
-        // uart_puts("get_next_ready_task: Ready queue is empty.\n");
-        return NULL;  // No tasks ready
+static void sleep_timer_expired(hrtimer_t *timer) {
+    task_wake((tcb_t *)timer->data);
+}
+
+// Block the calling task until CNTPCT_EL0 reaches 'deadline_ticks'.
+void task_sleep_until(uint64_t deadline_ticks) {
+    if (!task_can_block()) {
+        pr_err("Error: task_sleep_until() outside a sleepable task!\n");
+        return;
     }
+    disable_interrupts();  // Pin this task to the CPU while we look it up
+    tcb_t *self = current_task;
+
+    self->state = TASK_BLOCKED;
+    TRACE_EVENT(TRACE_TASK_STATE, self->pid, TASK_BLOCKED);
+    hrtimer_init(&self->sleep_timer, sleep_timer_expired, self);
+    hrtimer_start(&self->sleep_timer, deadline_ticks);
+
+    // IRQs stay masked across the switch, so the timer cannot fire before
+    // we are off the CPU; the timer callback's task_wake() brings us back.
+    task_block();
+    enable_interrupts();
+}
 
-    tcb_t *task_to_run = ready_queue_head;
-    ready_queue_head = ready_queue_head->next_in_queue;  // Dequeue
+void task_sleep_ns(uint64_t ns) {
+    task_sleep_until(timer_read_counter() + timer_ns_to_ticks(ns));
+}
 
-    task_to_run->next_in_queue = NULL;  // Isolate the dequeued task
+// Take the most urgent task of 'victim''s run queue that may run on another
+// CPU, i.e. whose FP/SIMD registers are not still live on 'victim'. Unlike
+// rq_dequeue_locked() this may walk the lists. Caller holds victim->rq.lock.
+static tcb_t *rq_steal_locked(cpu_t *victim) {
+    run_queue_t *rq = &victim->rq;
+    uint32_t bitmap = rq->bitmap;
+    while (bitmap) {
+        uint32_t prio = (uint32_t)__builtin_clz(bitmap);
+        bitmap &= ~PRIO_BIT(prio);
+
+        ready_list_t *list = &rq->lists[prio];
+        tcb_t *prev = NULL;
+        for (tcb_t *task = list->head; task; task = task->next_in_queue) {
+            if (fpsimd_state_live_on(victim, task)) {
+                prev = task;
+                continue;
+            }
+            if (prev) {
+                prev->next_in_queue = task->next_in_queue;
+            } else {
+                list->head = task->next_in_queue;
+            }
+            if (list->tail == task) {
+                list->tail = prev;
+            }
+            if (!list->head) {
+                rq->bitmap &= ~PRIO_BIT(prio);
+            }
+            rq->nr_ready--;
+            task->next_in_queue = NULL;
+            return task;
+        }
+    }
+    return NULL;
+}
 
-    // uart_puts("get_next_ready_task: Got PID "); print_uint(task_to_run->pid);
-    // uart_puts("\n");
-    return task_to_run;
+// Work stealing: take a ready task from another CPU's run queue. Victims are
+// probed round-robin starting after 'cpu', with trylock so two idle cores
+// never wait on each other. Called with IRQs masked.
+static tcb_t *steal_task(cpu_t *cpu) {
+    for (uint32_t n = 1; n < smp_num_cpus; ++n) {
+        cpu_t *victim = &cpus[(cpu->id + n) % smp_num_cpus];
+        if (!victim->online ||
+            !__atomic_load_n(&victim->rq.nr_ready, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (!spin_trylock(&victim->rq.lock)) {
+            continue;
+        }
+        tcb_t *task = rq_steal_locked(victim);
+        spin_unlock(&victim->rq.lock);
+        if (task) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+// Return a dead task's TCB and stack to the free pools. Only called once no
+// CPU is running on the task's stack any more.
+static void task_reap(tcb_t *task) {
+    task->state = TASK_UNUSED;
+    pid_free(task->pid);  // Stale lookups of this PID fail from here on
+    if (task->addr_space) {
+        mmu_as_put(task->addr_space);  // We are no longer running in it
+    }
+    kstack_free(&task->stack);
+    kmem_cache_free(&tcb_cache, task);
 }
 
 // The scheduler.
-// Called from an interrupt context (e.g., timer IRQ).
-// current_task_sp_val: The value of SP for the task that was just interrupted,
-//                      pointing to its saved context_state_t.
-// Returns: The kernel_sp of the next task to run.
-uint64_t schedule(uint64_t current_task_sp_val) {
-    tcb_t *previous_task = current_task;
-
-    // Handle ZOMBIE task cleanup first
-    if (previous_task != NULL && previous_task->state == TASK_ZOMBIE &&
-        previous_task != idle_task_tcb) {
-        uart_puts("Scheduler: Cleaning up ZOMBIE task PID ");
-        print_uint(previous_task->pid);
-        uart_puts(".\n");
-
-        // Mark TCB as unused (assuming PID is the index in task_table)
-        // If PIDs are not direct indices, you'd need to find the TCB in
-        // task_table by PID.
-        task_table[previous_task->pid].state = TASK_UNUSED;
-
-        // Mark stack as free
-        if (previous_task->stack_idx < MAX_TASKS) {  // Basic bounds check
-            task_stacks_status[previous_task->stack_idx] = 0;
-        } else {
-            uart_puts("Scheduler: Invalid stack_idx for zombie task PID ");
-            print_uint(previous_task->pid);
-            uart_puts("\n");
+// Called with IRQs masked, either voluntarily from task context (yield,
+// block, exit) or from c_irq_handler() when preemption is due. Switches to
+// the next task with cpu_switch_to() and returns once the calling task has
+// been picked again, possibly on another CPU. A preempted task's exception
+// frame stays on its stack and is restored by the vector code on return.
+void schedule(void) {
+    cpu_t *cpu = this_cpu();
+    tcb_t *previous_task = cpu->curr_task;
+
+    cpu->need_resched = 0;
+
+    // Requeue the previously running task. A preempted task goes
+    // back on this CPU's run queue; a BLOCKED one stays off it until
+    // task_wake(); a ZOMBIE is reaped by finish_task_switch() once we are
+    // off its stack. The state check and the curr_task update happen under
+    // the run-queue lock so they are atomic with respect to task_wake().
+    spin_lock(&cpu->rq.lock);
+    if (previous_task != NULL) {
+        if (previous_task->state == TASK_RUNNING &&
+            previous_task != cpu->idle_task) {
+            previous_task->state = TASK_READY;
+            rq_enqueue_locked(cpu, previous_task);
         }
+    }
+    tcb_t *next_task = rq_dequeue_locked(&cpu->rq);
+    cpu->curr_task = next_task;  // NULL while we look elsewhere
+    spin_unlock(&cpu->rq.lock);
 
-        // Optionally: Clear other TCB fields, add PID to a free PID list for
-        // reuse. For now, we just mark as UNUSED.
+    if (next_task == NULL) {
+        next_task = steal_task(cpu);
+    }
 
-        if (current_task == previous_task) {
-            current_task = NULL;  // This task is gone.
+    if (next_task == NULL) {  // Nothing ready anywhere
+        if (!cpu->idle_task) {
+            panic("FATAL: Idle task TCB is NULL! Halting.\n");
         }
-        previous_task = NULL;  // Don't process this zombie task further (for
-                               // saving SP or re-queuing).
+        next_task = cpu->idle_task;
     }
 
-    // Save context of the (non-zombie) previously running task
-    if (previous_task != NULL && previous_task != idle_task_tcb) {
-        previous_task->kernel_sp = current_task_sp_val;
-        if (previous_task->state ==
-            TASK_RUNNING) {  // Only re-queue if it was running and not a zombie
-            previous_task->state = TASK_READY;
-            add_to_ready_queue(previous_task);
+    if (next_task != previous_task) {
+        // The CPU that last ran next_task may still be on its stack (it
+        // queued the task in its own schedule() and has not yet switched
+        // away). Wait for its finish_task_switch().
+        while (__atomic_load_n(&next_task->on_cpu, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
         }
-    } else if (previous_task == idle_task_tcb) {
-        idle_task_tcb->kernel_sp = current_task_sp_val;
-    } else if (previous_task == NULL && current_task != NULL) {
-        // This case might occur if current_task was set to NULL due to zombie
-        // cleanup and there was no *other* previous_task. Essentially, the
-        // initial state or post-zombie state.
+        next_task->on_cpu = 1;
+        cpu->prev_task = previous_task;
     }
 
-    tcb_t *next_task = get_next_ready_task();
+    spin_lock(&cpu->rq.lock);
+    next_task->state = TASK_RUNNING;
+    next_task->cpu = cpu->id;
+    cpu->curr_task = next_task;
+    spin_unlock(&cpu->rq.lock);
 
-    if (next_task == NULL) {  // Ready queue is empty
-        if (!idle_task_tcb) {
-            uart_puts("FATAL: Idle task TCB is NULL! Halting.\n");
-            while (1) __asm__ __volatile__("wfi");
-        }
-        current_task = idle_task_tcb;
+    // FP/SIMD registers are not switched here; the first FP instruction of
+    // next_task traps if someone else's registers are loaded.
+    fpsimd_switch_to(cpu, next_task);
+
+    // Dynamic tick: an idle CPU needs no periodic interrupt. It is woken by
+    // a reschedule IPI when work shows up (see smp_kick_idle_cpu()).
+    if (next_task == cpu->idle_task) {
+        timer_tick_stop();
     } else {
-        current_task = next_task;
+        timer_tick_restart();
+        // Work left queued here that a tickless idle core could take.
+        if (__atomic_load_n(&cpu->rq.nr_ready, __ATOMIC_RELAXED)) {
+            smp_kick_idle_cpu();
+        }
     }
 
-    if (current_task != NULL) {
-        current_task->state = TASK_RUNNING;
-        return current_task->kernel_sp;
-    } else {
-        // This should only be reached if idle_task_tcb was somehow NULL and
-        // ready queue was empty.
-        uart_puts(
-            "FATAL: current_task is NULL after scheduling decision! Returning "
-            "original SP.\n");
-        // This might return to kernel_main's WFI or whatever was running before
-        // the interrupt.
-        return current_task_sp_val;
+    if (next_task != previous_task) {
+        TRACE_EVENT(TRACE_SWITCH, next_task->pid,
+                    previous_task ? previous_task->pid : ~0ULL);
+        // Kernel stacks are in the shared mappings, so this is safe while
+        // still on previous_task's stack.
+        mmu_switch_to(next_task->addr_space);
+        // For the exception-entry stack check (vectors.s).
+        cpu->stack_limit = next_task->stack.mapped;
+        cpu_switch_to(previous_task, next_task);
+        // Running again as previous_task, on whichever CPU picked us.
+        finish_task_switch();
+    }
+}
+
+// Called on the new task's stack right after cpu_switch_to(): at the end of
+// schedule(), or from ret_from_fork for a task's first run. Only now is it
+// safe to let other CPUs resume the previous task, or to free it if it
+// exited.
+void finish_task_switch(void) {
+    cpu_t *cpu = this_cpu();
+    tcb_t *prev = cpu->prev_task;
+    cpu->prev_task = NULL;
+
+    if (prev && prev->state == TASK_ZOMBIE) {
+        pr_info("Scheduler: Cleaning up ZOMBIE task PID %u.\n", prev->pid);
+        prev->on_cpu = 0;
+        fpsimd_task_exit(cpu, prev);
+        task_reap(prev);
+    } else if (prev) {
+        __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
     }
-}  // This should be the only closing brace for the function.
\ No newline at end of file
+    // Replace what stack faults took from the reserve while we are at a
+    // point where taking the page allocator's lock is safe.
+    kstack_refill_reserve();
+}
@@ -4,10 +4,17 @@
 
 #include "common_macros.h"  // For TIMER_IRQ_ID
 #include "gic.h"            // For gic_enable_interrupt
+#include "hrtimer.h"
+#include "kprintf.h"
 #include "mmio.h"
-#include "uart.h"  // For uart_puts, print_uint, print_hex
+#include "smp.h"   // Per-CPU tick state
+
+// CNTP_CTL_EL0 bits
+#define CNTP_CTL_ENABLE (1U << 0)
+#define CNTP_CTL_IMASK (1U << 1)
 
 static uint64_t TIMER_INTERVAL_TICKS = 0;
+static uint64_t timer_freq_hz = 1;  // CNTFRQ_EL0, read by timer_init_periodic()
 
 // Remove 'static' to match declaration in timer.h
 uint64_t read_cntp_ctl_el0(void) {
@@ -21,51 +28,124 @@ void write_cntp_tval_el0(uint64_t val) {
     __asm__ __volatile__("msr cntp_tval_el0, %0" ::"r"(val));
 }
 
+void write_cntp_ctl_el0(uint64_t val) {
+    __asm__ __volatile__("msr cntp_ctl_el0, %0" ::"r"(val));
+    __asm__ __volatile__("isb");
+}
+
 void timer_init(uint32_t interval_ms) {
     uint64_t cntfrq;
     uint64_t ticks;
 
     __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(cntfrq));
-    uart_puts("  System Counter Frequency (CNTFRQ_EL0) read: ");
-    print_uint(cntfrq);
-    uart_puts(" Hz\n");
+    pr_debug("  System Counter Frequency (CNTFRQ_EL0) read: %lu Hz\n", cntfrq);
 
     ticks = (cntfrq * interval_ms) / 1000;
     TIMER_INTERVAL_TICKS = ticks;
 
-    uart_puts("  Timer interval calculated: ");
-    print_uint(ticks);
-    uart_puts(" ticks for ");
-    print_uint(interval_ms);
-    uart_puts(" ms\n");
+    pr_debug("  Timer interval calculated: %lu ticks for %u ms\n", ticks,
+             interval_ms);
 
     write_cntp_tval_el0(ticks);
 
     __asm__ __volatile__("msr cntp_ctl_el0, %0" ::"r"((uint64_t)0x1));
     uint64_t ctl_val_check = read_cntp_ctl_el0();
-    uart_puts("EL1 Physical Timer Initialized and Enabled. CNTP_CTL_EL0: 0x");
-    print_hex(ctl_val_check);
-    uart_puts("\n");
+    pr_debug("EL1 Physical Timer Initialized and Enabled. CNTP_CTL_EL0: 0x%lx\n",
+             ctl_val_check);
 
-    uart_puts("Enabling timer IRQ in GIC...\n");
     gic_enable_interrupt(TIMER_IRQ_ID, 0x01, 0xA0);
-    uart_puts("Timer IRQ enabling attempt complete.\n");
+}
+
+// Per-CPU periodic scheduler tick, implemented as a self-re-arming hrtimer
+// so it shares CNTP_CVAL_EL0 with every other pending timer on the CPU.
+static void tick_timer_fn(hrtimer_t *timer) {
+    cpu_t *cpu = this_cpu();
+    cpu->need_resched = 1;  // Time slice over
+
+    // Advance by whole periods so the tick does not drift, but never queue
+    // a deadline that is already in the past.
+    uint64_t next = timer->expires + TIMER_INTERVAL_TICKS;
+    uint64_t now = timer_read_counter();
+    if (next <= now) {
+        next = now + TIMER_INTERVAL_TICKS;
+    }
+    hrtimer_start(timer, next);
+}
+
+// Enable the timer PPI and start the periodic tick on the calling CPU.
+static void timer_start_local(void) {
+    cpu_t *cpu = this_cpu();
+    write_cntp_ctl_el0(0);  // Quiet until the first deadline is programmed
+    hrtimer_init(&cpu->tick_timer, tick_timer_fn, NULL);
+    cpu->tick_stopped = 0;
+    hrtimer_start(&cpu->tick_timer,
+                  timer_read_counter() + TIMER_INTERVAL_TICKS);
+    gic_enable_interrupt(TIMER_IRQ_ID, 0x01, 0xA0);
 }
 
 void timer_init_periodic(uint64_t interval_ticks) {
     TIMER_INTERVAL_TICKS = interval_ticks;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(timer_freq_hz));
 
-    write_cntp_tval_el0(interval_ticks);
+    timer_start_local();
 
-    __asm__ __volatile__("msr cntp_ctl_el0, %0" ::"r"((uint64_t)0x1));
-    uint64_t ctl_val_check = read_cntp_ctl_el0();
-    uart_puts("EL1 Physical Timer Initialized and Enabled. CNTP_CTL_EL0: 0x");
-    print_hex(ctl_val_check);
-    uart_puts("\n");
+    pr_debug("EL1 Physical Timer Initialized and Enabled. CNTP_CTL_EL0: 0x%lx\n",
+             read_cntp_ctl_el0());
+}
 
-    uart_puts("Enabling timer IRQ in GIC...\n");
-    gic_enable_interrupt(TIMER_IRQ_ID, 0x01, 0xA0);
-    uart_puts("Timer IRQ enabling attempt complete.\n");
+// Start the already-configured periodic tick on a secondary core. The EL1
+// physical timer and its PPI enable bit are per-core state.
+void timer_init_secondary(void) { timer_start_local(); }
+
+void handle_timer_irq(void) { hrtimer_interrupt(); }
+
+uint64_t timer_read_counter(void) {
+    uint64_t val;
+    // ISB so the read is not speculated ahead of earlier instructions.
+    __asm__ __volatile__("isb; mrs %0, cntpct_el0" : "=r"(val)::"memory");
+    return val;
+}
+
+uint64_t timer_ns_to_ticks(uint64_t ns) {
+    // Split to avoid overflowing ns * freq for long delays.
+    return (ns / 1000000000ULL) * timer_freq_hz +
+           ((ns % 1000000000ULL) * timer_freq_hz) / 1000000000ULL;
+}
+
+uint64_t timer_ticks_to_ns(uint64_t ticks) {
+    return (ticks / timer_freq_hz) * 1000000000ULL +
+           ((ticks % timer_freq_hz) * 1000000000ULL) / timer_freq_hz;
+}
+
+// Fire the EL1 physical timer when CNTPCT_EL0 reaches 'cval'. A deadline
+// already in the past fires immediately.
+void timer_set_deadline(uint64_t cval) {
+    __asm__ __volatile__("msr cntp_cval_el0, %0" ::"r"(cval));
+    write_cntp_ctl_el0(CNTP_CTL_ENABLE);
 }
 
-void handle_timer_irq(void) { write_cntp_tval_el0(TIMER_INTERVAL_TICKS); }
\ No newline at end of file
+// Dynamic tick: called by schedule() when this CPU is about to run its idle
+// task. The periodic tick is cancelled and the hardware is left programmed
+// for the next real deadline (e.g. a sleeping task's wakeup), or switched off
+// entirely if there is none. The CPU then sleeps in WFI until that deadline,
+// a device IRQ or a reschedule IPI.
+void timer_tick_stop(void) {
+    cpu_t *cpu = this_cpu();
+    if (cpu->tick_stopped) {
+        return;
+    }
+    hrtimer_cancel(&cpu->tick_timer);  // Re-programs CVAL or disables
+    cpu->tick_stopped = 1;
+}
+
+// Called by schedule() when this CPU picks a real task: bring the periodic
+// tick back so it can be preempted by whatever becomes runnable next.
+void timer_tick_restart(void) {
+    cpu_t *cpu = this_cpu();
+    if (!cpu->tick_stopped) {
+        return;
+    }
+    cpu->tick_stopped = 0;
+    hrtimer_start(&cpu->tick_timer,
+                  timer_read_counter() + TIMER_INTERVAL_TICKS);
+}
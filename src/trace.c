@@ -0,0 +1,89 @@
+#include "trace.h"
+
+#ifdef CONFIG_TRACE
+
+#include "common_macros.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "uart.h"
+
+typedef struct {
+    uint64_t head;  // Total records written; the next slot is head % size
+    trace_event_t events[TRACE_RING_ENTRIES];
+} trace_ring_t;
+
+_Static_assert(sizeof(trace_event_t) == 24,
+               "tools/trace2perfetto.py expects 24-byte trace records");
+_Static_assert((TRACE_RING_ENTRIES & (TRACE_RING_ENTRIES - 1)) == 0,
+               "TRACE_RING_ENTRIES must be a power of two");
+
+static trace_ring_t trace_rings[MAX_CPUS];
+static volatile uint32_t trace_enabled;
+
+void trace_init(void) {
+    for (uint32_t i = 0; i < MAX_CPUS; ++i) {
+        trace_rings[i].head = 0;
+    }
+    trace_enabled = 1;
+}
+
+void trace_record(uint32_t type, uint32_t arg0, uint64_t arg1) {
+    if (!trace_enabled) {
+        return;
+    }
+    // IRQs masked so an interrupt's own tracepoint cannot claim the same
+    // slot, and so the task cannot migrate away from this CPU's ring.
+    uint64_t flags = local_irq_save();
+    cpu_t *cpu = this_cpu();
+    trace_ring_t *ring = &trace_rings[cpu->id];
+    trace_event_t *ev = &ring->events[ring->head & (TRACE_RING_ENTRIES - 1)];
+    uint64_t ts;
+    __asm__ __volatile__("mrs %0, cntpct_el0" : "=r"(ts));
+    ev->ts = ts;
+    ev->type = (uint8_t)type;
+    ev->cpu = (uint8_t)cpu->id;
+    ev->arg0 = arg0;
+    ev->arg1 = arg1;
+    ring->head++;
+    local_irq_restore(flags);
+}
+
+// Print 'len' bytes as lowercase hex, in memory order.
+static void dump_bytes(const uint8_t *p, uint32_t len) {
+    static const char digits[] = "0123456789abcdef";
+    for (uint32_t i = 0; i < len; ++i) {
+        uart_putc(digits[p[i] >> 4]);
+        uart_putc(digits[p[i] & 0xF]);
+    }
+}
+
+// Stream every CPU's ring, oldest record first, as one line of raw record
+// bytes in hex per event between TRACE-BEGIN and TRACE-END markers.
+// Tracing is paused while dumping so the rings hold still.
+void trace_dump(void) {
+    trace_enabled = 0;
+
+    uint64_t freq;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+    uart_puts("TRACE-BEGIN freq=");
+    print_uint(freq);
+    uart_puts(" cpus=");
+    print_uint(smp_num_cpus);
+    uart_puts("\n");
+
+    for (uint32_t id = 0; id < smp_num_cpus; ++id) {
+        trace_ring_t *ring = &trace_rings[id];
+        uint64_t head = ring->head;
+        uint64_t start = head > TRACE_RING_ENTRIES ? head - TRACE_RING_ENTRIES : 0;
+        for (uint64_t i = start; i < head; ++i) {
+            dump_bytes((const uint8_t *)&ring->events[i & (TRACE_RING_ENTRIES - 1)],
+                       sizeof(trace_event_t));
+            uart_putc('\n');
+        }
+    }
+
+    uart_puts("TRACE-END\n");
+    trace_enabled = 1;
+}
+
+#endif  // CONFIG_TRACE
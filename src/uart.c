@@ -0,0 +1,322 @@
+#include "uart.h"
+
+#include <stddef.h>
+
+#include "common_macros.h"
+#include "gic.h"
+#include "mmio.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "task.h"
+#include "wait.h"
+
+#define UART_TX_RING_MASK (UART_TX_RING_SIZE - 1)
+#define UART_RX_RING_MASK (UART_RX_RING_SIZE - 1)
+
+_Static_assert((UART_TX_RING_SIZE & UART_TX_RING_MASK) == 0,
+               "UART_TX_RING_SIZE must be a power of two");
+_Static_assert((UART_RX_RING_SIZE & UART_RX_RING_MASK) == 0,
+               "UART_RX_RING_SIZE must be a power of two");
+
+enum { UART_MODE_SYNC, UART_MODE_RING, UART_MODE_PANIC };
+
+static volatile uint32_t uart_mode;  // UART_MODE_SYNC until uart_irq_init()
+
+// Multi-producer, single-consumer ring with free-running indices:
+//   tx_tail <= tx_commit <= tx_head <= tx_tail + UART_TX_RING_SIZE
+// A writer claims [head, head + n) with a CAS on tx_head, fills it, then
+// waits for tx_commit to reach 'head' (earlier claims published) and
+// advances it past its own bytes. The drainer, whoever holds tx_lock, sends
+// [tx_tail, tx_commit) and advances tx_tail. Writers keep IRQs masked from
+// claim to publish, so a claim is never left half written by an interrupt
+// on its own CPU.
+static char tx_ring[UART_TX_RING_SIZE];
+static uint64_t tx_head;
+static uint64_t tx_commit;
+static uint64_t tx_tail;
+static spinlock_t tx_lock = SPINLOCK_INIT;  // Drainer, never waited for
+static uint64_t tx_dropped;
+
+// Receive side. Only the CPU the UART interrupt is routed to produces, so
+// one lock covers the line being edited and the ring of input ready for
+// readers. Blocked readers wait on rx_wq.
+static spinlock_t rx_lock = SPINLOCK_INIT;
+static wait_queue_t rx_wq = WAIT_QUEUE_INIT;
+static uint32_t rx_mode = UART_RX_ECHO | UART_RX_LINE;
+static char rx_ring[UART_RX_RING_SIZE];
+static uint64_t rx_head;  // Free-running, like the TX indices
+static uint64_t rx_tail;
+static char rx_line[UART_RX_LINE_MAX];
+static uint32_t rx_line_len;
+static uint32_t rx_last_cr;  // Swallow the LF of a CR LF pair
+static uint64_t rx_dropped;
+
+// Move bytes from the ring into the TX FIFO until one runs out. If the FIFO
+// fills first, the TX interrupt is left unmasked to continue once the FIFO
+// drains; the PL011 only raises it on the way down through the trigger
+// level, so it is masked while there is nothing to send. tx_lock is only
+// held with IRQs masked: a holder preempted here would leave every other
+// drainer, the TX interrupt included, failing its trylock.
+static void uart_tx_drain(void) {
+    while (1) {
+        uint64_t flags = local_irq_save();
+        if (!spin_trylock(&tx_lock)) {
+            local_irq_restore(flags);
+            return;
+        }
+        uint64_t tail = tx_tail;
+        uint64_t commit = __atomic_load_n(&tx_commit, __ATOMIC_ACQUIRE);
+        while (tail != commit &&
+               !(mmio_read(UART_BASE + UART_FR) & UART_FR_TXFF)) {
+            mmio_write(UART_BASE + UART_DR,
+                       (uint8_t)tx_ring[tail & UART_TX_RING_MASK]);
+            tail++;
+        }
+        __atomic_store_n(&tx_tail, tail, __ATOMIC_RELEASE);
+
+        int pending = (tail != commit);
+        uint32_t imsc = mmio_read(UART_BASE + UART_IMSC);
+        imsc = pending ? (imsc | UART_INT_TX) : (imsc & ~UART_INT_TX);
+        mmio_write(UART_BASE + UART_IMSC, imsc);
+        spin_unlock(&tx_lock);
+        local_irq_restore(flags);
+
+        if (pending) {
+            return;  // The TX interrupt takes it from here
+        }
+        // A writer that published while we held the lock failed its
+        // trylock and relies on us to look again. Pairs with the fence in
+        // uart_write().
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&tx_commit, __ATOMIC_RELAXED) == tail) {
+            return;
+        }
+    }
+}
+
+static void uart_write_sync(const char *buf, uint64_t len) {
+    for (uint64_t i = 0; i < len; ++i) {
+        uart_putc_sync(buf[i]);
+    }
+}
+
+void uart_write(const char *buf, uint64_t len) {
+    while (len) {
+        if (uart_mode != UART_MODE_RING) {
+            uart_write_sync(buf, len);
+            return;
+        }
+
+        uint64_t flags = local_irq_save();
+        uint64_t head = __atomic_load_n(&tx_head, __ATOMIC_RELAXED);
+        uint64_t n;
+        do {
+            uint64_t used = head - __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE);
+            uint64_t space = UART_TX_RING_SIZE - used;
+            n = len < space ? len : space;
+        } while (n && !__atomic_compare_exchange_n(&tx_head, &head, head + n,
+                                                   1, __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED));
+        if (n == 0) {
+            local_irq_restore(flags);
+            if (flags & DAIF_IRQ_MASKED) {
+                // Waiting here could mean waiting for an interrupt that
+                // cannot be taken.
+                __atomic_fetch_add(&tx_dropped, len, __ATOMIC_RELAXED);
+                return;
+            }
+            uart_tx_drain();
+            cpu_relax();
+            continue;
+        }
+
+        for (uint64_t i = 0; i < n; ++i) {
+            tx_ring[(head + i) & UART_TX_RING_MASK] = buf[i];
+        }
+        while (__atomic_load_n(&tx_commit, __ATOMIC_RELAXED) != head) {
+            cpu_relax();  // An earlier claim is still being filled
+        }
+        __atomic_store_n(&tx_commit, head + n, __ATOMIC_RELEASE);
+        local_irq_restore(flags);
+
+        buf += n;
+        len -= n;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        uart_tx_drain();
+    }
+}
+
+void uart_puts(const char *s) {
+    uint64_t len = 0;
+    while (s[len]) {
+        len++;
+    }
+    uart_write(s, len);
+}
+
+void uart_putc(char c) { uart_write(&c, 1); }
+
+// Append to the ring readers take from, all or nothing. Caller holds
+// rx_lock.
+static int rx_deliver_locked(const char *buf, uint32_t len) {
+    if (UART_RX_RING_SIZE - (rx_head - rx_tail) < len) {
+        rx_dropped += len;
+        return -1;
+    }
+    for (uint32_t i = 0; i < len; ++i) {
+        rx_ring[(rx_head + i) & UART_RX_RING_MASK] = buf[i];
+    }
+    rx_head += len;
+    return 0;
+}
+
+// Line discipline for one received byte. Caller holds rx_lock. Returns 1
+// if readers have something new.
+static int rx_input_locked(char c) {
+    int echo = rx_mode & UART_RX_ECHO;
+
+    if (c == '\n' && rx_last_cr) {
+        rx_last_cr = 0;
+        return 0;
+    }
+    rx_last_cr = (c == '\r');
+    if (c == '\r') {
+        c = '\n';
+    }
+
+    if (!(rx_mode & UART_RX_LINE)) {
+        if (echo) {
+            uart_putc(c);
+        }
+        return rx_deliver_locked(&c, 1) == 0;
+    }
+
+    if (c == '\n') {
+        if (echo) {
+            uart_putc('\n');
+        }
+        rx_line[rx_line_len++] = '\n';  // Room kept for it below
+        rx_deliver_locked(rx_line, rx_line_len);
+        rx_line_len = 0;
+        return 1;
+    }
+    if (c == '\b' || c == 0x7f) {  // Backspace or DEL, depending on terminal
+        if (rx_line_len) {
+            rx_line_len--;
+            if (echo) {
+                uart_puts("\b \b");
+            }
+        }
+        return 0;
+    }
+    if ((uint8_t)c < 0x20 || rx_line_len >= UART_RX_LINE_MAX - 1) {
+        return 0;  // Other control characters, or the line is full
+    }
+    rx_line[rx_line_len++] = c;
+    if (echo) {
+        uart_putc(c);
+    }
+    return 0;
+}
+
+// Empty the receive FIFO through the line discipline.
+static void uart_rx_irq(void) {
+    int wake = 0;
+    spin_lock(&rx_lock);
+    while (!(mmio_read(UART_BASE + UART_FR) & UART_FR_RXFE)) {
+        uint32_t data = mmio_read(UART_BASE + UART_DR);
+        if (data & UART_DR_BAD) {
+            continue;  // Framing, parity or break: not a character
+        }
+        wake |= rx_input_locked((char)(data & 0xFF));
+    }
+    spin_unlock(&rx_lock);
+    if (wake) {
+        wake_up_all(&rx_wq);  // Readers re-check under rx_lock
+    }
+}
+
+static int rx_available(void) {
+    return __atomic_load_n(&rx_head, __ATOMIC_RELAXED) !=
+           __atomic_load_n(&rx_tail, __ATOMIC_RELAXED);
+}
+
+int64_t uart_read(char *buf, uint64_t len) {
+    if (!task_can_block()) {
+        return -1;
+    }
+
+    uint64_t flags;
+    while (1) {
+        wait_event(&rx_wq, rx_available());
+        flags = spin_lock_irqsave(&rx_lock);
+        if (rx_head != rx_tail) {
+            break;
+        }
+        spin_unlock_irqrestore(&rx_lock, flags);  // Another reader won
+    }
+
+    uint64_t n = 0;
+    while (n < len && rx_tail != rx_head) {
+        char c = rx_ring[rx_tail++ & UART_RX_RING_MASK];
+        buf[n++] = c;
+        if (c == '\n' && (rx_mode & UART_RX_LINE)) {
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&rx_lock, flags);
+    return (int64_t)n;
+}
+
+void uart_set_rx_mode(uint32_t mode) {
+    uint64_t flags = spin_lock_irqsave(&rx_lock);
+    rx_mode = mode;
+    rx_line_len = 0;
+    rx_tail = rx_head;
+    spin_unlock_irqrestore(&rx_lock, flags);
+}
+
+void uart_irq_init(void) {
+    // TX stays masked until there is a backlog (see uart_tx_drain()).
+    mmio_write(UART_BASE + UART_ICR, UART_INT_TX | UART_INT_RX | UART_INT_RT);
+    mmio_write(UART_BASE + UART_IMSC, UART_INT_RX | UART_INT_RT);
+    gic_enable_interrupt(INTERRUPT_ID_UART0, gic_cpu_mask(), 0xA0);
+    __atomic_store_n(&uart_mode, UART_MODE_RING, __ATOMIC_RELEASE);
+}
+
+void uart_irq_handler(void) {
+    uint32_t mis = mmio_read(UART_BASE + UART_MIS);
+    if (mis & (UART_INT_RX | UART_INT_RT)) {
+        // Reading the FIFO clears RX; the timeout needs an explicit clear.
+        mmio_write(UART_BASE + UART_ICR, UART_INT_RT);
+        uart_rx_irq();
+    }
+    if (mis & UART_INT_TX) {
+        mmio_write(UART_BASE + UART_ICR, UART_INT_TX);
+        uart_tx_drain();
+    }
+}
+
+void uart_panic_begin(void) {
+    uint64_t flags = local_irq_save();
+    if (uart_mode != UART_MODE_PANIC) {
+        uart_mode = UART_MODE_PANIC;
+        // Skip tx_lock: its holder may be this CPU, or one that will never
+        // run again. At worst a racing drainer repeats a few bytes.
+        uint64_t tail = __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE);
+        uint64_t commit = __atomic_load_n(&tx_commit, __ATOMIC_ACQUIRE);
+        while (tail != commit) {
+            uart_putc_sync(tx_ring[tail++ & UART_TX_RING_MASK]);
+        }
+        __atomic_store_n(&tx_tail, tail, __ATOMIC_RELEASE);
+    }
+    local_irq_restore(flags);
+}
+
+uint64_t uart_tx_dropped(void) {
+    return __atomic_load_n(&tx_dropped, __ATOMIC_RELAXED);
+}
+
+uint64_t uart_rx_dropped(void) {
+    return __atomic_load_n(&rx_dropped, __ATOMIC_RELAXED);
+}
@@ -1,7 +1,7 @@
 // filepath: src/uart.s
 .global uart_init
-.global uart_puts
-.global uart_putc
+.global uart_puts_sync
+.global uart_putc_sync
 .global print_hex
 .global print_uint
 
@@ -13,7 +13,19 @@ uart_init:
     stp x1, x2, [sp, #-16]!   // Save x1, x2
 
     ldr x0, =UART_BASE_CONST   // Load UART base address
-    mov w1, #0x101             // UARTCR: UARTEN (bit 0), TXE (bit 8) - Enable UART and TX
+
+    // UARTLCR_H may only change while the UART is disabled, and disabling
+    // it mid-character cuts that character short. We are called twice
+    // (boot.s, kernel_main), so let earlier output finish first.
+uart_init_wait_idle:
+    ldr w1, [x0, #0x18]        // UARTFR
+    tst w1, #(1 << 3)          // BUSY: still shifting out data
+    b.ne uart_init_wait_idle
+    str wzr, [x0, #0x30]       // UARTCR = 0: disable while reconfiguring
+
+    mov w1, #0x70              // UARTLCR_H: WLEN 8 bits (bits 6:5), FEN (bit 4) - FIFOs on
+    str w1, [x0, #0x2C]        // Write to UARTLCR_H (offset 0x2C)
+    mov w1, #0x301             // UARTCR: UARTEN (bit 0), TXE (bit 8), RXE (bit 9)
     str w1, [x0, #0x30]        // Write to UARTCR (offset 0x30)
     dsb sy                     // Data Synchronization Barrier
 
@@ -21,9 +33,11 @@ uart_init:
     ldp x30, x0, [sp], #16
     ret
 
-// Character output subroutine
+// Polled character output: waits for room in the TX FIFO. Used before
+// uart_irq_init() and for panics; everything else goes through the ring
+// buffer in uart.c.
 // Input: w0 = character to print (AAPCS64 for first argument)
-uart_putc:
+uart_putc_sync:
     stp x30, x1, [sp, #-16]!  // Save LR (x30) and x1 (used for UART base)
     stp x2, x3, [sp, #-16]!   // Save x2 (used for char) and x3 (used for UARTFR)
 
@@ -41,17 +55,17 @@ uart_wait_putc_loop:
     ldp x30, x1, [sp], #16
     ret
 
-// Subroutine to output a string to UART
+// Polled string output, see uart_putc_sync
 // Input: x0 = address of null-terminated string
-uart_puts:
+uart_puts_sync:
     stp x30, x19, [sp, #-16]! // Save LR (x30) and x19 (callee-saved, used for string pointer)
     
     mov x19, x0               // x19 = current address in string
 
 puts_loop:
-    ldrb w0, [x19], #1        // Load byte into w0 (argument for uart_putc), advance x19
+    ldrb w0, [x19], #1        // Load byte into w0 (argument for uart_putc_sync), advance x19
     cbz w0, puts_done         // If char is null, done
-    bl uart_putc              // Call uart_putc (expects char in w0)
+    bl uart_putc_sync         // Call uart_putc_sync (expects char in w0)
     b puts_loop
 
 puts_done:
@@ -108,11 +122,13 @@ hex_char_done:
 
 // Prints a 64-bit unsigned integer in decimal
 // Input: x0 = value to print
+// uart_putc is C code and may clobber x0-x18, so anything live across a
+// call stays in x19-x24.
 print_uint:
     stp x30, x19, [sp, #-16]! // Save LR, x19 (value being processed)
     stp x20, x21, [sp, #-16]! // Save x20 (buffer pointer), x21 (divisor 10)
     stp x22, x23, [sp, #-16]! // Save x22 (quotient), x23 (remainder/digit)
-    stp x4, x5, [sp, #-16]!   // Save x4 (digit count), x5 (scratch)
+    stp x24, x5, [sp, #-16]!  // Save x24 (digit count), x5 (scratch)
 
     mov x19, x0               // x19 = value to print
     mov x21, #10              // x21 = 10 (divisor)
@@ -130,7 +146,7 @@ print_uint_not_zero:
     sub sp, sp, #24
     mov x20, sp               // x20 = buffer pointer (points to start of buffer)
     
-    mov x4, #0                // x4 = digit_count, tracks number of digits stored in buffer
+    mov x24, #0               // x24 = digit_count, tracks number of digits stored in buffer
 
 print_uint_convert_loop:
     udiv x22, x19, x21        // x22 (quotient) = x19 / 10
@@ -138,8 +154,8 @@ print_uint_convert_loop:
                               // x23 is the current least significant digit (0-9)
 
     add w5, w23, #'0'         // Convert digit to ASCII char (use w5 as temp for w23)
-    strb w5, [x20, x4]        // Store char in buffer: buffer[digit_count] = char
-    add x4, x4, #1            // Increment digit_count
+    strb w5, [x20, x24]       // Store char in buffer: buffer[digit_count] = char
+    add x24, x24, #1          // Increment digit_count
 
     mov x19, x22              // value = quotient
     cmp x19, #0               // If value is zero, all digits extracted
@@ -149,10 +165,10 @@ print_uint_convert_loop:
     // Now print digits from buffer in correct order (MSD first)
     // which means printing from buffer[digit_count-1] down to buffer[0]
 print_uint_print_loop:
-    subs x4, x4, #1           // Decrement digit_count (now it's an index from count-1 down to 0)
-    bmi print_uint_print_done // If index < 0 (i.e., x4 becomes -1), all digits printed
+    subs x24, x24, #1         // Decrement digit_count (now it's an index from count-1 down to 0)
+    bmi print_uint_print_done // If index < 0 (i.e., x24 becomes -1), all digits printed
 
-    ldrb w0, [x20, x4]        // Load char from buffer[index] into w0 (arg for uart_putc)
+    ldrb w0, [x20, x24]       // Load char from buffer[index] into w0 (arg for uart_putc)
     bl uart_putc              // Print char
 
     b print_uint_print_loop
@@ -161,7 +177,7 @@ print_uint_print_done:
     add sp, sp, #24           // Deallocate stack buffer
 
 print_uint_cleanup:
-    ldp x4, x5, [sp], #16
+    ldp x24, x5, [sp], #16
     ldp x22, x23, [sp], #16
     ldp x20, x21, [sp], #16
     ldp x30, x19, [sp], #16
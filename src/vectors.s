@@ -2,6 +2,14 @@
 
 .global _exception_vector_table
 
+// Exception frame: SPSR/ELR plus x0-x30, padded to 16 bytes. Checked
+// against context_state_t in exceptions.c.
+.equ EXC_FRAME_SIZE, 272
+// cpu_t fields used by the stack check, checked in smp.c.
+.equ CPU_STACK_LIMIT, 8
+.equ CPU_FAULT_STACK_TOP, 16
+.equ CPU_ENTRY_SCRATCH, 24
+
 // Macro to save general-purpose registers x0-x29 and lr (x30)
 // Assumes SP is 16-byte aligned before this macro.
 // Saves 31 registers * 8 bytes/reg = 248 bytes.
@@ -47,6 +55,53 @@
     ldr x30,      [sp], #16*1    // Load lr (x30), SP is now SP + 16 (total SP + 256 from original base)
 .endm
 
+// Task stacks are grown on demand (see kstack.c), so the frame pushed at
+// exception entry may not fit in the mapped part of the stack; pushing it
+// would fault again, with nowhere to put that frame either. Compare SP
+// minus the frame size against this CPU's stack_limit first, using only
+// TPIDRRO_EL0 (unused: nothing runs at EL0) and the per-CPU scratch slot.
+// Falls through with every register intact, or branches to 'overflow'
+// with x0 = SP - EXC_FRAME_SIZE.
+.macro kstack_check overflow
+    msr tpidrro_el0, x0
+    mrs x0, tpidr_el1                    // this_cpu()
+    str x1, [x0, #CPU_ENTRY_SCRATCH]
+    ldr x1, [x0, #CPU_STACK_LIMIT]
+    mov x0, sp
+    sub x0, x0, #EXC_FRAME_SIZE
+    cmp x0, x1
+    b.lo \overflow
+    mrs x0, tpidr_el1
+    ldr x1, [x0, #CPU_ENTRY_SCRATCH]
+    mrs x0, tpidrro_el0
+.endm
+
+// Slow path of kstack_check: grow the stack from this CPU's fault stack,
+// then restart the entry at 'body' on the original stack. The original
+// x0 and x1 are still in TPIDRRO_EL0 and the scratch slot. IRQs are masked
+// and nothing here faults, so ELR/SPSR/ESR/FAR survive for 'body'.
+// kstack_entry_fault() does not return if the task overflowed.
+.macro kstack_overflow_stub body
+    mrs x1, tpidr_el1
+    ldr x1, [x1, #CPU_FAULT_STACK_TOP]
+    add x0, x0, #EXC_FRAME_SIZE          // Interrupted SP
+    mov sp, x1
+    str x0, [sp, #-16]!
+    mrs x0, tpidr_el1
+    ldr x1, [x0, #CPU_ENTRY_SCRATCH]
+    mrs x0, tpidrro_el0
+    save_gprs_lr
+    ldr x0, [sp, #16*16]                 // Interrupted SP
+    sub x0, x0, #EXC_FRAME_SIZE
+    bl kstack_entry_fault
+    restore_gprs_lr
+    msr tpidrro_el0, x0
+    ldr x0, [sp]
+    mov sp, x0                           // Back on the interrupted stack
+    mrs x0, tpidrro_el0
+    b \body
+.endm
+
 // Exception Vector Table
 // Each entry is 128 bytes (0x80)
 .align 11 // Align to 2^11 = 2048 bytes (0x800)
@@ -108,6 +163,8 @@ _exception_vector_table:
 
 // Synchronous exception handler from Current EL using SP_ELx (typically SP_EL1 for kernel)
 sync_current_el_spx_handler:
+    kstack_check sync_current_el_spx_overflow
+sync_current_el_spx_body:
     save_gprs_lr            // Save x0-x30. SP is now current_sp - 256. Stack: [GPRs]
 
     mrs x2, spsr_el1        // Get SPSR_EL1
@@ -118,9 +175,8 @@ sync_current_el_spx_handler:
     mov x1, sp              // Arg1 for c_sync_handler: pointer to context (points to SPSR_EL1 on stack)
     mrs x0, esr_el1         // Arg0 for c_sync_handler: ESR_EL1
     bl c_sync_handler       // Call C handler: c_sync_handler(esr_el1, context_ptr)
-
-    // Context might have been switched by scheduler if c_sync_handler called schedule() e.g. for SVC
-    // SP might now point to a different task's stack which has SPSR,ELR,GPRs saved in the same layout.
+                            // If it called schedule() (e.g. for an SVC), it only returns once
+                            // this task is running again; SP is back at our own frame.
 
     ldp x2, x3, [sp], #16   // Pop SPSR_EL1 into x2, ELR_EL1 into x3. SP is now current_sp - 256.
     msr spsr_el1, x2
@@ -129,8 +185,13 @@ sync_current_el_spx_handler:
     restore_gprs_lr         // Restore x0-x30. SP is restored to original value before save_gprs_lr.
     eret
 
+sync_current_el_spx_overflow:
+    kstack_overflow_stub sync_current_el_spx_body
+
 // IRQ handler from Current EL using SP_ELx
 irq_current_el_spx_handler:
+    kstack_check irq_current_el_spx_overflow
+irq_current_el_spx_body:
     save_gprs_lr            // Save x0-x30. Stack: [GPRs]
 
     mrs x2, spsr_el1
@@ -140,20 +201,20 @@ irq_current_el_spx_handler:
     mov x0, sp              // Arg0 for c_irq_handler: pointer to current context on stack
     bl c_irq_handler        // Call C handler: c_irq_handler(context_ptr)
                             // c_irq_handler will call schedule() if preemption is needed.
-                            // It returns the SP of the next task to run in x0.
-
-    mov sp, x0              // Set SP to the stack pointer of the next task to run.
-                            // This SP points to the SPSR_EL1 of the next task's saved context.
+                            // The task switched away sleeps inside schedule() with this frame
+                            // on its stack, and comes back here when it is picked again.
 
-    ldp x2, x3, [sp], #16   // Pop SPSR_EL1, ELR_EL1 from (potentially new) task's stack into x2, x3
-                            // SP is incremented by 16, now points to the GPRs of new task.
+    ldp x2, x3, [sp], #16   // Pop SPSR_EL1, ELR_EL1 from the interrupted task's frame
+                            // SP is incremented by 16, now points to its GPRs.
     msr spsr_el1, x2
     msr elr_el1, x3
 
-    restore_gprs_lr         // Restore GPRs from (potentially new) task's stack
-                            // SP will be restored to new_task_stack_base + sizeof(context_state_t)
+    restore_gprs_lr         // Restore GPRs of the interrupted task
     eret
 
+irq_current_el_spx_overflow:
+    kstack_overflow_stub irq_current_el_spx_body
+
 // FIQ handler from Current EL using SP_ELx
 fiq_current_el_spx_handler:
     save_gprs_lr
@@ -0,0 +1,245 @@
+#include "virtio.h"
+
+#include <stddef.h>
+
+#include "common_macros.h"
+#include "gic.h"
+#include "kprintf.h"
+#include "mmio.h"
+#include "page_alloc.h"
+#include "string.h"
+
+// Ring memory is shared with the device: order stores to it before the
+// stores that publish them (and the doorbell), and the used index load
+// before the entries it covers.
+#define virtio_wmb() __asm__ __volatile__("dmb oshst" ::: "memory")
+#define virtio_rmb() __asm__ __volatile__("dmb oshld" ::: "memory")
+#define virtio_mb() __asm__ __volatile__("dmb osh" ::: "memory")
+
+static void (*irq_handlers[VIRTIO_MMIO_SLOTS])(void);
+
+static inline uint32_t vreg_read(const virtio_dev_t *dev, uint32_t reg) {
+    return mmio_read(dev->base + reg);
+}
+
+static inline void vreg_write(const virtio_dev_t *dev, uint32_t reg,
+                              uint32_t val) {
+    mmio_write(dev->base + reg, val);
+}
+
+int virtio_probe(uint32_t device_id, virtio_dev_t *dev) {
+    for (uint32_t slot = 0; slot < VIRTIO_MMIO_SLOTS; ++slot) {
+        uintptr_t base = VIRTIO_MMIO_BASE + slot * VIRTIO_MMIO_STRIDE;
+        if (mmio_read(base + VIRTIO_MMIO_MAGIC) != VIRTIO_MMIO_MAGIC_VALUE ||
+            mmio_read(base + VIRTIO_MMIO_DEVICE_ID) != device_id) {
+            continue;
+        }
+        uint32_t version = mmio_read(base + VIRTIO_MMIO_VERSION);
+        if (version != 1 && version != 2) {
+            pr_warn("virtio: slot %u has unknown version %u\n", slot, version);
+            continue;
+        }
+        dev->base = base;
+        dev->slot = slot;
+        dev->irq = INTERRUPT_ID_VIRTIO_MMIO + slot;
+        dev->version = version;
+
+        vreg_write(dev, VIRTIO_MMIO_STATUS, 0);  // Reset
+        vreg_write(dev, VIRTIO_MMIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+        vreg_write(dev, VIRTIO_MMIO_STATUS,
+                   VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+        return 0;
+    }
+    return -1;
+}
+
+int64_t virtio_negotiate(virtio_dev_t *dev, uint64_t wanted) {
+    if (dev->version == 2) {
+        wanted |= 1UL << VIRTIO_F_VERSION_1;
+    }
+    vreg_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
+    uint64_t offered = vreg_read(dev, VIRTIO_MMIO_DEVICE_FEATURES);
+    vreg_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
+    offered |= (uint64_t)vreg_read(dev, VIRTIO_MMIO_DEVICE_FEATURES) << 32;
+
+    uint64_t accepted = offered & wanted;
+    vreg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
+    vreg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)accepted);
+    vreg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
+    vreg_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)(accepted >> 32));
+
+    if (dev->version == 1) {
+        return (int64_t)accepted;  // Legacy devices have no FEATURES_OK
+    }
+    if (!(accepted & (1UL << VIRTIO_F_VERSION_1))) {
+        virtio_fail(dev);
+        return -1;
+    }
+    uint32_t status = vreg_read(dev, VIRTIO_MMIO_STATUS);
+    vreg_write(dev, VIRTIO_MMIO_STATUS, status | VIRTIO_STATUS_FEATURES_OK);
+    if (!(vreg_read(dev, VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+        virtio_fail(dev);
+        return -1;
+    }
+    return (int64_t)accepted;
+}
+
+void virtio_driver_ok(virtio_dev_t *dev) {
+    uint32_t status = vreg_read(dev, VIRTIO_MMIO_STATUS);
+    vreg_write(dev, VIRTIO_MMIO_STATUS, status | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(virtio_dev_t *dev) {
+    uint32_t status = vreg_read(dev, VIRTIO_MMIO_STATUS);
+    vreg_write(dev, VIRTIO_MMIO_STATUS, status | VIRTIO_STATUS_FAILED);
+}
+
+int virtq_init(virtq_t *vq, virtio_dev_t *dev, uint32_t index,
+               uint32_t max_size) {
+    vreg_write(dev, VIRTIO_MMIO_QUEUE_SEL, index);
+    if (dev->version == 2 ? vreg_read(dev, VIRTIO_MMIO_QUEUE_READY)
+                          : vreg_read(dev, VIRTIO_MMIO_QUEUE_PFN)) {
+        return -1;  // Already in use
+    }
+    uint32_t size = vreg_read(dev, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if (size == 0) {
+        return -1;
+    }
+    if (size > max_size) {
+        size = max_size;
+    }
+    if (size > VIRTQ_MAX_SIZE) {
+        size = VIRTQ_MAX_SIZE;
+    }
+    size = 1U << (31 - __builtin_clz(size));  // Split rings: power of two
+
+    // The legacy layout, which modern devices accept too: descriptors, then
+    // the avail ring, then the used ring on the next page boundary. The
+    // trailing uint16_t of each ring is the unused event index.
+    uint64_t avail_off = size * sizeof(virtq_desc_t);
+    uint64_t used_off = avail_off + sizeof(virtq_avail_t) +
+                        (size + 1) * sizeof(uint16_t);
+    used_off = (used_off + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint64_t bytes = used_off + sizeof(virtq_used_t) +
+                     size * sizeof(virtq_used_elem_t) + sizeof(uint16_t);
+
+    vq->order = page_order_for(bytes);
+    uint8_t *mem = page_alloc(vq->order);
+    if (!mem) {
+        return -1;
+    }
+    memset(mem, 0, PAGE_SIZE << vq->order);
+
+    vq->base = dev->base;
+    vq->index = index;
+    vq->size = size;
+    vq->desc = (virtq_desc_t *)mem;
+    vq->avail = (virtq_avail_t *)(mem + avail_off);
+    vq->used = (virtq_used_t *)(mem + used_off);
+    for (uint32_t i = 0; i < size; ++i) {
+        vq->desc[i].next = (uint16_t)(i + 1);
+    }
+    vq->free_head = 0;
+    vq->num_free = (uint16_t)size;
+    vq->avail_idx = 0;
+    vq->avail_published = 0;
+    vq->last_used = 0;
+    vq->notifies = 0;
+
+    uint64_t pa = (uint64_t)mem;  // Identity mapped
+    vreg_write(dev, VIRTIO_MMIO_QUEUE_NUM, size);
+    if (dev->version == 1) {
+        vreg_write(dev, VIRTIO_MMIO_GUEST_PAGE_SIZE, PAGE_SIZE);
+        vreg_write(dev, VIRTIO_MMIO_QUEUE_ALIGN, PAGE_SIZE);
+        vreg_write(dev, VIRTIO_MMIO_QUEUE_PFN, (uint32_t)(pa >> PAGE_SHIFT));
+    } else {
+        uint64_t avail = pa + avail_off;
+        uint64_t used = pa + used_off;
+        vreg_write(dev, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t)pa);
+        vreg_write(dev, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t)(pa >> 32));
+        vreg_write(dev, VIRTIO_MMIO_QUEUE_DRIVER_LOW, (uint32_t)avail);
+        vreg_write(dev, VIRTIO_MMIO_QUEUE_DRIVER_HIGH, (uint32_t)(avail >> 32));
+        vreg_write(dev, VIRTIO_MMIO_QUEUE_DEVICE_LOW, (uint32_t)used);
+        vreg_write(dev, VIRTIO_MMIO_QUEUE_DEVICE_HIGH, (uint32_t)(used >> 32));
+        vreg_write(dev, VIRTIO_MMIO_QUEUE_READY, 1);
+    }
+    return 0;
+}
+
+int32_t virtq_alloc_chain(virtq_t *vq, uint32_t count) {
+    if (count == 0 || vq->num_free < count) {
+        return -1;
+    }
+    uint16_t head = vq->free_head;
+    uint16_t idx = head;
+    for (uint32_t i = 0; i < count; ++i) {
+        virtq_desc_t *d = &vq->desc[idx];
+        d->flags = (i + 1 < count) ? VIRTQ_DESC_F_NEXT : 0;
+        if (i + 1 < count) {
+            idx = d->next;
+        }
+    }
+    vq->free_head = vq->desc[idx].next;
+    vq->num_free -= (uint16_t)count;
+    return head;
+}
+
+void virtq_push(virtq_t *vq, uint16_t head) {
+    vq->avail->ring[vq->avail_idx & (vq->size - 1)] = head;
+    vq->avail_idx++;
+}
+
+int virtq_kick(virtq_t *vq) {
+    if (vq->avail_idx == vq->avail_published) {
+        return 0;
+    }
+    virtio_wmb();  // Descriptors and ring entries before the index
+    vq->avail->idx = vq->avail_idx;
+    vq->avail_published = vq->avail_idx;
+    // The index before reading the device's flags, and before the doorbell.
+    virtio_mb();
+    if (vq->used->flags & VIRTQ_USED_F_NO_NOTIFY) {
+        return 0;  // The device is already working through the ring
+    }
+    mmio_write(vq->base + VIRTIO_MMIO_QUEUE_NOTIFY, vq->index);
+    vq->notifies++;
+    return 1;
+}
+
+int32_t virtq_pop_used(virtq_t *vq, uint32_t *len) {
+    if (vq->last_used == vq->used->idx) {
+        return -1;
+    }
+    virtio_rmb();  // The index before the entry it covers
+    virtq_used_elem_t *elem = &vq->used->ring[vq->last_used & (vq->size - 1)];
+    uint16_t head = (uint16_t)elem->id;
+    if (len) {
+        *len = elem->len;
+    }
+    vq->last_used++;
+
+    // Return the chain to the free list, tail first.
+    uint16_t idx = head;
+    uint16_t count = 1;
+    while (vq->desc[idx].flags & VIRTQ_DESC_F_NEXT) {
+        idx = vq->desc[idx].next;
+        count++;
+    }
+    vq->desc[idx].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += count;
+    return head;
+}
+
+void virtio_set_irq_handler(virtio_dev_t *dev, void (*handler)(void)) {
+    irq_handlers[dev->slot] = handler;
+    gic_enable_interrupt(dev->irq, gic_cpu_mask(), 0xA0);
+}
+
+void virtio_irq_handler(uint32_t slot) {
+    if (slot < VIRTIO_MMIO_SLOTS && irq_handlers[slot]) {
+        irq_handlers[slot]();
+    } else {
+        pr_warn("virtio: interrupt from unclaimed slot %u\n", slot);
+    }
+}
@@ -0,0 +1,297 @@
+#include "virtio_blk.h"
+
+#include <stddef.h>
+
+#include "kprintf.h"
+#include "mmio.h"
+#include "page_alloc.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "task.h"
+#include "virtio.h"
+
+#define VIRTIO_BLK_S_OK 0
+
+// Offsets in the device configuration space
+#define VIRTIO_BLK_CFG_CAPACITY 0x00  // uint64_t, in sectors
+#define VIRTIO_BLK_CFG_SEG_MAX 0x0c   // uint32_t, with VIRTIO_BLK_F_SEG_MAX
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} virtio_blk_hdr_t;
+
+// One lock covers the queue, the per-chain state and the backlog; the
+// interrupt handler takes it too, so task paths mask IRQs while holding it.
+static spinlock_t blk_lock = SPINLOCK_INIT;
+static virtio_dev_t blk_dev;
+static virtq_t blk_vq;
+static int blk_present;
+static uint64_t blk_capacity;
+static uint64_t blk_features;
+static uint32_t blk_max_segs;
+
+// Per-chain state, indexed by the chain's head descriptor. The header and
+// status byte are read and written by the device, so they live here in
+// identity-mapped .bss rather than in the caller's request.
+static virtio_blk_hdr_t blk_hdrs[VIRTQ_MAX_SIZE];
+static volatile uint8_t blk_status[VIRTQ_MAX_SIZE];
+static virtio_blk_req_t *blk_inflight[VIRTQ_MAX_SIZE];
+
+// Requests that did not fit in the ring, oldest first
+static virtio_blk_req_t *backlog_head;
+static virtio_blk_req_t *backlog_tail;
+
+static virtio_blk_stats_t blk_stats;
+
+static uint32_t cfg_read32(uint32_t off) {
+    return mmio_read(blk_dev.base + VIRTIO_MMIO_CONFIG + off);
+}
+
+// Non-zero if [buf, buf + len) is RAM the device can reach at the same
+// address.
+static int dma_ok(const void *buf, uint32_t len) {
+    return len && virt_to_page(buf) &&
+           virt_to_page((const uint8_t *)buf + len - 1);
+}
+
+// Put 'req' in the avail ring as header, data segments, status. Caller
+// holds blk_lock. Returns -1 if the ring lacks descriptors.
+static int blk_post_locked(virtio_blk_req_t *req) {
+    int32_t head = virtq_alloc_chain(&blk_vq, req->nr_segs + 2);
+    if (head < 0) {
+        return -1;
+    }
+
+    virtio_blk_hdr_t *hdr = &blk_hdrs[head];
+    hdr->type = req->type;
+    hdr->reserved = 0;
+    hdr->sector = req->sector;
+    blk_status[head] = 0xFF;  // Overwritten by the device
+    blk_inflight[head] = req;
+
+    virtq_desc_t *desc = blk_vq.desc;
+    uint16_t idx = (uint16_t)head;
+    desc[idx].addr = (uint64_t)hdr;
+    desc[idx].len = sizeof(*hdr);
+    for (uint32_t i = 0; i < req->nr_segs; ++i) {
+        idx = desc[idx].next;
+        desc[idx].addr = (uint64_t)req->segs[i].buf;
+        desc[idx].len = req->segs[i].len;
+        if (req->type == VIRTIO_BLK_T_IN) {
+            desc[idx].flags |= VIRTQ_DESC_F_WRITE;
+        }
+    }
+    idx = desc[idx].next;
+    desc[idx].addr = (uint64_t)&blk_status[head];
+    desc[idx].len = 1;
+    desc[idx].flags |= VIRTQ_DESC_F_WRITE;
+
+    virtq_push(&blk_vq, (uint16_t)head);
+    return 0;
+}
+
+// Caller holds blk_lock.
+static void blk_kick_locked(void) {
+    if (virtq_kick(&blk_vq)) {
+        blk_stats.notifies++;
+    }
+}
+
+static void virtio_blk_irq_handler(void) {
+    uint32_t isr = mmio_read(blk_dev.base + VIRTIO_MMIO_INTERRUPT_STATUS);
+    mmio_write(blk_dev.base + VIRTIO_MMIO_INTERRUPT_ACK, isr);
+
+    virtio_blk_req_t *callbacks = NULL;
+    virtio_blk_req_t **callbacks_tail = &callbacks;
+
+    spin_lock(&blk_lock);
+    blk_stats.interrupts++;
+    int32_t head;
+    while ((head = virtq_pop_used(&blk_vq, NULL)) >= 0) {
+        virtio_blk_req_t *req = blk_inflight[head];
+        blk_inflight[head] = NULL;
+        int32_t status = (blk_status[head] == VIRTIO_BLK_S_OK) ? 0 : -1;
+        blk_stats.completed++;
+        if (req->done) {
+            req->status = status;
+            req->next = NULL;
+            *callbacks_tail = req;
+            callbacks_tail = &req->next;
+            continue;
+        }
+        // The waiter may free 'req' as soon as it sees the status, so it
+        // is the last thing touched.
+        struct tcb *waiter = req->waiter;
+        __atomic_store_n(&req->status, status, __ATOMIC_RELEASE);
+        if (waiter) {
+            task_wake(waiter);
+        }
+    }
+
+    // Descriptors came back: move what the backlog can now fit into the
+    // ring, with one doorbell for all of it.
+    while (backlog_head && blk_post_locked(backlog_head) == 0) {
+        backlog_head = backlog_head->next;
+    }
+    if (!backlog_head) {
+        backlog_tail = NULL;
+    }
+    blk_kick_locked();
+    spin_unlock(&blk_lock);
+
+    while (callbacks) {
+        virtio_blk_req_t *req = callbacks;
+        callbacks = req->next;  // done() may reuse the request
+        req->done(req);
+    }
+}
+
+int virtio_blk_init(void) {
+    if (virtio_probe(VIRTIO_ID_BLOCK, &blk_dev) < 0) {
+        pr_info("virtio-blk: no disk\n");
+        return -1;
+    }
+    int64_t features = virtio_negotiate(
+        &blk_dev, (1UL << VIRTIO_BLK_F_SEG_MAX) | (1UL << VIRTIO_BLK_F_RO) |
+                      (1UL << VIRTIO_BLK_F_FLUSH));
+    if (features < 0) {
+        pr_err("virtio-blk: feature negotiation failed\n");
+        return -1;
+    }
+    blk_features = (uint64_t)features;
+
+    blk_max_segs = VIRTIO_BLK_MAX_SEGS;
+    if (blk_features & (1UL << VIRTIO_BLK_F_SEG_MAX)) {
+        uint32_t seg_max = cfg_read32(VIRTIO_BLK_CFG_SEG_MAX);
+        if (seg_max && seg_max < blk_max_segs) {
+            blk_max_segs = seg_max;
+        }
+    }
+    blk_capacity = cfg_read32(VIRTIO_BLK_CFG_CAPACITY) |
+                   ((uint64_t)cfg_read32(VIRTIO_BLK_CFG_CAPACITY + 4) << 32);
+
+    if (virtq_init(&blk_vq, &blk_dev, 0, VIRTIO_BLK_QUEUE_SIZE) < 0) {
+        pr_err("virtio-blk: cannot set up the request queue\n");
+        virtio_fail(&blk_dev);
+        return -1;
+    }
+    virtio_set_irq_handler(&blk_dev, virtio_blk_irq_handler);
+    virtio_driver_ok(&blk_dev);
+    blk_present = 1;
+
+    pr_info("virtio-blk: slot %u (v%u), %lu sectors%s, %u-entry queue\n",
+            blk_dev.slot, blk_dev.version, blk_capacity,
+            virtio_blk_read_only() ? " read-only" : "", blk_vq.size);
+    return 0;
+}
+
+int virtio_blk_present(void) { return blk_present; }
+
+uint64_t virtio_blk_capacity(void) { return blk_capacity; }
+
+int virtio_blk_read_only(void) {
+    return (blk_features & (1UL << VIRTIO_BLK_F_RO)) != 0;
+}
+
+int virtio_blk_submit(virtio_blk_req_t *req) {
+    if (!blk_present) {
+        return -1;
+    }
+    if (req->type == VIRTIO_BLK_T_FLUSH) {
+        if (req->nr_segs != 0) {
+            return -1;
+        }
+    } else if (req->type == VIRTIO_BLK_T_IN || req->type == VIRTIO_BLK_T_OUT) {
+        if (req->nr_segs == 0 || req->nr_segs > blk_max_segs ||
+            (req->type == VIRTIO_BLK_T_OUT && virtio_blk_read_only())) {
+            return -1;
+        }
+        uint64_t sectors = 0;
+        for (uint32_t i = 0; i < req->nr_segs; ++i) {
+            const virtio_blk_seg_t *seg = &req->segs[i];
+            if (seg->len % VIRTIO_BLK_SECTOR_SIZE ||
+                !dma_ok(seg->buf, seg->len)) {
+                return -1;
+            }
+            sectors += seg->len / VIRTIO_BLK_SECTOR_SIZE;
+        }
+        if (req->sector > blk_capacity || sectors > blk_capacity - req->sector) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+
+    req->status = VIRTIO_BLK_PENDING;
+    req->waiter = NULL;
+    req->next = NULL;
+
+    uint64_t flags = spin_lock_irqsave(&blk_lock);
+    blk_stats.requests++;
+    // Behind a backlog, wait in line even if this one would fit.
+    if (backlog_head || blk_post_locked(req) < 0) {
+        if (backlog_tail) {
+            backlog_tail->next = req;
+        } else {
+            backlog_head = req;
+        }
+        backlog_tail = req;
+        blk_stats.backlogged++;
+    }
+    spin_unlock_irqrestore(&blk_lock, flags);
+    return 0;
+}
+
+void virtio_blk_kick(void) {
+    uint64_t flags = spin_lock_irqsave(&blk_lock);
+    blk_kick_locked();
+    spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+int32_t virtio_blk_wait(virtio_blk_req_t *req) {
+    uint64_t flags = spin_lock_irqsave(&blk_lock);
+    blk_kick_locked();
+    if (req->status == VIRTIO_BLK_PENDING && !task_can_block()) {
+        spin_unlock_irqrestore(&blk_lock, flags);
+        return -1;
+    }
+    tcb_t *self = this_cpu()->curr_task;
+    while (req->status == VIRTIO_BLK_PENDING) {
+        // Marked BLOCKED under blk_lock, which the IRQ takes to complete
+        // the request, so the wakeup cannot slip in between.
+        self->state = TASK_BLOCKED;
+        req->waiter = self;
+        spin_unlock(&blk_lock);
+        task_block();  // IRQs stay masked until we are off the CPU
+        spin_lock(&blk_lock);
+    }
+    int32_t status = req->status;
+    spin_unlock_irqrestore(&blk_lock, flags);
+    return status;
+}
+
+int32_t virtio_blk_rw(uint32_t type, uint64_t sector, void *buf,
+                      uint32_t len) {
+    virtio_blk_req_t req;
+    req.type = type;
+    req.sector = sector;
+    req.nr_segs = 1;
+    req.segs[0].buf = buf;
+    req.segs[0].len = len;
+    req.done = NULL;
+    req.data = NULL;
+    // 'req' is on our stack, so it must not be submitted unless we can
+    // wait for it to complete.
+    if (!task_can_block() || virtio_blk_submit(&req) < 0) {
+        return -1;
+    }
+    return virtio_blk_wait(&req);
+}
+
+void virtio_blk_get_stats(virtio_blk_stats_t *stats) {
+    uint64_t flags = spin_lock_irqsave(&blk_lock);
+    *stats = blk_stats;
+    spin_unlock_irqrestore(&blk_lock, flags);
+}
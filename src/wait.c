@@ -0,0 +1,85 @@
+#include "wait.h"
+
+#include <stddef.h>
+
+#include "smp.h"
+#include "spinlock.h"
+#include "task.h"
+#include "trace.h"
+
+void wait_queue_init(wait_queue_t *wq) {
+    spin_lock_init(&wq->lock);
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+// Caller holds wq->lock.
+static void wq_unlink_locked(wait_queue_t *wq, wait_entry_t *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wq->head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        wq->tail = entry->prev;
+    }
+    entry->next = NULL;
+    entry->prev = NULL;
+    entry->queued = 0;
+}
+
+void prepare_to_wait(wait_queue_t *wq, wait_entry_t *entry) {
+    tcb_t *self = current_task;  // IRQs are masked
+    spin_lock(&wq->lock);
+    if (!entry->queued) {
+        entry->task = self;
+        entry->next = NULL;
+        entry->prev = wq->tail;
+        if (wq->tail) {
+            wq->tail->next = entry;
+        } else {
+            wq->head = entry;
+        }
+        wq->tail = entry;
+        entry->queued = 1;
+    }
+    // Under wq->lock, which wakers take, so a wakeup from here on finds
+    // the task BLOCKED and cancels or undoes the block.
+    self->state = TASK_BLOCKED;
+    TRACE_EVENT(TRACE_TASK_STATE, self->pid, TASK_BLOCKED);
+    spin_unlock(&wq->lock);
+}
+
+void finish_wait(wait_queue_t *wq, wait_entry_t *entry) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    // Still BLOCKED if the condition held before anyone woke us; a waker
+    // that got here first has already made us RUNNING.
+    entry->task->state = TASK_RUNNING;
+    if (entry->queued) {
+        wq_unlink_locked(wq, entry);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+int wake_up_one(wait_queue_t *wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    wait_entry_t *entry = wq->head;
+    if (entry) {
+        wq_unlink_locked(wq, entry);
+        task_wake(entry->task);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return entry != NULL;
+}
+
+void wake_up_all(wait_queue_t *wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    while (wq->head) {
+        wait_entry_t *entry = wq->head;
+        wq_unlink_locked(wq, entry);
+        task_wake(entry->task);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Convert a picOS trace dump (see include/trace.h) to Chrome/Perfetto JSON.
+
+Usage: trace2perfetto.py uart.log > trace.json
+
+Reads the lines between TRACE-BEGIN and TRACE-END; each is one 24-byte
+trace_event_t in hex. Open the output in ui.perfetto.dev or chrome://tracing.
+"""
+
+import json
+import struct
+import sys
+
+RECORD = struct.Struct("<QBBHIQ")  # ts, type, cpu, reserved, arg0, arg1
+
+TRACE_SWITCH = 1
+TRACE_IRQ_ENTRY = 2
+TRACE_IRQ_EXIT = 3
+TRACE_TASK_STATE = 4
+TRACE_TIMER_EXPIRE = 5
+
+TASK_STATES = ["UNUSED", "READY", "RUNNING", "BLOCKED", "ZOMBIE"]
+NO_PID = 0xFFFFFFFF
+
+
+def read_dump(lines):
+    freq, records, inside = None, [], False
+    for line in lines:
+        line = line.strip()
+        if line.startswith("TRACE-BEGIN"):
+            fields = dict(f.split("=") for f in line.split()[1:])
+            freq = int(fields["freq"])
+            records, inside = [], True  # Keep only the last dump
+        elif line == "TRACE-END":
+            inside = False
+        elif inside and len(line) == RECORD.size * 2:
+            records.append(RECORD.unpack(bytes.fromhex(line)))
+    if freq is None:
+        sys.exit("no TRACE-BEGIN marker found")
+    return freq, sorted(records)
+
+
+def to_events(freq, records):
+    t0 = records[0][0] if records else 0
+    events = []
+    running = {}  # cpu -> pid of the open task slice
+
+    def us(ts):
+        return (ts - t0) * 1e6 / freq
+
+    for ts, kind, cpu, _, arg0, arg1 in records:
+        t = us(ts)
+        if kind == TRACE_SWITCH:
+            if cpu in running:
+                events.append({"ph": "E", "pid": 0, "tid": cpu, "ts": t})
+            events.append({"ph": "B", "pid": 0, "tid": cpu, "ts": t,
+                           "name": "pid %#x" % arg0})
+            running[cpu] = arg0
+        elif kind == TRACE_IRQ_ENTRY:
+            events.append({"ph": "B", "pid": 1, "tid": cpu, "ts": t,
+                           "name": "irq %d" % arg0})
+        elif kind == TRACE_IRQ_EXIT:
+            events.append({"ph": "E", "pid": 1, "tid": cpu, "ts": t})
+        elif kind == TRACE_TASK_STATE:
+            state = TASK_STATES[arg1] if arg1 < len(TASK_STATES) else str(arg1)
+            events.append({"ph": "i", "s": "t", "pid": 0, "tid": cpu,
+                           "ts": t, "name": "pid %#x -> %s" % (arg0, state)})
+        elif kind == TRACE_TIMER_EXPIRE:
+            events.append({"ph": "i", "s": "t", "pid": 1, "tid": cpu,
+                           "ts": t, "name": "hrtimer %#x" % arg1})
+
+    meta = [{"ph": "M", "pid": 0, "name": "process_name",
+             "args": {"name": "Tasks"}},
+            {"ph": "M", "pid": 1, "name": "process_name",
+             "args": {"name": "IRQs"}}]
+    for cpu in sorted({r[2] for r in records}):
+        for pid in (0, 1):
+            meta.append({"ph": "M", "pid": pid, "tid": cpu,
+                         "name": "thread_name",
+                         "args": {"name": "CPU %d" % cpu}})
+    return meta + events
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    with open(sys.argv[1], errors="replace") as f:
+        freq, records = read_dump(f)
+    json.dump({"traceEvents": to_events(freq, records),
+               "displayTimeUnit": "ns"}, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()